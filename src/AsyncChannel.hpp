@@ -0,0 +1,211 @@
+#ifndef COMMS_PROTOBUF_ASYNC_CHANNEL_HPP
+#define COMMS_PROTOBUF_ASYNC_CHANNEL_HPP
+
+#include <functional>
+#include <comms_protobuf/Channel.hpp>
+#include <comms_protobuf/Reactor.hpp>
+
+namespace comms_protobuf {
+    /**
+     * Services a Channel from a Reactor
+     *
+     * Received messages are delivered through a callback from within
+     * Reactor::poll. Written messages are queued and sent when the channel's
+     * file descriptor is writable, without blocking the reactor thread.
+     *
+     * The channel must be opened before the AsyncChannel is created, and
+     * must stay valid until it is destroyed. It must not be used directly
+     * in the meantime.
+     *
+     * Each readable event processes the data available at that time only,
+     * the rest is handled at the next Reactor::poll.
+     */
+    template<typename Local, typename Remote,
+             typename Framing = policies::VarintFraming,
+             typename Integrity = policies::CRC16Integrity,
+             typename Cipher = policies::RuntimeCipher>
+    class AsyncChannel : public Reactor::Handler {
+    public:
+        typedef Channel<Local, Remote, Framing, Integrity, Cipher> ChannelType;
+        typedef std::function<void(Remote&)> MessageCallback;
+        typedef std::function<void(std::exception const&)> ErrorCallback;
+        typedef std::function<void()> DrainedCallback;
+
+        /**
+         * @arg max_queue_size write() refuses new messages while this many
+         *   bytes are queued
+         */
+        AsyncChannel(Reactor& reactor, ChannelType& channel, size_t max_queue_size)
+            : m_reactor(reactor)
+            , m_channel(channel)
+            , m_max_queue_size(max_queue_size) {
+            m_reactor.add(*this);
+        }
+
+        ~AsyncChannel() {
+            if (!m_registered) {
+                return;
+            }
+            try {
+                m_reactor.remove(*this);
+            }
+            catch (std::exception const&) {
+            }
+        }
+
+        AsyncChannel(AsyncChannel const&) = delete;
+        AsyncChannel& operator=(AsyncChannel const&) = delete;
+
+        /** Set the callback called for each received message
+         *
+         * The message object is reused between calls, copy or move its
+         * content if it must outlive the callback
+         */
+        void setMessageCallback(MessageCallback callback) {
+            m_message_callback = callback;
+        }
+
+        /** Set the callback called when a received frame could not be
+         * decoded (e.g. InvalidProtobufMessage or DecryptionFailed)
+         *
+         * If there is none, the exception is propagated out of
+         * Reactor::poll. Read errors are reported as well, and may be
+         * reported again at each poll until the remote side hangs up
+         */
+        void setErrorCallback(ErrorCallback callback) {
+            m_error_callback = callback;
+        }
+
+        /** Set the callback called when the write queue becomes empty after
+         * having had to wait for the file descriptor to be writable
+         *
+         * Use it to resume sending after write() returned false
+         */
+        void setDrainedCallback(DrainedCallback callback) {
+            m_drained_callback = callback;
+        }
+
+        /** Queue a message for sending
+         *
+         * @return false if the message was not queued because the write
+         *   queue is full, or because the remote side closed the connection
+         */
+        bool write(Local const& message) {
+            if (isClosed() || getQueueSize() >= m_max_queue_size) {
+                return false;
+            }
+
+            bool was_empty = !wantsWrite();
+            m_channel.appendFrame(m_write_queue, message);
+            if (was_empty) {
+                flushQueue();
+                if (wantsWrite()) {
+                    m_reactor.update(*this);
+                }
+            }
+            return true;
+        }
+
+        /** Number of bytes waiting to be written */
+        size_t getQueueSize() const {
+            return m_write_queue.size() - m_write_queue_start;
+        }
+
+        /** Whether the remote side closed the connection */
+        bool isClosed() const {
+            return !m_registered;
+        }
+
+        int getFileDescriptor() const override {
+            return m_channel.getFileDescriptor();
+        }
+
+        void handleRead() override {
+            auto callback = [this](Remote& message) {
+                if (m_message_callback) {
+                    m_message_callback(message);
+                }
+            };
+
+            // Process what is available now and return to the reactor, so
+            // that a busy peer does not starve the other handlers. Frames
+            // left in the driver's buffer after an error do not make the
+            // descriptor readable, so they are processed here as well
+            do {
+                try {
+                    m_channel.drain(callback, base::Time(), base::Time());
+                }
+                catch (iodrivers_base::TimeoutError const&) {
+                    return;
+                }
+                catch (std::exception const& e) {
+                    if (!m_error_callback) {
+                        throw;
+                    }
+                    m_error_callback(e);
+                }
+            }
+            while (m_channel.hasPacket());
+        }
+
+        void handleWrite() override {
+            if (!flushQueue()) {
+                return;
+            }
+
+            m_reactor.update(*this);
+            if (m_drained_callback) {
+                m_drained_callback();
+            }
+        }
+
+        void handleHangup() override {
+            m_registered = false;
+        }
+
+        bool wantsWrite() const override {
+            return getQueueSize() != 0;
+        }
+
+    private:
+        Reactor& m_reactor;
+        ChannelType& m_channel;
+        size_t const m_max_queue_size;
+        bool m_registered = true;
+
+        /** Encoded frames waiting to be written
+         *
+         * The bytes before m_write_queue_start have already been written
+         */
+        std::vector<uint8_t> m_write_queue;
+        size_t m_write_queue_start = 0;
+
+        MessageCallback m_message_callback;
+        ErrorCallback m_error_callback;
+        DrainedCallback m_drained_callback;
+
+        /** Write as much of the queue as the file descriptor accepts
+         *
+         * @return true if the queue has been fully written
+         */
+        bool flushQueue() {
+            size_t written = m_channel.getMainStream()->write(
+                m_write_queue.data() + m_write_queue_start, getQueueSize()
+            );
+            m_write_queue_start += written;
+            if (m_write_queue_start == m_write_queue.size()) {
+                m_write_queue.clear();
+                m_write_queue_start = 0;
+                return true;
+            }
+            else if (m_write_queue_start > m_write_queue.size() / 2) {
+                m_write_queue.erase(m_write_queue.begin(),
+                                    m_write_queue.begin() + m_write_queue_start);
+                m_write_queue_start = 0;
+            }
+            return false;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,15 @@
+#include <comms_protobuf/Channel.hpp>
+#include <comms_protobuf/FrameLog.hpp>
+#include <comms_protobuf/SharedMemoryStream.hpp>
+
+using namespace std;
+using namespace comms_protobuf;
+
+iodrivers_base::IOStream* details::openChannelStream(string const& uri) {
+    return SharedMemoryStream::openURI(uri);
+}
+
+void details::appendToFrameLog(FrameLogWriter& log, uint8_t const* frame,
+                               size_t size) {
+    log.append(base::Time::now(), frame, size);
+}
@@ -1,8 +1,17 @@
 #ifndef COMMS_PROTOBUF_CHANNEL_HPP
 #define COMMS_PROTOBUF_CHANNEL_HPP
 
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <google/protobuf/arena.h>
 #include <iodrivers_base/Driver.hpp>
 #include <comms_protobuf/Protocol.hpp>
+#include <comms_protobuf/Compression.hpp>
+#include <comms_protobuf/Delta.hpp>
+#include <comms_protobuf/Fragmentation.hpp>
+#include <comms_protobuf/Policies.hpp>
+#include <comms_protobuf/Stats.hpp>
 
 namespace comms_protobuf {
     /** Exception thrown in read() when a packet was valid for the underlying protocol,
@@ -12,76 +21,603 @@ namespace comms_protobuf {
         using std::runtime_error::runtime_error;
     };
 
+    /** Policy used by Channel to size its internal buffers */
+    struct BufferPolicy {
+        /** How many frames of the maximum size the driver's internal buffer,
+         * and the buffer used to read and write single messages, can hold
+         *
+         * A value of 1 sizes the buffers exactly for the biggest possible
+         * frame. Higher values give more room to the driver to buffer bursts
+         * of incoming data
+         */
+        size_t frame_count = 10;
+
+        /** Whether all channels of a given thread should share the same
+         * buffer to encode and decode single messages
+         *
+         * The shared buffer grows to the needs of the biggest channel that
+         * uses it.
+         */
+        bool shared_io_buffer = false;
+    };
+
+    class FrameLogWriter;
+
+    namespace details {
+        /** Create the stream of the URI schemes that Channel::openURI adds
+         * to the ones of iodrivers_base
+         *
+         * It is defined out of line so that the channel does not pull the
+         * shared memory headers in
+         *
+         * @return the stream, or null if the URI has another scheme
+         */
+        iodrivers_base::IOStream* openChannelStream(std::string const& uri);
+
+        /** Append a received frame to a frame log, see
+         * Channel::setReceiveLog
+         */
+        void appendToFrameLog(FrameLogWriter& log, uint8_t const* frame,
+                              size_t size);
+
+        /** Return the I/O buffer shared by the channels of the current thread
+         *
+         * It is resized to at least min_size
+         */
+        inline std::vector<uint8_t>& getThreadIOBuffer(size_t min_size) {
+            static thread_local std::vector<uint8_t> buffer;
+            if (buffer.size() < min_size) {
+                buffer.resize(min_size);
+            }
+            return buffer;
+        }
+    }
+
     /**
      * A communication channel using protocol buffer messages
      *
      * The Local type is the type used for messages created locally for the remote
      * side. The Remote type is the type expected from the remote side
+     *
+     * The Framing, Integrity and Cipher policies select the frame format at
+     * compile time, see policies. The defaults implement the format of
+     * protocol. Both sides of the channel must use the same policies.
      */
-    template<typename Local, typename Remote>
+    template<typename Local, typename Remote,
+             typename Framing = policies::VarintFraming,
+             typename Integrity = policies::CRC16Integrity,
+             typename Cipher = policies::RuntimeCipher>
     class Channel : public iodrivers_base::Driver {
+    public:
+        /** Generation and extraction of the channel's frames */
+        typedef policies::FrameCodec<Framing, Integrity> FrameCodec;
+
     protected:
         const size_t m_max_message_size;
         /** Define a plain type for the benefit of subclasses */
-        typedef Channel<Local, Remote> ChannelType;
+        typedef Channel<Local, Remote, Framing, Integrity, Cipher> ChannelType;
 
     private:
         protocol::CipherContext* m_cipher = nullptr;
         bool m_encrypted = false;
 
+        /** IVs of the encrypted messages received so far */
+        protocol::ReplayWindow m_replay_window;
+
+        const BufferPolicy m_buffer_policy;
+
+        /** Size of the send/receive buffer */
+        const size_t m_io_buffer_size;
+
         /** Send/receive buffer used internally
+         *
+         * Encryption and decryption are done in place in this buffer. It is
+         * empty if the buffer policy asks for a per-thread shared buffer. Use
+         * getIOBuffer() to access the buffer that should be used
          */
         std::vector<uint8_t> m_io_buffer;
 
-        /** Buffer used as target when decrypting the payload from m_io_buffer
+        uint8_t* getIOBuffer() {
+            if (m_buffer_policy.shared_io_buffer) {
+                return details::getThreadIOBuffer(m_io_buffer_size).data();
+            }
+            return m_io_buffer.data();
+        }
+
+        /** Memory block handed to m_arena as its initial block
+         *
+         * The arena does not free it on reset, so as long as a batch of
+         * messages fits in it, readOnArena() does not allocate at all
          */
-        std::vector<uint8_t> m_plaintext_buffer;
+        std::vector<char> m_arena_initial_block;
 
-        /**
-         * Buffer used as target when encrypting the serialized version of the
-         * protobuf message
+        /** Frames waiting to be written by flush()
+         *
+         * Only the first m_write_queue_size bytes are valid
          */
-        std::vector<uint8_t> m_ciphertext_buffer;
+        std::vector<uint8_t> m_write_queue;
+        size_t m_write_queue_size = 0;
+
+        /** Max size of the write queue in coalescing mode. Zero if disabled */
+        size_t m_coalescing_max_size = 0;
+        base::Time m_coalescing_max_delay;
+
+        /** Time at which the write queue must be flushed in coalescing mode */
+        base::Time m_coalescing_deadline;
+
+        /** Arena used by readOnArena(), created by enableArena()
+         *
+         * Declared after m_arena_initial_block, as it must be destroyed first
+         */
+        std::unique_ptr<google::protobuf::Arena> m_arena;
+
+        /** Maximum size of a frame payload, accounting for the encryption
+         * overhead if enabled
+         */
+        size_t m_max_payload_size;
+
+        /** Whether the CRC of received frames is verified */
+        bool m_check_crc = true;
+
+        /** Maximum number of message bytes in a fragment. Zero if
+         * fragmentation is disabled
+         */
+        size_t m_fragment_chunk_size = 0;
+
+        /** ID of the next fragmented message */
+        uint32_t m_next_message_id = 0;
+
+        /** Serialized messages that span more than one fragment */
+        std::vector<uint8_t> m_fragment_buffer;
+
+        /** Reassembly of the received fragments, if fragmentation is enabled */
+        std::unique_ptr<fragmentation::Reassembler> m_reassembler;
+
+        /** Maximum size of a received message, after reassembly */
+        size_t m_max_remote_message_size;
+
+        /** Compression state, if compression is enabled */
+        std::unique_ptr<compression::Codec> m_compression;
+
+        /** Delta encoding state */
+        struct DeltaState {
+            size_t keyframe_period;
+            size_t messages_since_keyframe = 0;
+            bool keyframe_requested = true;
+            uint32_t keyframe_id = 0;
+            /** Whether the message being written, as prepared by
+             * serializeMessage, is a keyframe
+             */
+            bool pending_keyframe = false;
+            /** The last keyframe sent */
+            Local keyframe;
+            Local delta;
+
+            bool has_remote_keyframe = false;
+            uint32_t remote_keyframe_id = 0;
+            /** The last keyframe received */
+            Remote remote_keyframe;
+            Remote remote_delta;
+            delta::Header remote_header;
+
+            /** delta::Reflection<Local>::diff and
+             * delta::Reflection<Remote>::apply
+             *
+             * They are only instantiated by enableDeltaEncoding(), so that
+             * the rest of the channel does not need protobuf's reflection
+             */
+            void (*diff)(Local const&, Local const&, Local&,
+                         std::vector<uint32_t>&) = nullptr;
+            void (*apply)(Remote&, Remote const&,
+                          std::vector<uint32_t> const&) = nullptr;
+        };
+
+        /** Delta encoding state, if delta encoding is enabled */
+        std::unique_ptr<DeltaState> m_delta;
+
+        /** The bytes of the message being written, as generated by
+         * prepareMessage() when compression or delta encoding are enabled
+         */
+        std::vector<uint8_t> m_message_buffer;
+
+        /** Serialized message, before compression */
+        std::vector<uint8_t> m_serialization_buffer;
+
+        /** Decompressed message */
+        std::vector<uint8_t> m_decompression_buffer;
+
+        /** Statistics, updated from const methods as well */
+        mutable ChannelStats m_stats;
+
+        /** Log of the received frames, or null. Not owned */
+        FrameLogWriter* m_receive_log = nullptr;
+
+        /** Value of the driver's consumed byte count (good_rx + bad_rx)
+         * when rejected bytes were last counted, see countRejection()
+         */
+        mutable uint64_t m_rejection_consumed = 0;
+
+        /** End of the last rejected bytes counted at m_rejection_consumed */
+        mutable uint8_t const* m_rejection_end = nullptr;
 
         int extractPacket(uint8_t const* buffer, size_t size) const {
-            return protocol::extractPacket(buffer, size, m_max_message_size);
+            protocol::RejectionReason reason;
+            int result = FrameCodec::extractPacket(buffer, size, m_max_payload_size,
+                                                   m_check_crc, &reason);
+            if (result < 0) {
+                countRejection(buffer, -result, reason);
+            }
+            return result;
+        }
+
+        /** Record bytes rejected by extractPacket() in the statistics
+         *
+         * iodrivers_base calls extractPacket() from hasPacket() as well as
+         * from readPacket(), so the same bytes of its internal buffer may
+         * be rejected more than once. They only move in the buffer when the
+         * driver discards bytes, which it accounts in its good_rx and
+         * bad_rx counters. Until these counters change, rejections that
+         * start before the end of the last counted one are not counted
+         * again
+         */
+        void countRejection(uint8_t const* buffer, size_t size,
+                            protocol::RejectionReason reason) const {
+            if (!stats::ENABLED) {
+                return;
+            }
+
+            iodrivers_base::Status status = getStatus();
+            uint64_t consumed = static_cast<uint64_t>(status.good_rx) + status.bad_rx;
+            if (consumed == m_rejection_consumed && buffer < m_rejection_end) {
+                return;
+            }
+            m_rejection_consumed = consumed;
+            m_rejection_end = buffer + size;
+
+            m_stats.bytes_skipped.add(size);
+            if (reason == protocol::REJECTED_CRC) {
+                m_stats.crc_failures.add();
+            }
+            else if (reason == protocol::REJECTED_LENGTH) {
+                m_stats.oversize_rejections.add();
+            }
         }
 
     public:
-        static size_t getBufferSizeFromMessageSize(size_t message_size) {
-            return (protocol::PACKET_MIN_OVERHEAD +
-                    protocol::getLengthEncodedSize(message_size) +
-                    message_size) * 10;
+        static size_t getBufferSizeFromMessageSize(size_t message_size,
+                                                   size_t frame_count = 10) {
+            return FrameCodec::getMaxFrameSize(message_size) * frame_count;
+        }
+
+        /** Size of the buffers for the given max message size and policy
+         *
+         * Unless the cipher policy is NoCipher, the buffers are always big
+         * enough for encrypted messages, as encryption may be enabled after
+         * construction
+         */
+        static size_t getBufferSize(size_t max_message_size,
+                                    BufferPolicy const& policy) {
+            size_t max_payload_size = max_message_size;
+            if (Cipher::ENABLED) {
+                max_payload_size =
+                    protocol::CipherContext::getMaxCiphertextLength(max_message_size);
+            }
+            return getBufferSizeFromMessageSize(
+                max_payload_size, std::max<size_t>(1, policy.frame_count)
+            );
         }
 
         /** @arg max_message_size the maximum marshalled size of a Remote message
          *      You can estimate this by taking the nominal size of each field
          *      and adding two bytes per field. It does not need to be precise,
-         *      the values used internally will be 10x this
+         *      the buffers used internally will be BufferPolicy::frame_count
+         *      times this (10x by default)
+         * @arg buffer_policy how the internal buffers should be sized
+         * @throw std::invalid_argument if max_message_size does not fit in
+         *   the framing's length field
          */
-        Channel(size_t max_message_size)
-            : iodrivers_base::Driver(getBufferSizeFromMessageSize(max_message_size))
+        Channel(size_t max_message_size,
+                BufferPolicy const& buffer_policy = BufferPolicy())
+            : iodrivers_base::Driver(getBufferSize(max_message_size, buffer_policy))
             , m_max_message_size(max_message_size)
-            , m_io_buffer(getBufferSizeFromMessageSize(max_message_size)) {
+            , m_buffer_policy(buffer_policy)
+            , m_io_buffer_size(getBufferSize(max_message_size, buffer_policy))
+            , m_io_buffer(buffer_policy.shared_io_buffer ? 0 : m_io_buffer_size)
+            , m_max_payload_size(max_message_size)
+            , m_max_remote_message_size(max_message_size) {
+            validatePayloadSize(max_message_size);
+        }
+
+        /** Open the channel
+         *
+         * In addition to the URIs supported by iodrivers_base, this accepts
+         * shmserver://name[?options] to create a shared memory segment
+         * and shm://name to attach to it. See SharedMemoryStream
+         */
+        void openURI(std::string const& uri) {
+            if (auto stream = details::openChannelStream(uri)) {
+                setMainStream(stream);
+                return;
+            }
+            iodrivers_base::Driver::openURI(uri);
+        }
+
+        /** The buffer policy given at construction */
+        BufferPolicy getBufferPolicy() const {
+            return m_buffer_policy;
         }
 
         ~Channel() {
             delete m_cipher;
         }
 
-        void setEncryptionKey(std::string key) {
+        /** Enable or disable the verification of the received frames' CRC
+         *
+         * It is enabled by default. Only disable it on transports that
+         * cannot corrupt data, such as the in-process rings created by
+         * connectInProcess. The CRC is still computed on written frames, so
+         * that the remote side may keep verifying it.
+         */
+        void setCRCCheck(bool enabled) {
+            m_check_crc = enabled;
+        }
+
+        /** Whether the CRC of received frames is verified */
+        bool isCRCCheckEnabled() const {
+            return m_check_crc;
+        }
+
+        /** Split the messages bigger than a frame into several frames
+         *
+         * The max_message_size given to the constructor then becomes the
+         * maximum size of a frame's payload. Since it adds a header to all
+         * frames, fragmentation must be enabled on both sides of the channel.
+         *
+         * @arg max_reassembled_size the maximum size of a received message
+         * @arg max_reassembly_memory the maximum number of bytes held by
+         *   partially received messages, including their bookkeeping (see
+         *   fragmentation::Reassembler::getMessageOverhead)
+         * @arg reassembly_timeout time after which a partially received
+         *   message is dropped
+         */
+        void enableFragmentation(size_t max_reassembled_size,
+                                 size_t max_reassembly_memory,
+                                 base::Time const& reassembly_timeout) {
+            if (m_max_message_size <= fragmentation::HEADER_SIZE) {
+                throw std::invalid_argument(
+                    "enableFragmentation: max_message_size is too small to "
+                    "hold a fragment header"
+                );
+            }
+
+            m_fragment_chunk_size = m_max_message_size - fragmentation::HEADER_SIZE;
+            m_reassembler.reset(new fragmentation::Reassembler(
+                max_reassembled_size, max_reassembly_memory, reassembly_timeout
+            ));
+            m_max_remote_message_size = max_reassembled_size;
+        }
+
+        /** Go back to sending each message in a single frame */
+        void disableFragmentation() {
+            m_fragment_chunk_size = 0;
+            m_reassembler.reset();
+            m_max_remote_message_size = m_max_message_size;
+        }
+
+        /** Whether enableFragmentation() has been called */
+        bool isFragmentationEnabled() const {
+            return static_cast<bool>(m_reassembler);
+        }
+
+        /** Compress the messages before sending them
+         *
+         * Since it adds a flag byte to all messages, compression must be
+         * enabled on both sides of the channel. The two sides may however
+         * use different algorithms, as long as both are available. Messages
+         * are sent uncompressed if they are below the options' threshold,
+         * or if compression does not make them smaller. The flag byte
+         * counts towards the maximum message size.
+         *
+         * @throw std::invalid_argument if the algorithm is not available in
+         *   this build, see compression::isAvailable
+         */
+        void enableCompression(compression::Options const& options) {
+            m_compression.reset(new compression::Codec(options));
+        }
+
+        /** Go back to sending the messages as-is */
+        void disableCompression() {
+            m_compression.reset();
+        }
+
+        /** Whether enableCompression() has been called */
+        bool isCompressionEnabled() const {
+            return static_cast<bool>(m_compression);
+        }
+
+        /** Send only the fields that changed since the last keyframe
+         *
+         * Every keyframe_period-th message is sent in full as a keyframe.
+         * The other messages are sent as a delta against the last keyframe,
+         * and reconstructed by read() on the receiving side. Delta encoding
+         * must be enabled on both sides of the channel, and adds a small
+         * header to the messages that counts towards the maximum message
+         * size.
+         *
+         * Deltas against a keyframe that has not been received make read()
+         * throw MissingKeyframe until the next keyframe is received. Use
+         * requestKeyframe() to resynchronize the remote side earlier.
+         *
+         * Deltas are computed with protobuf's reflection, which requires
+         * full (not LITE) message types. The code that calls this method
+         * must include comms_protobuf/DeltaReflection.hpp
+         *
+         * @throw std::invalid_argument if keyframe_period is zero
+         */
+        void enableDeltaEncoding(size_t keyframe_period) {
+            if (keyframe_period == 0) {
+                throw std::invalid_argument("the keyframe period must be at least 1");
+            }
+            m_delta.reset(new DeltaState());
+            m_delta->keyframe_period = keyframe_period;
+            m_delta->diff = &delta::Reflection<Local>::diff;
+            m_delta->apply = &delta::Reflection<Remote>::apply;
+        }
+
+        /** Go back to sending the messages in full */
+        void disableDeltaEncoding() {
+            m_delta.reset();
+        }
+
+        /** Statistics about this channel's activity
+         *
+         * They may be polled from another thread. Their recording is
+         * compiled out if COMMS_PROTOBUF_DISABLE_STATS is defined.
+         * Messages decoded by a PipelinedReader are not timed
+         */
+        ChannelStats const& getStats() const {
+            return m_stats;
+        }
+
+        /** Reset the statistics returned by getStats() */
+        void resetStats() {
+            m_stats.reset();
+        }
+
+        /** Whether enableDeltaEncoding() has been called */
+        bool isDeltaEncodingEnabled() const {
+            return static_cast<bool>(m_delta);
+        }
+
+        /** Send the next message as a keyframe
+         *
+         * Does nothing if delta encoding is disabled
+         */
+        void requestKeyframe() {
+            if (m_delta) {
+                m_delta->keyframe_requested = true;
+            }
+        }
+
+        /** Enable encryption using the given PSK
+         *
+         * The key derivation is expensive, but is done only once per PSK in
+         * a given process. See protocol::getDerivedKey
+         *
+         * @arg algorithm the algorithm used to encrypt the sent messages.
+         *   Received messages are decrypted with the algorithm they were
+         *   encrypted with. By default, the fastest algorithm on this CPU is
+         *   used, see protocol::getFastestCipherAlgorithm
+         */
+        void setEncryptionKey(
+            std::string key,
+            protocol::CipherAlgorithm algorithm = protocol::AUTO_CIPHER
+        ) {
+            static_assert(Cipher::ENABLED,
+                          "encryption is not available with the NoCipher policy");
+            setCipherContext(new protocol::CipherContext(key, algorithm));
+        }
+
+        /** Enable encryption using a key derived offline
+         *
+         * See the comms_protobuf_derive_key tool and protocol::parseKey
+         */
+        void setEncryptionKey(
+            protocol::aes_key const& key,
+            protocol::CipherAlgorithm algorithm = protocol::AUTO_CIPHER
+        ) {
+            static_assert(Cipher::ENABLED,
+                          "encryption is not available with the NoCipher policy");
+            setCipherContext(new protocol::CipherContext(key, algorithm));
+        }
+
+    private:
+        /** Verify that payloads of the given size can be framed
+         *
+         * @throw std::invalid_argument
+         */
+        static void validatePayloadSize(size_t payload_size) {
+            if (payload_size > Framing::MAX_PAYLOAD_SIZE) {
+                throw std::invalid_argument(
+                    "payloads of " + std::to_string(payload_size) + " bytes "
+                    "do not fit in the framing's length field, the maximum is " +
+                    std::to_string(Framing::MAX_PAYLOAD_SIZE)
+                );
+            }
+        }
+
+        void setCipherContext(protocol::CipherContext* cipher) {
+            validatePayloadSize(
+                protocol::CipherContext::getMaxCiphertextLength(m_max_message_size)
+            );
             delete m_cipher;
-            m_cipher = new protocol::CipherContext(key);
+            m_cipher = cipher;
             m_encrypted = true;
-
-            size_t encryptedPayloadSize =
+            m_replay_window.reset();
+            m_replay_window.setLocalSession(cipher->session);
+            m_max_payload_size =
                 protocol::CipherContext::getMaxCiphertextLength(m_max_message_size);
+        }
 
-            m_ciphertext_buffer.resize(encryptedPayloadSize);
-            m_io_buffer.resize(getBufferSizeFromMessageSize(encryptedPayloadSize));
-            m_plaintext_buffer.resize(
-                getBufferSizeFromMessageSize(m_max_message_size)
-            );
+    public:
+        /** Enable readOnArena()
+         *
+         * @arg initial_block_size size of the memory block that is reused
+         *   across calls to resetArena(). Size it to hold the messages read
+         *   between two resets to avoid any allocation.
+         */
+        void enableArena(size_t initial_block_size) {
+            m_arena.reset();
+            m_arena_initial_block.resize(initial_block_size);
+
+            google::protobuf::ArenaOptions options;
+            options.initial_block = m_arena_initial_block.data();
+            options.initial_block_size = m_arena_initial_block.size();
+            m_arena.reset(new google::protobuf::Arena(options));
+        }
+
+        /** Whether enableArena() has been called */
+        bool isArenaEnabled() const {
+            return static_cast<bool>(m_arena);
+        }
+
+        /** Destroy all messages returned by readOnArena() so far
+         *
+         * The memory is kept for the messages read after the reset
+         */
+        void resetArena() {
+            if (m_arena) {
+                m_arena->Reset();
+            }
+        }
+
+        Remote& readOnArena() {
+            return readOnArena(getReadTimeout(), getReadTimeout());
+        }
+
+        Remote& readOnArena(base::Time const& timeout) {
+            return readOnArena(timeout, timeout);
+        }
+
+        /** Read a message allocated on the channel's arena
+         *
+         * The message, its submessages, strings and repeated fields are
+         * allocated on the arena. They remain valid until the next call to
+         * resetArena() or enableArena(), which is typically done once a batch
+         * of messages has been processed.
+         */
+        Remote& readOnArena(base::Time const& timeout,
+                            base::Time const& first_byte_timeout) {
+            if (!m_arena) {
+                throw std::logic_error(
+                    "readOnArena: arena mode is disabled, call enableArena first"
+                );
+            }
+
+            Remote* message =
+                google::protobuf::Arena::CreateMessage<Remote>(m_arena.get());
+            read(*message, timeout, first_byte_timeout);
+            return *message;
         }
 
         Remote read() {
@@ -93,76 +629,889 @@ namespace comms_protobuf {
         }
 
         Remote read(base::Time const& timeout, base::Time const& first_byte_timeout) {
-            size_t size = readPacket(&m_io_buffer[0], m_io_buffer.size(),
+            Remote result;
+            read(result, timeout, first_byte_timeout);
+            return result;
+        }
+
+        /** Read a message into an existing object
+         *
+         * The message is cleared before being filled, but protobuf keeps the
+         * storage allocated for its strings and repeated fields. Reusing the
+         * same object for successive reads avoids reallocating them.
+         */
+        void read(Remote& message) {
+            read(message, getReadTimeout(), getReadTimeout());
+        }
+
+        void read(Remote& message, base::Time const& timeout) {
+            read(message, timeout, timeout);
+        }
+
+        void read(Remote& message, base::Time const& timeout,
+                  base::Time const& first_byte_timeout) {
+            if (!m_reassembler) {
+                auto payload_range = readPayload(timeout, first_byte_timeout);
+                parseMessage(message, payload_range.first, payload_range.second);
+                return;
+            }
+
+            base::Time deadline = base::Time::now() + timeout;
+            base::Time packet_timeout = timeout;
+            base::Time packet_first_byte_timeout = first_byte_timeout;
+            while (true) {
+                auto payload_range = readPayload(packet_timeout,
+                                                 packet_first_byte_timeout);
+                base::Time now = base::Time::now();
+                if (parseFragment(message, payload_range.first,
+                                  payload_range.second, now)) {
+                    return;
+                }
+
+                // Wait for the next fragments within what remains of the
+                // timeout. A zero timeout still processes the frames that
+                // are already available
+                packet_timeout = std::max(base::Time(), deadline - now);
+                packet_first_byte_timeout = packet_timeout;
+            }
+        }
+
+        /** Record the frames received by read() and its variants
+         *
+         * Frames are appended with their reception time before being
+         * decrypted, so that the log can be replayed with decodeFrame().
+         * Messages sent on the channel are not recorded.
+         *
+         * @arg log the log, or null to stop recording. It is not owned by
+         *   the channel, and must remain valid until recording stops
+         */
+        void setReceiveLog(FrameLogWriter* log) {
+            m_receive_log = log;
+        }
+
+        /** Decode one frame received outside of the channel, e.g. read from
+         * a FrameLogReader
+         *
+         * The frame goes through the same pipeline as the frames read from
+         * the device (decryption, replay protection, reassembly, decompression,
+         * delta decoding and statistics). Unencrypted frames are parsed in
+         * place, without copy. Encrypted frames are copied in the I/O buffer
+         * to be decrypted.
+         *
+         * @arg time the reception time of the frame, used for the reassembly
+         *   timeout
+         * @return true if a message has been parsed in message, false if the
+         *   frame is a fragment of a message that is not complete yet
+         * @throw std::invalid_argument if the buffer does not contain exactly
+         *   one valid frame
+         */
+        bool decodeFrame(Remote& message, uint8_t const* frame, size_t size,
+                         base::Time const& time) {
+            int frame_size = FrameCodec::extractPacket(frame, size, m_max_payload_size,
+                                                       m_check_crc);
+            if (frame_size != static_cast<int>(size)) {
+                throw std::invalid_argument(
+                    "decodeFrame: the buffer does not contain exactly one "
+                    "valid frame"
+                );
+            }
+
+            std::pair<uint8_t const*, uint8_t const*> payload_range;
+            if (isEncrypted()) {
+                if (size > m_io_buffer_size) {
+                    throw std::invalid_argument(
+                        "decodeFrame: the frame is bigger than the I/O buffer"
+                    );
+                }
+                uint8_t* io_buffer = getIOBuffer();
+                std::memcpy(io_buffer, frame, size);
+                payload_range = decodePayload(io_buffer, size);
+            }
+            else {
+                // decodePayload only writes into the frame to decrypt it
+                payload_range = decodePayload(const_cast<uint8_t*>(frame), size);
+            }
+
+            if (!m_reassembler) {
+                parseMessage(message, payload_range.first, payload_range.second);
+                return true;
+            }
+            return parseFragment(message, payload_range.first,
+                                 payload_range.second, time);
+        }
+
+    private:
+        /** Process a frame that is already in the driver's internal buffer
+         *
+         * @return true if the frame completed a message
+         */
+        bool readBufferedFrame(Remote& message) {
+            if (!m_reassembler) {
+                read(message, base::Time(), base::Time());
+                return true;
+            }
+
+            auto payload_range = readPayload(base::Time(), base::Time());
+            return parseFragment(message, payload_range.first,
+                                 payload_range.second, base::Time::now());
+        }
+
+        /** Read a frame and return its decrypted payload
+         *
+         * The payload is decrypted in place in the I/O buffer
+         */
+        std::pair<uint8_t const*, uint8_t const*> readPayload(
+            base::Time const& timeout, base::Time const& first_byte_timeout
+        ) {
+            uint8_t* io_buffer = getIOBuffer();
+            size_t size = readPacket(io_buffer, m_io_buffer_size,
                                      timeout, first_byte_timeout);
-            auto payload_range = protocol::getPayload(
-                &m_io_buffer[0],
-                &m_io_buffer[0] + size
-            );
+            if (m_receive_log) {
+                details::appendToFrameLog(*m_receive_log, io_buffer, size);
+            }
+            return decodePayload(io_buffer, size);
+        }
 
-            if (m_encrypted) {
-                // Payload starts with the AES tag
-                protocol::aes_tag tag;
-                uint8_t const* ciphertext_start = payload_range.first + tag.size();
-                std::copy(payload_range.first, ciphertext_start, tag.begin());
+        /** Return the payload of a frame, decrypting it in place if needed */
+        std::pair<uint8_t const*, uint8_t const*> decodePayload(uint8_t* frame,
+                                                                size_t size) {
+            m_stats.frames_received.add();
+            m_stats.bytes_received.add(size);
+            auto payload_range = FrameCodec::getPayload(frame, frame + size);
 
-                size_t ciphertext_length = payload_range.second - ciphertext_start;
-                size_t size = protocol::decrypt(
-                    *m_cipher, &m_plaintext_buffer[0],
-                    payload_range.first + tag.size(), ciphertext_length, tag
+            if (isEncrypted()) {
+                protocol::aes_iv iv = protocol::getPayloadIV(
+                    payload_range.first, payload_range.second
                 );
-                payload_range.first = &m_plaintext_buffer[0];
-                payload_range.second = &m_plaintext_buffer[size];
+                if (!m_replay_window.isAcceptable(iv)) {
+                    throw ReplayedMessage(
+                        "received an encrypted message whose IV has already "
+                        "been used"
+                    );
+                }
+
+                // Decrypt in place
+                std::pair<uint8_t*, uint8_t*> plaintext;
+                try {
+                    stats::ScopedTimer timer(m_stats.decrypt_time);
+                    plaintext = protocol::decryptPayload(
+                        *m_cipher,
+                        frame + (payload_range.first - frame),
+                        frame + (payload_range.second - frame)
+                    );
+                }
+                catch (DecryptionFailed const&) {
+                    m_stats.decrypt_failures.add();
+                    throw;
+                }
+                m_replay_window.update(iv);
+                payload_range.first = plaintext.first;
+                payload_range.second = plaintext.second;
+            }
+            return payload_range;
+        }
+
+        /** Handle a payload when fragmentation is enabled
+         *
+         * @return true if a message has been parsed, false if the payload is
+         *   a fragment of a message that is not complete yet
+         */
+        bool parseFragment(Remote& message, uint8_t const* begin,
+                           uint8_t const* end, base::Time const& now) {
+            auto header = fragmentation::parseHeader(begin, end);
+            uint8_t const* chunk = begin + fragmentation::HEADER_SIZE;
+            if (header.count == 1) {
+                parseMessage(message, chunk, end);
+                return true;
             }
 
-            Remote result;
-            bool success = result.ParseFromString(
-                std::string(reinterpret_cast<char const*>(payload_range.first),
-                            reinterpret_cast<char const*>(payload_range.second))
+            if (m_reassembler->push(header, chunk, end, now)) {
+                auto const& reassembled = m_reassembler->getMessage();
+                parseMessage(message, reassembled.data(),
+                             reassembled.data() + reassembled.size());
+                return true;
+            }
+            return false;
+        }
+
+        /** Unmarshal a message from its bytes, decompressing it if needed */
+        void parseMessage(Remote& message, uint8_t const* begin, uint8_t const* end) {
+            stats::ScopedTimer timer(m_stats.parse_time);
+            try {
+                decompressAndParse(message, begin, end);
+            }
+            catch (...) {
+                m_stats.parse_failures.add();
+                throw;
+            }
+        }
+
+        void decompressAndParse(Remote& message, uint8_t const* begin,
+                                uint8_t const* end) {
+            if (!m_compression) {
+                parseSerializedMessage(message, begin, end);
+                return;
+            }
+
+            if (begin == end) {
+                throw DecompressionFailed(
+                    "received an empty message while compression is enabled"
+                );
+            }
+            auto algorithm = static_cast<compression::Algorithm>(*begin);
+            if (algorithm == compression::NONE) {
+                parseSerializedMessage(message, begin + 1, end);
+                return;
+            }
+
+            auto parsed_length = protocol::parseLength(begin + 1, end);
+            size_t size = parsed_length.first;
+            if (!parsed_length.second) {
+                throw DecompressionFailed(
+                    "received a compressed message with an invalid size field"
+                );
+            }
+            else if (size > m_max_remote_message_size) {
+                throw DecompressionFailed(
+                    "received a compressed message whose uncompressed size (" +
+                    std::to_string(size) + ") is bigger than the maximum "
+                    "message size"
+                );
+            }
+
+            m_decompression_buffer.resize(size);
+            m_compression->decompress(
+                algorithm, m_decompression_buffer.data(), size,
+                parsed_length.second, end - parsed_length.second
             );
+            parseSerializedMessage(message, m_decompression_buffer.data(),
+                                   m_decompression_buffer.data() + size);
+        }
+
+        /** Unmarshal a decompressed message, applying it to the last keyframe
+         * if it is a delta
+         */
+        void parseSerializedMessage(Remote& message, uint8_t const* begin,
+                                    uint8_t const* end) {
+            if (!m_delta) {
+                parsePayload(message, begin, end);
+                return;
+            }
+
+            DeltaState& state = *m_delta;
+            delta::Header& header = state.remote_header;
+            begin = delta::parseHeader(begin, end, header);
+            if (header.type == delta::KEYFRAME) {
+                parsePayload(message, begin, end);
+                state.remote_keyframe.CopyFrom(message);
+                state.remote_keyframe_id = header.keyframe_id;
+                state.has_remote_keyframe = true;
+                return;
+            }
+            else if (!state.has_remote_keyframe) {
+                throw MissingKeyframe(
+                    "received a delta against keyframe " +
+                    std::to_string(header.keyframe_id) + " before any keyframe"
+                );
+            }
+            else if (header.keyframe_id != state.remote_keyframe_id) {
+                throw MissingKeyframe(
+                    "received a delta against keyframe " +
+                    std::to_string(header.keyframe_id) + ", but the last "
+                    "keyframe received is " +
+                    std::to_string(state.remote_keyframe_id)
+                );
+            }
+
+            parsePayload(state.remote_delta, begin, end);
+            message.CopyFrom(state.remote_keyframe);
+            state.apply(message, state.remote_delta, header.cleared_fields);
+        }
+
+    public:
+        /** Unmarshal a message from a decrypted payload
+         *
+         * @throw InvalidProtobufMessage
+         */
+        static void parsePayload(Remote& message, uint8_t const* begin,
+                                 uint8_t const* end) {
+            bool success = message.ParseFromArray(begin, end - begin);
             if (!success) {
                 throw InvalidProtobufMessage(
                     "a valid packet was received, but it could not be successfully "\
                     "unmarshalled by the protocol buffer implementation"
                 );
             }
-            return result;
         }
 
+        /** Whether encryption has been enabled with setEncryptionKey */
+        bool isEncrypted() const {
+            return Cipher::ENABLED && m_encrypted;
+        }
+
+        /** The algorithm used to encrypt the sent messages
+         *
+         * Only valid if isEncrypted() is true
+         */
+        protocol::CipherAlgorithm getCipherAlgorithm() const {
+            return m_cipher->algorithm;
+        }
+
+        /** The filter that rejects replayed messages
+         *
+         * It rejects the messages sent by this channel, and the ones of the
+         * sessions of the remote side that have been replaced by a newer
+         * one. See protocol::ReplayWindow
+         */
+        protocol::ReplayWindow const& getReplayWindow() const {
+            return m_replay_window;
+        }
+
+        /** Create a new cipher context with the channel's key
+         *
+         * OpenSSL contexts cannot be shared between threads. This allows
+         * to decrypt frames received by this channel from other threads.
+         *
+         * @return the new context, or null if encryption is disabled
+         */
+        std::unique_ptr<protocol::CipherContext> createCipherContext() const {
+            if (!isEncrypted()) {
+                return std::unique_ptr<protocol::CipherContext>();
+            }
+
+            protocol::aes_key key;
+            std::copy(m_cipher->key, m_cipher->key + key.size(), key.begin());
+            return std::unique_ptr<protocol::CipherContext>(
+                new protocol::CipherContext(key, m_cipher->algorithm)
+            );
+        }
+
+        template<typename Callback>
+        size_t drain(Callback callback) {
+            return drain(callback, getReadTimeout(), getReadTimeout());
+        }
+
+        template<typename Callback>
+        size_t drain(Callback callback, base::Time const& timeout) {
+            return drain(callback, timeout, timeout);
+        }
+
+        /** Read all messages that are already available, and pass them to
+         * a callback
+         *
+         * The method waits (up to the given timeouts) for a first message,
+         * and then processes all the frames already present in the driver's
+         * internal buffer without waiting further. With fragmentation, the
+         * fragments of a message that is not complete yet are kept for the
+         * next call.
+         *
+         * The callback is called with a Remote& argument. The same object is
+         * reused between calls, so its contents must be copied or moved
+         * if needed after the callback returns.
+         *
+         * @return the number of messages passed to the callback
+         */
+        template<typename Callback>
+        size_t drain(Callback callback, base::Time const& timeout,
+                     base::Time const& first_byte_timeout) {
+            Remote message;
+            read(message, timeout, first_byte_timeout);
+            callback(message);
+
+            size_t count = 1;
+            while (hasPacket()) {
+                if (readBufferedFrame(message)) {
+                    callback(message);
+                    ++count;
+                }
+            }
+            return count;
+        }
+
+        size_t readAll(std::vector<Remote>& messages) {
+            return readAll(messages, getReadTimeout(), getReadTimeout());
+        }
+
+        size_t readAll(std::vector<Remote>& messages, base::Time const& timeout) {
+            return readAll(messages, timeout, timeout);
+        }
+
+        /** Read all messages that are already available
+         *
+         * See drain() for the waiting behavior. The messages are appended to
+         * the given vector
+         *
+         * @return the number of messages appended to the vector
+         */
+        size_t readAll(std::vector<Remote>& messages, base::Time const& timeout,
+                       base::Time const& first_byte_timeout) {
+            return drain(
+                [&messages](Remote& message) {
+                    messages.push_back(std::move(message));
+                }, timeout, first_byte_timeout
+            );
+        }
+
+        /** Write a message
+         *
+         * In coalescing mode (see setWriteCoalescing), the message is queued
+         * and only written once the queue is full or has expired
+         *
+         * @throw std::invalid_argument if the message is bigger than
+         *   max_message_size and fragmentation is disabled
+         */
         void write(Local const& message) {
-            uint8_t* end;
-            if (m_encrypted) {
-#if GOOGLE_PROTOBUF_VERSION >= 3006001
-                size_t serialized_length = message.ByteSizeLong();
-#else
-                size_t serialized_length = message.ByteSize();
-#endif
-                message.SerializeWithCachedSizesToArray(&m_plaintext_buffer[0]);
+            if (m_coalescing_max_size) {
+                queueMessage(message, m_coalescing_max_size);
+                if (base::Time::now() >= m_coalescing_deadline) {
+                    flush();
+                }
+                return;
+            }
+
+            stats::ScopedTimer timer(m_stats.encode_time);
+            size_t message_length = prepareMessage(message);
+            validateMessageLength(message_length);
+            if (getEncodedSize(message_length) > m_io_buffer_size) {
+                // Only possible with fragmentation
+                queuePreparedMessage(message, message_length, m_io_buffer_size,
+                                     timer);
+                timer.pause();
+                flush();
+                return;
+            }
 
-                protocol::aes_tag tag;
-                size_t ciphertext_length = protocol::encrypt(
-                    *m_cipher, &m_ciphertext_buffer[sizeof(tag)], tag,
-                    &m_plaintext_buffer[0], serialized_length
+            uint8_t* io_buffer = getIOBuffer();
+            uint8_t* end = encodeMessage(
+                io_buffer, io_buffer + m_io_buffer_size, message, message_length
+            );
+            timer.pause();
+            writePacket(io_buffer, end - io_buffer);
+            commitMessage(message);
+        }
+
+        /** Write a sequence of messages
+         *
+         * The frames are packed in as few writePacket calls as possible,
+         * each one being at most the size of the internal I/O buffer (or
+         * the coalescing size in coalescing mode). All messages are written
+         * when the method returns.
+         *
+         * @arg begin iterator on the first Local message
+         * @arg end past-the-end iterator
+         */
+        template<typename Iterator>
+        void writeBatch(Iterator begin, Iterator end) {
+            size_t max_size = m_coalescing_max_size ? m_coalescing_max_size
+                                                    : m_io_buffer_size;
+            for (Iterator it = begin; it != end; ++it) {
+                queueMessage(*it, max_size);
+            }
+            flush();
+        }
+
+        /** Enable coalescing of the frames written with write()
+         *
+         * In this mode, the frames are queued and written together in a
+         * single writePacket call when either the next frame would make
+         * the queue exceed max_size bytes, or when the oldest queued frame
+         * has been waiting for more than max_delay. The delay is only
+         * checked when write() is called, so call flush() when no more
+         * messages are to be sent for a while.
+         *
+         * On datagram links, max_size should be less than the link's MTU.
+         */
+        void setWriteCoalescing(size_t max_size, base::Time const& max_delay) {
+            flush();
+            m_coalescing_max_size = max_size;
+            m_coalescing_max_delay = max_delay;
+        }
+
+        /** Go back to writing each message as soon as write() is called
+         *
+         * Queued frames are flushed
+         */
+        void disableWriteCoalescing() {
+            flush();
+            m_coalescing_max_size = 0;
+        }
+
+        /** Write all queued frames */
+        void flush() {
+            if (!m_write_queue_size) {
+                return;
+            }
+
+            size_t size = m_write_queue_size;
+            m_write_queue_size = 0;
+            writePacket(m_write_queue.data(), size);
+        }
+
+        /** Encode a message and append the resulting frame to a buffer
+         *
+         * This is meant for code that does its own I/O, such as
+         * AsyncChannel. The frame is encrypted if encryption is enabled,
+         * and split in several frames if fragmentation is enabled and the
+         * message is too big
+         *
+         * @return the number of bytes appended to the buffer
+         * @throw std::invalid_argument if the message is bigger than
+         *   max_message_size and fragmentation is disabled
+         */
+        size_t appendFrame(std::vector<uint8_t>& buffer, Local const& message) {
+            stats::ScopedTimer timer(m_stats.encode_time);
+            size_t message_length = prepareMessage(message);
+            validateMessageLength(message_length);
+            size_t frame_size = getEncodedSize(message_length);
+
+            size_t offset = buffer.size();
+            buffer.resize(offset + frame_size);
+            encodeMessage(buffer.data() + offset, buffer.data() + buffer.size(),
+                          message, message_length);
+            commitMessage(message);
+            return frame_size;
+        }
+
+        /** Number of bytes queued and waiting for flush() */
+        size_t getWriteQueueSize() const {
+            return m_write_queue_size;
+        }
+
+    private:
+        /** Size of the payload generated for a plaintext of the given size */
+        size_t getPayloadSize(size_t plaintext_length) const {
+            if (isEncrypted()) {
+                return plaintext_length +
+                       sizeof(protocol::aes_iv) + sizeof(protocol::aes_tag);
+            }
+            return plaintext_length;
+        }
+
+        /** Compute the size of the bytes sent for a message, and prepare
+         * them if needed
+         *
+         * Without compression and delta encoding, this computes the
+         * serialized size of the message, which protobuf caches for the
+         * serialization. Otherwise, the message is serialized, delta-encoded
+         * and compressed in m_message_buffer. It must be called exactly
+         * once per message, right before encodeMessage, and followed by
+         * commitMessage once the message's frames are written or queued
+         */
+        size_t prepareMessage(Local const& message) {
+            if (!m_compression && !m_delta) {
+                return protocol::getSerializedSize(message);
+            }
+            else if (!m_compression) {
+                return serializeMessage(message, m_message_buffer);
+            }
+
+            size_t serialized_length = serializeMessage(message, m_serialization_buffer);
+            auto const& options = m_compression->getOptions();
+            size_t max_length = 1 + serialized_length;
+            m_message_buffer.resize(max_length);
+            uint8_t* buffer = m_message_buffer.data();
+            if (options.algorithm != compression::NONE &&
+                serialized_length >= options.threshold) {
+                // Compress only if it makes the message smaller than the
+                // uncompressed flag byte and message
+                size_t header_length = 1 + std::max<size_t>(
+                    1, protocol::getLengthEncodedSize(serialized_length)
                 );
+                if (header_length < max_length) {
+                    buffer[0] = options.algorithm;
+                    uint8_t* data = protocol::encodeLength(
+                        buffer + 1, buffer + max_length, serialized_length
+                    );
+                    size_t compressed_length = m_compression->compress(
+                        data, max_length - 1 - header_length,
+                        m_serialization_buffer.data(), serialized_length
+                    );
+                    if (compressed_length) {
+                        return header_length + compressed_length;
+                    }
+                }
+            }
 
-                std::copy(tag.begin(), tag.end(), m_ciphertext_buffer.begin());
+            buffer[0] = compression::NONE;
+            std::memcpy(buffer + 1, m_serialization_buffer.data(), serialized_length);
+            return max_length;
+        }
 
-                end = protocol::encodeFrame(
-                    m_io_buffer.data(),
-                    m_io_buffer.data() + m_io_buffer.size(),
-                    m_ciphertext_buffer.data(),
-                    m_ciphertext_buffer.data() + ciphertext_length + sizeof(tag)
+        /** Serialize a message in the given buffer, delta-encoding it if
+         * enabled
+         *
+         * @return the number of bytes written. The buffer is resized to it
+         */
+        size_t serializeMessage(Local const& message, std::vector<uint8_t>& buffer) {
+            if (!m_delta) {
+                size_t length = protocol::getSerializedSize(message);
+                buffer.resize(length);
+                message.SerializeWithCachedSizesToArray(buffer.data());
+                return length;
+            }
+
+            // The state is only updated by commitMessage(), once the
+            // message has been accepted
+            DeltaState& state = *m_delta;
+            delta::Header header;
+            Local const* payload = &message;
+            state.pending_keyframe =
+                state.keyframe_requested ||
+                state.messages_since_keyframe + 1 >= state.keyframe_period;
+            if (state.pending_keyframe) {
+                header.keyframe_id = state.keyframe_id + 1;
+            }
+            else {
+                header.type = delta::DELTA;
+                header.keyframe_id = state.keyframe_id;
+                state.diff(state.keyframe, message, state.delta,
+                           header.cleared_fields);
+                payload = &state.delta;
+            }
+
+            size_t header_length = delta::getHeaderSize(header);
+            size_t length = header_length + protocol::getSerializedSize(*payload);
+            buffer.resize(length);
+            uint8_t* serialized = delta::encodeHeader(buffer.data(), header);
+            payload->SerializeWithCachedSizesToArray(serialized);
+            return length;
+        }
+
+        /** Update the delta encoding state once the frames of a message
+         * prepared by prepareMessage have been written or queued
+         *
+         * A message that is rejected, or whose encoding fails, must not
+         * be committed, so that the following deltas are not computed
+         * against a keyframe the remote side never received
+         */
+        void commitMessage(Local const& message) {
+            if (!m_delta) {
+                return;
+            }
+
+            DeltaState& state = *m_delta;
+            if (state.pending_keyframe) {
+                state.keyframe.CopyFrom(message);
+                state.keyframe_requested = false;
+                state.messages_since_keyframe = 0;
+                state.keyframe_id++;
+            }
+            else {
+                state.messages_since_keyframe++;
+            }
+        }
+
+        /** Verify that a message can be sent
+         *
+         * Without fragmentation, messages must fit in a single frame
+         *
+         * @arg message_length the message length as returned by
+         *   prepareMessage
+         * @throw std::invalid_argument
+         */
+        void validateMessageLength(size_t message_length) const {
+            if (!m_fragment_chunk_size && message_length > m_max_message_size) {
+                throw std::invalid_argument(
+                    "cannot send a message of " + std::to_string(message_length) +
+                    " bytes, the maximum is " + std::to_string(m_max_message_size) +
+                    ". Enable fragmentation to send bigger messages"
                 );
             }
+        }
+
+        /** Size of the frames generated for a message
+         *
+         * This is the size of a single frame, unless the message is
+         * fragmented
+         *
+         * @arg message_length the message length as returned by
+         *   prepareMessage
+         */
+        size_t getEncodedSize(size_t message_length) const {
+            if (!m_fragment_chunk_size) {
+                return FrameCodec::getFrameSize(getPayloadSize(message_length));
+            }
+
+            size_t count = fragmentation::getFragmentCount(
+                message_length, m_fragment_chunk_size
+            );
+            size_t last_chunk_size =
+                message_length - (count - 1) * m_fragment_chunk_size;
+            size_t full_frame_size = FrameCodec::getFrameSize(
+                getPayloadSize(fragmentation::HEADER_SIZE + m_fragment_chunk_size)
+            );
+            return (count - 1) * full_frame_size + FrameCodec::getFrameSize(
+                getPayloadSize(fragmentation::HEADER_SIZE + last_chunk_size)
+            );
+        }
+
+        /** Write the bytes of a message prepared by prepareMessage */
+        void writeMessage(uint8_t* buffer, Local const& message,
+                          size_t message_length) const {
+            if (m_compression || m_delta) {
+                std::memcpy(buffer, m_message_buffer.data(), message_length);
+            }
             else {
-                end = protocol::encodeFrame(
-                    &m_io_buffer[0], &m_io_buffer[0] + m_io_buffer.size(),
-                    message
+                message.SerializeWithCachedSizesToArray(buffer);
+            }
+        }
+
+        /** Encode a message in the given buffer
+         *
+         * The message is encoded as a single frame, or as a sequence of
+         * frames if it needs to be fragmented
+         *
+         * @arg message_length the message length as returned by
+         *   prepareMessage
+         * @return past-the-end pointer of the last frame
+         */
+        uint8_t* encodeMessage(uint8_t* buffer, uint8_t* buffer_end,
+                               Local const& message, size_t message_length) {
+            if (!m_fragment_chunk_size) {
+                return encodeFrame(
+                    buffer, buffer_end, message_length,
+                    [this, &message, message_length](uint8_t* plaintext) {
+                        writeMessage(plaintext, message, message_length);
+                    }
                 );
             }
-            writePacket(&m_io_buffer[0], end - &m_io_buffer[0]);
+
+            fragmentation::Header header;
+            header.message_id = m_next_message_id++;
+            header.count = fragmentation::getFragmentCount(
+                message_length, m_fragment_chunk_size
+            );
+            if (header.count == 1) {
+                return encodeFrame(
+                    buffer, buffer_end, fragmentation::HEADER_SIZE + message_length,
+                    [this, &message, message_length, &header](uint8_t* plaintext) {
+                        plaintext = fragmentation::encodeHeader(plaintext, header);
+                        writeMessage(plaintext, message, message_length);
+                    }
+                );
+            }
+
+            uint8_t const* message_bytes = m_message_buffer.data();
+            if (!m_compression && !m_delta) {
+                m_fragment_buffer.resize(message_length);
+                message.SerializeWithCachedSizesToArray(m_fragment_buffer.data());
+                message_bytes = m_fragment_buffer.data();
+            }
+            for (header.index = 0; header.index < header.count; ++header.index) {
+                size_t offset = header.index * m_fragment_chunk_size;
+                size_t chunk_size = std::min(m_fragment_chunk_size,
+                                             message_length - offset);
+                uint8_t const* chunk = message_bytes + offset;
+                buffer = encodeFrame(
+                    buffer, buffer_end, fragmentation::HEADER_SIZE + chunk_size,
+                    [&header, chunk, chunk_size](uint8_t* plaintext) {
+                        plaintext = fragmentation::encodeHeader(plaintext, header);
+                        std::memcpy(plaintext, chunk, chunk_size);
+                    }
+                );
+            }
+            return buffer;
+        }
+
+        /** Encode a single frame in the given buffer
+         *
+         * The frame is built in place: header, IV and tag if encryption is
+         * enabled, and then the plaintext written by the fill function,
+         * which is then encrypted where it is
+         *
+         * @arg plaintext_length the size of the frame's plaintext
+         * @arg fill functor called with a pointer to the plaintext area. It
+         *   must write exactly plaintext_length bytes
+         * @return past-the-end pointer of the frame
+         */
+        template<typename Fill>
+        uint8_t* encodeFrame(uint8_t* buffer, uint8_t* buffer_end,
+                             size_t plaintext_length, Fill fill) {
+            m_stats.frames_sent.add();
+            if (!isEncrypted()) {
+                uint8_t* payload = FrameCodec::encodeFrameHeader(
+                    buffer, buffer_end, plaintext_length
+                );
+                fill(payload);
+                uint8_t* end = FrameCodec::encodeFrameTrailer(
+                    buffer, payload + plaintext_length
+                );
+                m_stats.bytes_sent.add(end - buffer);
+                return end;
+            }
+
+            size_t header_size = sizeof(protocol::aes_iv) + sizeof(protocol::aes_tag);
+            uint8_t* payload = FrameCodec::encodeFrameHeader(
+                buffer, buffer_end, header_size + plaintext_length
+            );
+            uint8_t* plaintext = payload + header_size;
+            fill(plaintext);
+
+            protocol::aes_iv iv = m_cipher->nextIV();
+            protocol::aes_tag tag;
+            size_t ciphertext_length;
+            {
+                stats::ScopedTimer timer(m_stats.encrypt_time);
+                ciphertext_length = protocol::encrypt(
+                    *m_cipher, iv, plaintext, tag, plaintext, plaintext_length
+                );
+            }
+            if (ciphertext_length != plaintext_length) {
+                throw protocol::InternalError(
+                    "ciphertext and plaintext lengths differ"
+                );
+            }
+
+            std::copy(iv.begin(), iv.end(), payload);
+            std::copy(tag.begin(), tag.end(), payload + sizeof(iv));
+            uint8_t* end = FrameCodec::encodeFrameTrailer(
+                buffer, plaintext + ciphertext_length
+            );
+            m_stats.bytes_sent.add(end - buffer);
+            return end;
+        }
+
+        /** Append the frame(s) of a message to the write queue
+         *
+         * The queue is flushed first if adding the frames would make it
+         * bigger than max_size. Frames bigger than max_size are sent on
+         * their own
+         */
+        void queueMessage(Local const& message, size_t max_size) {
+            stats::ScopedTimer timer(m_stats.encode_time);
+            queuePreparedMessage(message, prepareMessage(message), max_size, timer);
+        }
+
+        /** Append the frame(s) of a message already passed to
+         * prepareMessage to the write queue
+         *
+         * @arg timer the encoding timer, paused while flushing the queue
+         */
+        void queuePreparedMessage(Local const& message, size_t message_length,
+                                  size_t max_size, stats::ScopedTimer& timer) {
+            validateMessageLength(message_length);
+            size_t frame_size = getEncodedSize(message_length);
+            if (m_write_queue_size + frame_size > max_size) {
+                timer.pause();
+                flush();
+                timer.resume();
+            }
+
+            size_t needed_size = m_write_queue_size + frame_size;
+            if (m_write_queue.size() < needed_size) {
+                m_write_queue.resize(needed_size);
+            }
+            if (!m_write_queue_size) {
+                m_coalescing_deadline = base::Time::now() + m_coalescing_max_delay;
+            }
+
+            uint8_t* begin = m_write_queue.data() + m_write_queue_size;
+            uint8_t* end = encodeMessage(begin, begin + frame_size,
+                                         message, message_length);
+            m_write_queue_size += end - begin;
+            commitMessage(message);
         }
     };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,179 @@
+#include <comms_protobuf/Compression.hpp>
+
+#include <algorithm>
+#include <string>
+
+#ifdef COMMS_PROTOBUF_HAS_LZ4
+#include <lz4.h>
+#endif
+#ifdef COMMS_PROTOBUF_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+using namespace comms_protobuf;
+using namespace comms_protobuf::compression;
+
+bool compression::isAvailable(Algorithm algorithm) {
+    switch (algorithm) {
+        case NONE:
+            return true;
+#ifdef COMMS_PROTOBUF_HAS_LZ4
+        case LZ4:
+            return true;
+#endif
+#ifdef COMMS_PROTOBUF_HAS_ZSTD
+        case ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+#ifdef COMMS_PROTOBUF_HAS_ZSTD
+struct Codec::ZstdState {
+    ZSTD_CCtx* cctx = nullptr;
+    ZSTD_DCtx* dctx = nullptr;
+    ZSTD_CDict* cdict = nullptr;
+    ZSTD_DDict* ddict = nullptr;
+
+    ZstdState(Options const& options) {
+        cctx = ZSTD_createCCtx();
+        dctx = ZSTD_createDCtx();
+        if (!options.dictionary.empty()) {
+            int level = options.level ? options.level : ZSTD_CLEVEL_DEFAULT;
+            cdict = ZSTD_createCDict(options.dictionary.data(),
+                                     options.dictionary.size(), level);
+            ddict = ZSTD_createDDict(options.dictionary.data(),
+                                     options.dictionary.size());
+        }
+        if (!cctx || !dctx || (!options.dictionary.empty() && (!cdict || !ddict))) {
+            release();
+            throw std::invalid_argument("failed to create the zstd contexts");
+        }
+    }
+
+    ~ZstdState() {
+        release();
+    }
+
+    void release() {
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+};
+
+Codec::ZstdState& Codec::getZstdState() {
+    if (!m_zstd) {
+        m_zstd.reset(new ZstdState(m_options));
+    }
+    return *m_zstd;
+}
+#else
+struct Codec::ZstdState {};
+#endif
+
+Codec::Codec(Options const& options)
+    : m_options(options) {
+    if (!isAvailable(options.algorithm)) {
+        throw std::invalid_argument(
+            "compression algorithm " + to_string(options.algorithm) +
+            " is not available in this build"
+        );
+    }
+}
+
+Codec::~Codec() {
+}
+
+Options const& Codec::getOptions() const {
+    return m_options;
+}
+
+size_t Codec::compress(uint8_t* dst, size_t dst_capacity,
+                       uint8_t const* src, size_t src_size) {
+    switch (m_options.algorithm) {
+#ifdef COMMS_PROTOBUF_HAS_LZ4
+        case LZ4: {
+            if (src_size > LZ4_MAX_INPUT_SIZE) {
+                return 0;
+            }
+            int size = LZ4_compress_default(
+                reinterpret_cast<char const*>(src), reinterpret_cast<char*>(dst),
+                src_size, min<size_t>(dst_capacity, LZ4_MAX_INPUT_SIZE)
+            );
+            return size > 0 ? size : 0;
+        }
+#endif
+#ifdef COMMS_PROTOBUF_HAS_ZSTD
+        case ZSTD: {
+            ZstdState& zstd = getZstdState();
+            size_t size;
+            if (zstd.cdict) {
+                size = ZSTD_compress_usingCDict(zstd.cctx, dst, dst_capacity,
+                                                src, src_size, zstd.cdict);
+            }
+            else {
+                int level = m_options.level ? m_options.level : ZSTD_CLEVEL_DEFAULT;
+                size = ZSTD_compressCCtx(zstd.cctx, dst, dst_capacity,
+                                         src, src_size, level);
+            }
+            // Errors here are in practice always 'destination too small'
+            return ZSTD_isError(size) ? 0 : size;
+        }
+#endif
+        default:
+            return 0;
+    }
+}
+
+void Codec::decompress(Algorithm algorithm, uint8_t* dst, size_t dst_size,
+                       uint8_t const* src, size_t src_size) {
+    switch (algorithm) {
+#ifdef COMMS_PROTOBUF_HAS_LZ4
+        case LZ4: {
+            int size = LZ4_decompress_safe(
+                reinterpret_cast<char const*>(src), reinterpret_cast<char*>(dst),
+                src_size, dst_size
+            );
+            if (size < 0 || static_cast<size_t>(size) != dst_size) {
+                throw DecompressionFailed("LZ4 decompression failed");
+            }
+            return;
+        }
+#endif
+#ifdef COMMS_PROTOBUF_HAS_ZSTD
+        case ZSTD: {
+            ZstdState& zstd = getZstdState();
+            size_t size;
+            if (zstd.ddict) {
+                size = ZSTD_decompress_usingDDict(zstd.dctx, dst, dst_size,
+                                                  src, src_size, zstd.ddict);
+            }
+            else {
+                size = ZSTD_decompressDCtx(zstd.dctx, dst, dst_size,
+                                           src, src_size);
+            }
+            if (ZSTD_isError(size)) {
+                throw DecompressionFailed(
+                    string("zstd decompression failed: ") + ZSTD_getErrorName(size)
+                );
+            }
+            else if (size != dst_size) {
+                throw DecompressionFailed(
+                    "zstd decompression did not produce the announced size"
+                );
+            }
+            return;
+        }
+#endif
+        default:
+            throw DecompressionFailed(
+                "received a message compressed with algorithm " +
+                to_string(algorithm) + ", which is not available in this build"
+            );
+    }
+}
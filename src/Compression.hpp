@@ -0,0 +1,104 @@
+#ifndef COMMS_PROTOBUF_COMPRESSION_HPP
+#define COMMS_PROTOBUF_COMPRESSION_HPP
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace comms_protobuf {
+    struct CompressionFailed : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+    struct DecompressionFailed : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    /** Compression of the serialized messages
+     *
+     * When compression is enabled on a channel, the message bytes start
+     * with a flag byte giving the algorithm used for this message. It is
+     * followed by the uncompressed size (encoded as a frame length) and the
+     * compressed data, or directly by the serialized message if the
+     * algorithm is NONE.
+     */
+    namespace compression {
+        enum Algorithm {
+            NONE = 0,
+            /** LZ4, for the lowest latency */
+            LZ4 = 1,
+            /** zstd, for the best ratio. Use a dictionary trained on
+             * representative messages to compress small messages well
+             */
+            ZSTD = 2
+        };
+
+        /** Whether the library was built with support for this algorithm */
+        bool isAvailable(Algorithm algorithm);
+
+        struct Options {
+            /** The algorithm used to compress outgoing messages
+             *
+             * Incoming messages may use any available algorithm
+             */
+            Algorithm algorithm = LZ4;
+
+            /** Messages whose serialized size is below this threshold are
+             * sent uncompressed
+             */
+            size_t threshold = 128;
+
+            /** Compression level. Zero uses the algorithm's default
+             *
+             * Only used by zstd
+             */
+            int level = 0;
+
+            /** zstd dictionary, as generated by `zstd --train`
+             *
+             * Both sides of the channel must use the same dictionary
+             */
+            std::vector<uint8_t> dictionary;
+        };
+
+        /** Compression and decompression state */
+        class Codec {
+        public:
+            /** @throw std::invalid_argument if the algorithm is not available */
+            explicit Codec(Options const& options);
+            ~Codec();
+            Codec(Codec const&) = delete;
+            Codec& operator=(Codec const&) = delete;
+
+            Options const& getOptions() const;
+
+            /** Compress with the configured algorithm
+             *
+             * @return the compressed size, or zero if the compressed data
+             *   would not fit in dst_capacity
+             */
+            size_t compress(uint8_t* dst, size_t dst_capacity,
+                            uint8_t const* src, size_t src_size);
+
+            /** Decompress data that was compressed with the given algorithm
+             *
+             * @arg dst_size the exact uncompressed size
+             * @throw DecompressionFailed
+             */
+            void decompress(Algorithm algorithm, uint8_t* dst, size_t dst_size,
+                            uint8_t const* src, size_t src_size);
+
+        private:
+            Options m_options;
+
+            struct ZstdState;
+            /** zstd contexts, created on first use so that codecs that
+             * never see zstd data do not pay for them
+             */
+            std::unique_ptr<ZstdState> m_zstd;
+            ZstdState& getZstdState();
+        };
+    }
+}
+
+#endif
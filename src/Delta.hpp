@@ -0,0 +1,171 @@
+#ifndef COMMS_PROTOBUF_DELTA_HPP
+#define COMMS_PROTOBUF_DELTA_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <comms_protobuf/Protocol.hpp>
+
+namespace comms_protobuf {
+    /** Exception thrown when receiving a delta-encoded message that cannot
+     * be parsed
+     */
+    struct InvalidDelta : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    /** Exception thrown when receiving a delta against a keyframe that has
+     * not been received
+     *
+     * The following deltas will fail in the same way until the next
+     * keyframe is received
+     */
+    struct MissingKeyframe : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    /** Sending only the fields that changed since the last keyframe
+     *
+     * When delta encoding is enabled on a channel, the message bytes start
+     * with a delta header. A keyframe contains the full message, which
+     * becomes the reference for the following deltas. A delta contains
+     * only the top-level fields that differ from the reference, as well as
+     * the numbers of the fields that are set in the reference but not in
+     * the message.
+     *
+     * Deltas are computed against the last keyframe rather than against the
+     * previous message, so that losing a delta does not prevent decoding
+     * the following ones.
+     *
+     * This header only defines the format of the delta header. The delta
+     * computation itself is in DeltaReflection.hpp, so that channels that
+     * do not use delta encoding do not depend on protobuf's reflection
+     */
+    namespace delta {
+        enum Type {
+            KEYFRAME = 0,
+            DELTA = 1
+        };
+
+        /** Delta header
+         *
+         * Encoded as the type (one byte), the keyframe ID and, for deltas,
+         * the number of cleared fields followed by the cleared field
+         * numbers, all encoded as frame lengths
+         */
+        struct Header {
+            Type type = KEYFRAME;
+            uint32_t keyframe_id = 0;
+            std::vector<uint32_t> cleared_fields;
+        };
+
+        /** Size of a header field */
+        inline size_t getFieldSize(size_t value) {
+            return std::max<size_t>(1, protocol::getLengthEncodedSize(value));
+        }
+
+        /** Size of the encoded header */
+        inline size_t getHeaderSize(Header const& header) {
+            size_t size = 1 + getFieldSize(header.keyframe_id);
+            if (header.type == KEYFRAME) {
+                return size;
+            }
+
+            size += getFieldSize(header.cleared_fields.size());
+            for (uint32_t number : header.cleared_fields) {
+                size += getFieldSize(number);
+            }
+            return size;
+        }
+
+        /** Encode a header
+         *
+         * The buffer must be at least getHeaderSize(header) bytes
+         *
+         * @return the pointer past the header
+         */
+        inline uint8_t* encodeHeader(uint8_t* buffer, Header const& header) {
+            uint8_t* end = buffer + getHeaderSize(header);
+            *buffer++ = header.type;
+            buffer = protocol::encodeLength(buffer, end, header.keyframe_id);
+            if (header.type == KEYFRAME) {
+                return buffer;
+            }
+
+            buffer = protocol::encodeLength(buffer, end, header.cleared_fields.size());
+            for (uint32_t number : header.cleared_fields) {
+                buffer = protocol::encodeLength(buffer, end, number);
+            }
+            return buffer;
+        }
+
+        /** Parse a header field, and advance begin past it */
+        inline uint32_t parseField(uint8_t const*& begin, uint8_t const* end,
+                                   char const* name) {
+            auto parsed = protocol::parseLength(begin, end);
+            if (!parsed.second || parsed.first > UINT32_MAX) {
+                throw InvalidDelta(
+                    std::string("received a delta header with an invalid ") + name
+                );
+            }
+            begin = parsed.second;
+            return parsed.first;
+        }
+
+        /** Parse the header at the start of the buffer
+         *
+         * @return the pointer past the header
+         * @throw InvalidDelta if the header is truncated or invalid
+         */
+        inline uint8_t const* parseHeader(uint8_t const* begin, uint8_t const* end,
+                                          Header& header) {
+            if (begin == end) {
+                throw InvalidDelta(
+                    "received an empty message while delta encoding is enabled"
+                );
+            }
+
+            uint8_t type = *begin++;
+            if (type != KEYFRAME && type != DELTA) {
+                throw InvalidDelta(
+                    "received a message with unknown delta type " +
+                    std::to_string(type)
+                );
+            }
+            header.type = static_cast<Type>(type);
+            header.keyframe_id = parseField(begin, end, "keyframe ID");
+            header.cleared_fields.clear();
+            if (header.type == KEYFRAME) {
+                return begin;
+            }
+
+            size_t count = parseField(begin, end, "cleared field count");
+            // Each field number is at least one byte
+            if (count > static_cast<size_t>(end - begin)) {
+                throw InvalidDelta(
+                    "received a delta header announcing more cleared fields "
+                    "than it contains"
+                );
+            }
+            header.cleared_fields.resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                header.cleared_fields[i] =
+                    parseField(begin, end, "cleared field number");
+            }
+            return begin;
+        }
+
+        /** Computation and application of deltas between messages
+         *
+         * It is only declared here. The definition, in DeltaReflection.hpp,
+         * relies on protobuf's reflection and therefore requires full (not
+         * LITE) message types. Include it in the code that calls
+         * Channel::enableDeltaEncoding
+         */
+        template<typename Message> struct Reflection;
+    }
+}
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef COMMS_PROTOBUF_DELTA_REFLECTION_HPP
+#define COMMS_PROTOBUF_DELTA_REFLECTION_HPP
+
+#include <vector>
+#include <google/protobuf/message.h>
+#include <google/protobuf/util/message_differencer.h>
+#include <comms_protobuf/Delta.hpp>
+
+namespace comms_protobuf {
+    namespace delta {
+        /** Whether a field is set
+         *
+         * proto3 scalar fields without presence are considered set when they
+         * are not zero
+         */
+        inline bool hasField(google::protobuf::Message const& message,
+                             google::protobuf::FieldDescriptor const* field) {
+            auto const* reflection = message.GetReflection();
+            if (field->is_repeated()) {
+                return reflection->FieldSize(message, field) != 0;
+            }
+            return reflection->HasField(message, field);
+        }
+
+        /** Compute the delta between a message and a reference
+         *
+         * @arg delta the message, without the fields that are equal to the
+         *   reference
+         * @arg cleared_fields the numbers of the fields that are set in the
+         *   reference but not in the message
+         */
+        inline void diff(google::protobuf::Message const& reference,
+                         google::protobuf::Message const& message,
+                         google::protobuf::Message& delta,
+                         std::vector<uint32_t>& cleared_fields) {
+            using google::protobuf::util::MessageDifferencer;
+
+            delta.CopyFrom(message);
+            cleared_fields.clear();
+
+            MessageDifferencer differencer;
+            differencer.set_scope(MessageDifferencer::FULL);
+            auto const* descriptor = message.GetDescriptor();
+            auto const* reflection = delta.GetReflection();
+            for (int i = 0; i < descriptor->field_count(); ++i) {
+                auto const* field = descriptor->field(i);
+                bool in_reference = hasField(reference, field);
+                bool in_message = hasField(message, field);
+                if (!in_message) {
+                    if (in_reference) {
+                        cleared_fields.push_back(field->number());
+                    }
+                    continue;
+                }
+                else if (!in_reference) {
+                    continue;
+                }
+
+                std::vector<google::protobuf::FieldDescriptor const*> fields = { field };
+                if (differencer.CompareWithFields(reference, message, fields, fields)) {
+                    reflection->ClearField(&delta, field);
+                }
+            }
+        }
+
+        /** Apply a delta computed by diff
+         *
+         * @arg target the reference message on input, the reconstructed
+         *   message on output
+         */
+        inline void apply(google::protobuf::Message& target,
+                          google::protobuf::Message const& delta,
+                          std::vector<uint32_t> const& cleared_fields) {
+            auto const* descriptor = target.GetDescriptor();
+            auto const* reflection = target.GetReflection();
+            for (uint32_t number : cleared_fields) {
+                auto const* field = descriptor->FindFieldByNumber(number);
+                if (field) {
+                    reflection->ClearField(&target, field);
+                }
+            }
+
+            // Merging appends to repeated fields and merges sub-messages,
+            // while the delta contains the whole new field
+            for (int i = 0; i < descriptor->field_count(); ++i) {
+                auto const* field = descriptor->field(i);
+                if (hasField(delta, field)) {
+                    reflection->ClearField(&target, field);
+                }
+            }
+            target.MergeFrom(delta);
+        }
+
+        template<typename Message>
+        struct Reflection {
+            static void diff(Message const& reference, Message const& message,
+                             Message& delta, std::vector<uint32_t>& cleared_fields) {
+                delta::diff(reference, message, delta, cleared_fields);
+            }
+
+            static void apply(Message& target, Message const& delta,
+                              std::vector<uint32_t> const& cleared_fields) {
+                delta::apply(target, delta, cleared_fields);
+            }
+        };
+    }
+}
+
+#endif
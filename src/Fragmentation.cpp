@@ -0,0 +1,252 @@
+#include <comms_protobuf/Fragmentation.hpp>
+
+#include <algorithm>
+
+using namespace std;
+using namespace comms_protobuf;
+using namespace comms_protobuf::fragmentation;
+
+uint8_t* fragmentation::encodeHeader(uint8_t* buffer, Header const& header) {
+    for (int i = 0; i < 4; ++i) {
+        buffer[i] = (header.message_id >> (8 * i)) & 0xFF;
+    }
+    buffer[4] = header.index & 0xFF;
+    buffer[5] = header.index >> 8;
+    buffer[6] = header.count & 0xFF;
+    buffer[7] = header.count >> 8;
+    return buffer + HEADER_SIZE;
+}
+
+Header fragmentation::parseHeader(uint8_t const* begin, uint8_t const* end) {
+    if (end - begin < static_cast<int>(HEADER_SIZE)) {
+        throw InvalidFragment(
+            "received payload is too small to contain a fragment header"
+        );
+    }
+
+    Header header;
+    header.message_id = 0;
+    for (int i = 0; i < 4; ++i) {
+        header.message_id |= static_cast<uint32_t>(begin[i]) << (8 * i);
+    }
+    header.index = begin[4] | static_cast<uint16_t>(begin[5]) << 8;
+    header.count = begin[6] | static_cast<uint16_t>(begin[7]) << 8;
+    if (header.count == 0 || header.index >= header.count) {
+        throw InvalidFragment(
+            "received fragment " + to_string(header.index) + " of a message "
+            "announced as having " + to_string(header.count) + " fragments"
+        );
+    }
+    return header;
+}
+
+size_t fragmentation::getFragmentCount(size_t message_size, size_t chunk_size) {
+    size_t count = max<size_t>(1, (message_size + chunk_size - 1) / chunk_size);
+    if (count > MAX_FRAGMENT_COUNT) {
+        throw std::invalid_argument(
+            "message of " + to_string(message_size) + " bytes would need more "
+            "than " + to_string(MAX_FRAGMENT_COUNT) + " fragments"
+        );
+    }
+    return count;
+}
+
+Reassembler::Reassembler(size_t max_message_size, size_t max_memory,
+                         base::Time const& timeout, size_t max_pending_count)
+    : m_max_message_size(max_message_size)
+    , m_max_memory(max_memory)
+    , m_timeout(timeout)
+    , m_max_pending_count(max_pending_count) {
+    if (max_pending_count == 0) {
+        throw std::invalid_argument(
+            "Reassembler: max_pending_count must be strictly positive"
+        );
+    }
+}
+
+size_t Reassembler::getMessageOverhead(size_t fragment_count) {
+    // Approximation of the size of a std::map node, i.e. the value and
+    // the red-black tree links
+    size_t node_size = sizeof(pair<uint32_t const, Pending>) + 4 * sizeof(void*);
+    return node_size + fragment_count * sizeof(Fragment);
+}
+
+bool Reassembler::push(Header const& header, uint8_t const* begin,
+                       uint8_t const* end, base::Time const& now) {
+    dropExpired(now);
+
+    size_t size = end - begin;
+    auto it = m_pending.find(header.message_id);
+    if (it != m_pending.end() && it->second.fragments.size() != header.count) {
+        // The message ID has been reused for a new message
+        drop(it);
+        it = m_pending.end();
+    }
+
+    if (size > m_max_message_size) {
+        if (it != m_pending.end()) {
+            drop(it);
+        }
+        throw InvalidFragment(
+            "reassembled message would be bigger than the maximum of " +
+            to_string(m_max_message_size) + " bytes"
+        );
+    }
+    else if (header.count == 1) {
+        // Not fragmented, no need to keep it
+        m_message.assign(begin, end);
+        return true;
+    }
+
+    if (it == m_pending.end()) {
+        while (m_pending.size() >= m_max_pending_count) {
+            drop(findOldest(header.message_id));
+        }
+
+        size_t overhead = getMessageOverhead(header.count);
+        if (!reserve(overhead, header.message_id)) {
+            throw InvalidFragment(
+                "message of " + to_string(header.count) + " fragments does not "
+                "fit in the reassembly memory of " + to_string(m_max_memory) +
+                " bytes"
+            );
+        }
+
+        Pending pending;
+        pending.deadline = now + m_timeout;
+        pending.fragments.resize(header.count);
+        pending.memory_usage = overhead;
+        m_memory_usage += overhead;
+        it = m_pending.insert(make_pair(header.message_id, move(pending))).first;
+    }
+
+    Pending& pending = it->second;
+    Fragment& fragment = pending.fragments[header.index];
+    if (fragment.size != NOT_RECEIVED) {
+        return false;
+    }
+
+    size_t required = pending.data.size() + size;
+    if (required > m_max_message_size) {
+        drop(it);
+        throw InvalidFragment(
+            "reassembled message would be bigger than the maximum of " +
+            to_string(m_max_message_size) + " bytes"
+        );
+    }
+
+    size_t capacity = pending.data.capacity();
+    if (required > capacity) {
+        // Grow geometrically if the memory is available, but do not drop
+        // other messages for it
+        size_t new_capacity = min(max(required, 2 * capacity), m_max_message_size);
+        if (m_memory_usage + new_capacity - capacity > m_max_memory) {
+            new_capacity = required;
+        }
+        if (!reserve(new_capacity - capacity, header.message_id)) {
+            drop(it);
+            throw InvalidFragment(
+                "message does not fit in the reassembly memory of " +
+                to_string(m_max_memory) + " bytes"
+            );
+        }
+        pending.data.reserve(new_capacity);
+        pending.memory_usage += new_capacity - capacity;
+        m_memory_usage += new_capacity - capacity;
+    }
+
+    fragment.offset = pending.data.size();
+    fragment.size = size;
+    pending.data.insert(pending.data.end(), begin, end);
+    pending.received_count++;
+    if (pending.received_count != pending.fragments.size()) {
+        return false;
+    }
+
+    assembleMessage(pending);
+    drop(it);
+    return true;
+}
+
+void Reassembler::assembleMessage(Pending& pending) {
+    bool in_order = true;
+    size_t offset = 0;
+    for (auto const& fragment : pending.fragments) {
+        if (fragment.offset != offset) {
+            in_order = false;
+            break;
+        }
+        offset += fragment.size;
+    }
+
+    if (in_order) {
+        m_message.swap(pending.data);
+        return;
+    }
+
+    m_message.clear();
+    m_message.reserve(pending.data.size());
+    for (auto const& fragment : pending.fragments) {
+        auto fragment_begin = pending.data.begin() + fragment.offset;
+        m_message.insert(m_message.end(),
+                         fragment_begin, fragment_begin + fragment.size);
+    }
+}
+
+vector<uint8_t> const& Reassembler::getMessage() const {
+    return m_message;
+}
+
+size_t Reassembler::getPendingCount() const {
+    return m_pending.size();
+}
+
+size_t Reassembler::getMemoryUsage() const {
+    return m_memory_usage;
+}
+
+void Reassembler::clear() {
+    m_pending.clear();
+    m_memory_usage = 0;
+}
+
+void Reassembler::dropExpired(base::Time const& now) {
+    for (auto it = m_pending.begin(); it != m_pending.end(); ) {
+        auto current = it++;
+        if (current->second.deadline <= now) {
+            drop(current);
+        }
+    }
+}
+
+map<uint32_t, Reassembler::Pending>::iterator Reassembler::findOldest(
+    uint32_t except_id
+) {
+    auto oldest = m_pending.end();
+    for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+        if (it->first == except_id) {
+            continue;
+        }
+        else if (oldest == m_pending.end() ||
+                 it->second.deadline < oldest->second.deadline) {
+            oldest = it;
+        }
+    }
+    return oldest;
+}
+
+void Reassembler::drop(map<uint32_t, Pending>::iterator it) {
+    m_memory_usage -= it->second.memory_usage;
+    m_pending.erase(it);
+}
+
+bool Reassembler::reserve(size_t size, uint32_t except_id) {
+    while (m_memory_usage + size > m_max_memory) {
+        auto oldest = findOldest(except_id);
+        if (oldest == m_pending.end()) {
+            return false;
+        }
+        drop(oldest);
+    }
+    return true;
+}
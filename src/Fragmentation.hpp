@@ -0,0 +1,172 @@
+#ifndef COMMS_PROTOBUF_FRAGMENTATION_HPP
+#define COMMS_PROTOBUF_FRAGMENTATION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <vector>
+#include <base/Time.hpp>
+
+namespace comms_protobuf {
+    /** Exception thrown when receiving a fragment that cannot be reassembled */
+    struct InvalidFragment : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    /** Splitting of messages bigger than a frame into several frames
+     *
+     * When fragmentation is enabled, the (decrypted) payload of each frame
+     * starts with a fragment header. The serialized message is split in
+     * chunks, one per frame
+     */
+    namespace fragmentation {
+        /** Fragment header
+         *
+         * Encoded as the message ID (4 bytes), the fragment index and the
+         * fragment count (2 bytes each), all little-endian
+         */
+        struct Header {
+            uint32_t message_id = 0;
+            uint16_t index = 0;
+            uint16_t count = 1;
+        };
+
+        static const size_t HEADER_SIZE = 8;
+
+        /** Maximum number of fragments in a message */
+        static const size_t MAX_FRAGMENT_COUNT = 65535;
+
+        /** Encode a header
+         *
+         * The buffer must be at least HEADER_SIZE bytes
+         *
+         * @return the pointer past the header
+         */
+        uint8_t* encodeHeader(uint8_t* buffer, Header const& header);
+
+        /** Parse the header at the start of the buffer
+         *
+         * @throw InvalidFragment if the buffer is too small or the header is
+         *   inconsistent
+         */
+        Header parseHeader(uint8_t const* begin, uint8_t const* end);
+
+        /** Number of fragments needed to send a message
+         *
+         * @arg message_size the size of the serialized message
+         * @arg chunk_size the maximum number of message bytes in a fragment
+         * @throw std::invalid_argument if the message would need more than
+         *   MAX_FRAGMENT_COUNT fragments
+         */
+        size_t getFragmentCount(size_t message_size, size_t chunk_size);
+
+        /** Reassembly of fragmented messages
+         *
+         * Fragments may arrive out of order, and the fragments of different
+         * messages may be interleaved. The memory used by incomplete messages
+         * is bounded: messages older than the timeout are dropped, and the
+         * oldest incomplete messages are dropped when a new fragment would
+         * exceed the memory limit or the maximum number of incomplete
+         * messages.
+         *
+         * The memory usage includes the bookkeeping of the incomplete
+         * messages, not only the received bytes, so that fragments
+         * announcing many fragments cannot make the reassembler allocate
+         * more than the limit.
+         */
+        class Reassembler {
+        public:
+            /** Default maximum number of incomplete messages */
+            static const size_t DEFAULT_MAX_PENDING_COUNT = 64;
+
+            /**
+             * @arg max_message_size maximum size of a reassembled message
+             * @arg max_memory maximum number of bytes held by incomplete
+             *   messages
+             * @arg timeout time after which an incomplete message is dropped,
+             *   counted from the reception of its first fragment
+             * @arg max_pending_count maximum number of incomplete messages
+             */
+            Reassembler(size_t max_message_size, size_t max_memory,
+                        base::Time const& timeout,
+                        size_t max_pending_count = DEFAULT_MAX_PENDING_COUNT);
+
+            /** Memory counted for the bookkeeping of an incomplete message
+             * of the given number of fragments, excluding the fragments
+             * themselves
+             */
+            static size_t getMessageOverhead(size_t fragment_count);
+
+
+            /** Add a fragment
+             *
+             * @return true if the fragment completes a message. The message
+             *   is then available through getMessage() until the next call
+             * @throw InvalidFragment if the message is bigger than the
+             *   maximum message size. The message is dropped
+             */
+            bool push(Header const& header, uint8_t const* begin,
+                      uint8_t const* end, base::Time const& now);
+
+            /** The last message completed by push() */
+            std::vector<uint8_t> const& getMessage() const;
+
+            /** Number of incomplete messages */
+            size_t getPendingCount() const;
+
+            /** Number of bytes held by incomplete messages, including their
+             * bookkeeping
+             */
+            size_t getMemoryUsage() const;
+
+            /** Drop all incomplete messages */
+            void clear();
+
+        private:
+            static const size_t NOT_RECEIVED = SIZE_MAX;
+
+            /** Location of a fragment in Pending::data */
+            struct Fragment {
+                size_t offset = 0;
+                /** Size of the fragment, or NOT_RECEIVED */
+                size_t size = NOT_RECEIVED;
+            };
+
+            struct Pending {
+                base::Time deadline;
+                size_t received_count = 0;
+                /** The received fragments, in reception order */
+                std::vector<uint8_t> data;
+                /** The location of each fragment, in message order */
+                std::vector<Fragment> fragments;
+                /** Memory counted for this message in m_memory_usage */
+                size_t memory_usage = 0;
+            };
+
+            size_t m_max_message_size;
+            size_t m_max_memory;
+            base::Time m_timeout;
+            size_t m_max_pending_count;
+            size_t m_memory_usage = 0;
+            std::map<uint32_t, Pending> m_pending;
+            std::vector<uint8_t> m_message;
+
+            void dropExpired(base::Time const& now);
+            /** Return the incomplete message that expires first, ignoring
+             * the given message ID
+             */
+            std::map<uint32_t, Pending>::iterator findOldest(uint32_t except_id);
+            void drop(std::map<uint32_t, Pending>::iterator it);
+            /** Drop the oldest messages until the given amount of memory
+             * is available, ignoring the given message ID
+             *
+             * @return false if it is not possible
+             */
+            bool reserve(size_t size, uint32_t except_id);
+            void assembleMessage(Pending& pending);
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,358 @@
+#include <comms_protobuf/FrameLog.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iodrivers_base/Exceptions.hpp>
+
+using namespace std;
+using namespace comms_protobuf;
+using namespace comms_protobuf::frame_log;
+
+namespace {
+    void encode32(uint8_t* buffer, uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            buffer[i] = (value >> (8 * i)) & 0xFF;
+        }
+    }
+
+    void encode64(uint8_t* buffer, uint64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            buffer[i] = (value >> (8 * i)) & 0xFF;
+        }
+    }
+
+    uint32_t decode32(uint8_t const* buffer) {
+        uint32_t value = 0;
+        for (int i = 3; i >= 0; --i) {
+            value = (value << 8) | buffer[i];
+        }
+        return value;
+    }
+
+    uint64_t decode64(uint8_t const* buffer) {
+        uint64_t value = 0;
+        for (int i = 7; i >= 0; --i) {
+            value = (value << 8) | buffer[i];
+        }
+        return value;
+    }
+
+    void encodeFileHeader(uint8_t* buffer, char const* magic) {
+        std::copy(magic, magic + 8, buffer);
+        encode32(buffer + 8, VERSION);
+        encode32(buffer + 12, 0);
+    }
+
+    bool isFileHeaderValid(uint8_t const* buffer, char const* magic) {
+        return std::equal(magic, magic + 8, buffer) &&
+               decode32(buffer + 8) == VERSION;
+    }
+
+    void writeAll(int fd, uint8_t const* buffer, size_t size) {
+        while (size) {
+            ssize_t written = ::write(fd, buffer, size);
+            if (written < 0 && errno != EINTR) {
+                throw iodrivers_base::UnixError("failed to write the frame log index");
+            }
+            else if (written > 0) {
+                buffer += written;
+                size -= written;
+            }
+        }
+    }
+}
+
+FrameLogWriter::FrameLogWriter(string const& path, WriterOptions const& options)
+    : m_options(options) {
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        throw iodrivers_base::UnixError("failed to create the frame log " + path);
+    }
+    string index_path = path + INDEX_SUFFIX;
+    m_index_fd = ::open(index_path.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (m_index_fd == -1) {
+        int error = errno;
+        ::close(m_fd);
+        throw iodrivers_base::UnixError(
+            "failed to create the frame log index " + index_path, error
+        );
+    }
+
+    try {
+        uint8_t index_header[FILE_HEADER_SIZE];
+        encodeFileHeader(index_header, INDEX_MAGIC);
+        writeAll(m_index_fd, index_header, FILE_HEADER_SIZE);
+
+        reserve(FILE_HEADER_SIZE);
+        encodeFileHeader(m_mapping, MAGIC);
+        m_size = FILE_HEADER_SIZE;
+    }
+    catch (...) {
+        if (m_mapping) {
+            munmap(m_mapping, m_capacity);
+        }
+        ::close(m_fd);
+        ::close(m_index_fd);
+        throw;
+    }
+}
+
+FrameLogWriter::~FrameLogWriter() {
+    try {
+        close();
+    }
+    catch (...) {
+    }
+}
+
+void FrameLogWriter::reserve(size_t size) {
+    if (m_size + size <= m_capacity) {
+        return;
+    }
+
+    size_t capacity = std::max(m_capacity + m_options.growth_size, m_size + size);
+    if (ftruncate(m_fd, capacity) == -1) {
+        throw iodrivers_base::UnixError("failed to extend the frame log");
+    }
+
+    void* mapping;
+    if (m_mapping) {
+        mapping = mremap(m_mapping, m_capacity, capacity, MREMAP_MAYMOVE);
+    }
+    else {
+        mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       m_fd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        throw iodrivers_base::UnixError("failed to map the frame log");
+    }
+    m_mapping = static_cast<uint8_t*>(mapping);
+    m_capacity = capacity;
+}
+
+void FrameLogWriter::append(base::Time const& time, uint8_t const* frame, size_t size) {
+    if (m_fd == -1) {
+        throw std::logic_error("append: the frame log is closed");
+    }
+    else if (size == 0 || size > UINT32_MAX) {
+        throw std::invalid_argument(
+            "append: frames must be between 1 byte and 4 GiB, got " +
+            to_string(size) + " bytes"
+        );
+    }
+
+    reserve(RECORD_HEADER_SIZE + size);
+    uint64_t microseconds = time.toMicroseconds();
+    if (m_frame_count == 0 || m_size - m_last_indexed >= m_options.index_interval) {
+        uint8_t entry[INDEX_ENTRY_SIZE];
+        encode64(entry, microseconds);
+        encode64(entry + 8, m_size);
+        writeAll(m_index_fd, entry, INDEX_ENTRY_SIZE);
+        m_last_indexed = m_size;
+    }
+
+    uint8_t* record = m_mapping + m_size;
+    encode64(record, microseconds);
+    encode32(record + 8, size);
+    std::memcpy(record + RECORD_HEADER_SIZE, frame, size);
+    m_size += RECORD_HEADER_SIZE + size;
+    m_frame_count++;
+}
+
+void FrameLogWriter::sync() {
+    if (m_fd == -1) {
+        return;
+    }
+    if (msync(m_mapping, m_size, MS_SYNC) == -1) {
+        throw iodrivers_base::UnixError("failed to sync the frame log");
+    }
+    if (fsync(m_index_fd) == -1) {
+        throw iodrivers_base::UnixError("failed to sync the frame log index");
+    }
+}
+
+void FrameLogWriter::close() {
+    if (m_fd == -1) {
+        return;
+    }
+
+    munmap(m_mapping, m_capacity);
+    m_mapping = nullptr;
+    int result = ftruncate(m_fd, m_size);
+    int error = errno;
+    ::close(m_fd);
+    ::close(m_index_fd);
+    m_fd = -1;
+    m_index_fd = -1;
+    if (result == -1) {
+        throw iodrivers_base::UnixError("failed to truncate the frame log", error);
+    }
+}
+
+uint64_t FrameLogWriter::getFrameCount() const {
+    return m_frame_count;
+}
+
+uint64_t FrameLogWriter::getSize() const {
+    return m_size;
+}
+
+FrameLogReader::FrameLogReader(string const& path) {
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd == -1) {
+        throw iodrivers_base::UnixError("failed to open the frame log " + path);
+    }
+
+    struct stat info;
+    if (fstat(m_fd, &info) == -1) {
+        int error = errno;
+        ::close(m_fd);
+        throw iodrivers_base::UnixError("failed to stat the frame log " + path, error);
+    }
+    m_size = info.st_size;
+    if (m_size < FILE_HEADER_SIZE) {
+        ::close(m_fd);
+        throw InvalidFrameLog(path + " is too small to be a frame log");
+    }
+
+    void* mapping = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (mapping == MAP_FAILED) {
+        int error = errno;
+        ::close(m_fd);
+        throw iodrivers_base::UnixError("failed to map the frame log " + path, error);
+    }
+    m_mapping = static_cast<uint8_t const*>(mapping);
+    madvise(mapping, m_size, MADV_SEQUENTIAL);
+
+    if (!isFileHeaderValid(m_mapping, MAGIC)) {
+        munmap(mapping, m_size);
+        ::close(m_fd);
+        throw InvalidFrameLog(path + " is not a frame log, or has an unsupported version");
+    }
+    loadIndex(path + INDEX_SUFFIX);
+}
+
+FrameLogReader::~FrameLogReader() {
+    munmap(const_cast<uint8_t*>(m_mapping), m_size);
+    ::close(m_fd);
+}
+
+void FrameLogReader::loadIndex(string const& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+
+    vector<uint8_t> data;
+    uint8_t buffer[4096];
+    while (true) {
+        ssize_t size = ::read(fd, buffer, sizeof(buffer));
+        if (size > 0) {
+            data.insert(data.end(), buffer, buffer + size);
+        }
+        else if (size == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    ::close(fd);
+
+    if (data.size() < FILE_HEADER_SIZE ||
+        !isFileHeaderValid(data.data(), INDEX_MAGIC)) {
+        return;
+    }
+    // Ignore a partially written last entry, and entries past the end of
+    // a log that was not properly closed. Stop at the first entry that
+    // cannot be right (before the first record, or not after the previous
+    // entry), the rest of the index is not trustworthy either
+    for (size_t offset = FILE_HEADER_SIZE; offset + INDEX_ENTRY_SIZE <= data.size();
+         offset += INDEX_ENTRY_SIZE) {
+        IndexEntry entry;
+        entry.time = base::Time::fromMicroseconds(decode64(&data[offset]));
+        entry.offset = decode64(&data[offset + 8]);
+        if (entry.offset < FILE_HEADER_SIZE ||
+            entry.offset > m_size - RECORD_HEADER_SIZE) {
+            break;
+        }
+        else if (!m_index.empty() && (entry.offset <= m_index.back().offset ||
+                                      entry.time <= m_index.back().time)) {
+            break;
+        }
+        m_index.push_back(entry);
+    }
+}
+
+bool FrameLogReader::next(Record& record) {
+    if (m_offset + RECORD_HEADER_SIZE > m_size) {
+        return false;
+    }
+
+    uint8_t const* header = m_mapping + m_offset;
+    size_t size = decode32(header + 8);
+    if (size == 0) {
+        return false;
+    }
+    else if (m_offset + RECORD_HEADER_SIZE + size > m_size) {
+        throw InvalidFrameLog(
+            "truncated record at offset " + to_string(m_offset) + " of the frame log"
+        );
+    }
+
+    record.time = base::Time::fromMicroseconds(decode64(header));
+    record.frame = header + RECORD_HEADER_SIZE;
+    record.size = size;
+    m_offset += RECORD_HEADER_SIZE + size;
+    return true;
+}
+
+void FrameLogReader::rewind() {
+    m_offset = FILE_HEADER_SIZE;
+}
+
+void FrameLogReader::seek(base::Time const& time) {
+    auto it = std::lower_bound(
+        m_index.begin(), m_index.end(), time,
+        [](IndexEntry const& entry, base::Time const& time) {
+            return entry.time < time;
+        }
+    );
+    m_offset = FILE_HEADER_SIZE;
+    if (it != m_index.begin()) {
+        m_offset = isIndexEntryValid(*(it - 1)) ? (it - 1)->offset
+                                                : FILE_HEADER_SIZE;
+    }
+
+    Record record;
+    uint64_t offset = m_offset;
+    while (next(record)) {
+        if (record.time >= time) {
+            break;
+        }
+        offset = m_offset;
+    }
+    m_offset = offset;
+}
+
+bool FrameLogReader::isIndexEntryValid(IndexEntry const& entry) {
+    m_offset = entry.offset;
+    Record record;
+    try {
+        return next(record) && record.time == entry.time;
+    }
+    catch (InvalidFrameLog const&) {
+        return false;
+    }
+}
+
+uint64_t FrameLogReader::getOffset() const {
+    return m_offset;
+}
+
+vector<IndexEntry> const& FrameLogReader::getIndex() const {
+    return m_index;
+}
@@ -0,0 +1,184 @@
+#ifndef COMMS_PROTOBUF_FRAME_LOG_HPP
+#define COMMS_PROTOBUF_FRAME_LOG_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <base/Time.hpp>
+
+namespace comms_protobuf {
+    /** Exception thrown when opening a file that is not a valid frame log */
+    struct InvalidFrameLog : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    /** Recording of framed streams
+     *
+     * A frame log starts with a 16-byte header (MAGIC, then the version as
+     * a 32-bit little-endian integer and 4 reserved bytes). It is followed
+     * by the records, each made of the reception time (64-bit microseconds
+     * since the epoch), the frame size (32 bits) and the frame itself, e.g.
+     * as generated by protocol::encodeFrame. All integers are little-endian.
+     * A record with a zero size marks the end of the log.
+     *
+     * The log comes with a sparse index, stored in a separate file with
+     * the INDEX_SUFFIX suffix. After a header with INDEX_MAGIC, it contains
+     * pairs of (time, offset) of some of the records, both 64 bits. The
+     * index is only an accelerator: a missing or truncated index makes
+     * FrameLogReader::seek slower, but not wrong.
+     */
+    namespace frame_log {
+        static const char MAGIC[8] = { 'C', 'P', 'B', 'F', 'L', 'O', 'G', 0 };
+        static const char INDEX_MAGIC[8] = { 'C', 'P', 'B', 'F', 'I', 'D', 'X', 0 };
+        static const char INDEX_SUFFIX[] = ".idx";
+        static const uint32_t VERSION = 1;
+
+        static const size_t FILE_HEADER_SIZE = 16;
+        static const size_t RECORD_HEADER_SIZE = 12;
+        static const size_t INDEX_ENTRY_SIZE = 16;
+
+        struct IndexEntry {
+            base::Time time;
+            uint64_t offset = 0;
+        };
+
+        struct WriterOptions {
+            /** Number of log bytes between two index entries */
+            size_t index_interval = 1024 * 1024;
+
+            /** Size by which the file is extended when the mapping is full */
+            size_t growth_size = 64 * 1024 * 1024;
+        };
+
+        /** A frame read from the log */
+        struct Record {
+            base::Time time;
+            /** Pointer to the frame, within the log's mapping */
+            uint8_t const* frame = nullptr;
+            size_t size = 0;
+        };
+    }
+
+    /** Appends frames to a frame log
+     *
+     * The log is memory-mapped, and grown by WriterOptions::growth_size
+     * bytes when full. The file is truncated to the actual size of the log
+     * on close(). If the process dies before, the reader stops at the
+     * zeroed area past the last record.
+     */
+    class FrameLogWriter {
+    public:
+        /** Create a new log, replacing any existing file at this path
+         *
+         * @throw iodrivers_base::UnixError
+         */
+        explicit FrameLogWriter(std::string const& path,
+                                frame_log::WriterOptions const& options =
+                                    frame_log::WriterOptions());
+        ~FrameLogWriter();
+        FrameLogWriter(FrameLogWriter const&) = delete;
+        FrameLogWriter& operator=(FrameLogWriter const&) = delete;
+
+        /** Append a frame
+         *
+         * The frame is not validated. It is meant to be a frame accepted by
+         * the extractPacket method of the channel that will replay it
+         *
+         * @arg time the reception time of the frame
+         * @throw std::invalid_argument if the frame is empty or bigger than
+         *   4 GiB
+         * @throw std::logic_error if the log has been closed
+         */
+        void append(base::Time const& time, uint8_t const* frame, size_t size);
+
+        /** Write the log and its index to disk */
+        void sync();
+
+        /** Truncate the file to the log's size and close it
+         *
+         * The writer cannot be used afterwards
+         */
+        void close();
+
+        /** Number of frames appended so far */
+        uint64_t getFrameCount() const;
+
+        /** Size of the log in bytes, including its header */
+        uint64_t getSize() const;
+
+    private:
+        frame_log::WriterOptions m_options;
+        int m_fd = -1;
+        int m_index_fd = -1;
+        uint8_t* m_mapping = nullptr;
+        size_t m_capacity = 0;
+        uint64_t m_size = 0;
+        uint64_t m_frame_count = 0;
+        /** Offset of the last record that has been indexed */
+        uint64_t m_last_indexed = 0;
+
+        void reserve(size_t size);
+    };
+
+    /** Zero-copy reading of a frame log
+     *
+     * The whole log is mapped read-only. The records returned by next()
+     * point directly within the mapping, and remain valid as long as the
+     * reader exists.
+     */
+    class FrameLogReader {
+    public:
+        /**
+         * @throw iodrivers_base::UnixError
+         * @throw InvalidFrameLog if the file is not a frame log
+         */
+        explicit FrameLogReader(std::string const& path);
+        ~FrameLogReader();
+        FrameLogReader(FrameLogReader const&) = delete;
+        FrameLogReader& operator=(FrameLogReader const&) = delete;
+
+        /** Read the next record
+         *
+         * @return false at the end of the log
+         * @throw InvalidFrameLog if the record is truncated
+         */
+        bool next(frame_log::Record& record);
+
+        /** Go back to the first record */
+        void rewind();
+
+        /** Position the reader on the first record whose time is greater
+         * than or equal to the given time
+         *
+         * The index is used to skip to the closest preceding record. If the
+         * index does not match the log there, the log is scanned from the
+         * start. The times of the records must be increasing
+         */
+        void seek(base::Time const& time);
+
+        /** Offset of the next record returned by next() */
+        uint64_t getOffset() const;
+
+        /** The entries of the sparse index */
+        std::vector<frame_log::IndexEntry> const& getIndex() const;
+
+    private:
+        int m_fd = -1;
+        uint8_t const* m_mapping = nullptr;
+        size_t m_size = 0;
+        uint64_t m_offset = frame_log::FILE_HEADER_SIZE;
+        std::vector<frame_log::IndexEntry> m_index;
+
+        void loadIndex(std::string const& path);
+
+        /** Whether a record with the entry's time starts at the entry's
+         * offset
+         *
+         * It moves the reader's offset
+         */
+        bool isIndexEntryValid(frame_log::IndexEntry const& entry);
+    };
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef COMMS_PROTOBUF_FRAME_LOG_REPLAYER_HPP
+#define COMMS_PROTOBUF_FRAME_LOG_REPLAYER_HPP
+
+#include <chrono>
+#include <thread>
+#include <comms_protobuf/Channel.hpp>
+#include <comms_protobuf/FrameLog.hpp>
+
+namespace comms_protobuf {
+    namespace frame_log {
+        enum ReplayMode {
+            /** Decode the frames without waiting */
+            AS_FAST_AS_POSSIBLE,
+            /** Reproduce the time between the frames, as recorded */
+            REAL_TIME
+        };
+
+        struct ReplayOptions {
+            ReplayMode mode = AS_FAST_AS_POSSIBLE;
+
+            /** Speed factor of the replay in REAL_TIME mode. 2 replays twice
+             * as fast as the frames were received
+             */
+            double speed = 1;
+        };
+    }
+
+    /**
+     * Feed the frames of a frame log to a channel
+     *
+     * The frames are decoded with Channel::decodeFrame, directly from the
+     * log's mapping. The channel must be configured as the one that
+     * received the frames (key, fragmentation, compression, delta
+     * encoding). It does not need to be opened.
+     *
+     * Replay starts at the reader's current position, see
+     * FrameLogReader::seek. If a frame cannot be decoded, the exception is
+     * thrown by replay() and the reader is left after the failing frame, so
+     * that calling replay() again resumes with the next one.
+     */
+    template<typename Local, typename Remote,
+             typename Framing = policies::VarintFraming,
+             typename Integrity = policies::CRC16Integrity,
+             typename Cipher = policies::RuntimeCipher>
+    class FrameLogReplayer {
+        typedef Channel<Local, Remote, Framing, Integrity, Cipher> ChannelType;
+
+    public:
+        /** The reader and channel must remain valid while this object is
+         * used
+         */
+        FrameLogReplayer(FrameLogReader& reader, ChannelType& channel,
+                         frame_log::ReplayOptions const& options =
+                             frame_log::ReplayOptions())
+            : m_reader(reader)
+            , m_channel(channel)
+            , m_options(options) {
+            if (options.speed <= 0) {
+                throw std::invalid_argument(
+                    "FrameLogReplayer: the speed must be strictly positive"
+                );
+            }
+        }
+
+        /** Replay the frames until the end of the log
+         *
+         * @arg callback called as callback(Remote const& message,
+         *   base::Time const& time) for each decoded message, with the
+         *   reception time of the frame that completed it
+         * @return the number of messages decoded
+         */
+        template<typename Callback>
+        size_t replay(Callback callback) {
+            typedef std::chrono::steady_clock clock;
+            clock::time_point start = clock::now();
+            base::Time first_time;
+
+            size_t count = 0;
+            frame_log::Record record;
+            for (bool first = true; m_reader.next(record); first = false) {
+                if (m_options.mode == frame_log::REAL_TIME) {
+                    if (first) {
+                        first_time = record.time;
+                    }
+                    auto delay = std::chrono::microseconds(static_cast<int64_t>(
+                        (record.time - first_time).toMicroseconds() / m_options.speed
+                    ));
+                    std::this_thread::sleep_until(start + delay);
+                }
+
+                if (m_channel.decodeFrame(m_message, record.frame, record.size,
+                                          record.time)) {
+                    ++count;
+                    callback(static_cast<Remote const&>(m_message), record.time);
+                }
+            }
+            return count;
+        }
+
+    private:
+        FrameLogReader& m_reader;
+        ChannelType& m_channel;
+        frame_log::ReplayOptions m_options;
+
+        /** Message reused for all the decoded frames */
+        Remote m_message;
+    };
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef COMMS_PROTOBUF_MULTIPLEXED_STREAM_HPP
+#define COMMS_PROTOBUF_MULTIPLEXED_STREAM_HPP
+
+#include <comms_protobuf/Channel.hpp>
+#include <comms_protobuf/Multiplexer.hpp>
+
+namespace comms_protobuf {
+    /** Protobuf messages sent and received on a stream of a Multiplexer
+     *
+     * The Local type is the type of the messages sent on the stream. The
+     * Remote type is the type expected from the remote side
+     */
+    template<typename Local, typename Remote>
+    class MultiplexedStream {
+    public:
+        /** Declare the stream on the multiplexer
+         *
+         * The multiplexer must stay valid while this object is used
+         */
+        MultiplexedStream(Multiplexer& multiplexer, uint8_t id,
+                          multiplexing::StreamOptions const& options)
+            : m_multiplexer(multiplexer)
+            , m_id(id) {
+            m_multiplexer.addStream(id, options);
+        }
+
+        uint8_t getID() const {
+            return m_id;
+        }
+
+        /** Queue a message
+         *
+         * Like Multiplexer::queue, it may be called from any thread
+         *
+         * @return false if the stream's queue is full
+         */
+        bool queue(Local const& message) {
+            std::vector<uint8_t> buffer(protocol::getSerializedSize(message));
+            message.SerializeWithCachedSizesToArray(buffer.data());
+            return m_multiplexer.queue(m_id, buffer.data(),
+                                       buffer.data() + buffer.size());
+        }
+
+        /** Unmarshal a message returned by Multiplexer::read for this
+         * stream
+         *
+         * @throw InvalidProtobufMessage
+         */
+        static void parse(Remote& message, std::vector<uint8_t> const& bytes) {
+            if (!message.ParseFromArray(bytes.data(), bytes.size())) {
+                throw InvalidProtobufMessage(
+                    "a valid packet was received, but it could not be "
+                    "successfully unmarshalled by the protocol buffer "
+                    "implementation"
+                );
+            }
+        }
+
+    private:
+        Multiplexer& m_multiplexer;
+        uint8_t m_id;
+    };
+}
+
+#endif
@@ -0,0 +1,257 @@
+#include <comms_protobuf/Multiplexer.hpp>
+
+#include <algorithm>
+#include <string>
+
+using namespace std;
+using namespace comms_protobuf;
+using namespace comms_protobuf::multiplexing;
+
+/** Number of maximum-size frames the driver's internal buffer can hold */
+static const size_t BUFFER_FRAME_COUNT = 10;
+
+static size_t getBufferSize(size_t max_frame_payload_size) {
+    return protocol::getFrameSize(max_frame_payload_size) * BUFFER_FRAME_COUNT;
+}
+
+Multiplexer::Multiplexer(size_t max_frame_payload_size)
+    : iodrivers_base::Driver(getBufferSize(max_frame_payload_size))
+    , m_max_frame_payload_size(max_frame_payload_size)
+    , m_write_buffer(protocol::getFrameSize(max_frame_payload_size))
+    , m_read_buffer(getBufferSize(max_frame_payload_size)) {
+    if (max_frame_payload_size <= STREAM_ID_SIZE + fragmentation::HEADER_SIZE) {
+        throw std::invalid_argument(
+            "Multiplexer: max_frame_payload_size is too small to hold a "
+            "fragment"
+        );
+    }
+}
+
+size_t Multiplexer::getChunkSize() const {
+    return m_max_frame_payload_size - STREAM_ID_SIZE - fragmentation::HEADER_SIZE;
+}
+
+void Multiplexer::addStream(uint8_t id, StreamOptions const& options) {
+    if (options.fragmentation) {
+        fragmentation::getFragmentCount(options.max_message_size, getChunkSize());
+    }
+    else if (STREAM_ID_SIZE + options.max_message_size > m_max_frame_payload_size) {
+        throw std::invalid_argument(
+            "addStream: messages of " + to_string(options.max_message_size) +
+            " bytes do not fit in a frame, enable fragmentation on stream " +
+            to_string(id)
+        );
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+    if (m_streams.count(id)) {
+        throw std::invalid_argument(
+            "addStream: stream " + to_string(id) + " already exists"
+        );
+    }
+
+    Stream& stream = m_streams[id];
+    stream.options = options;
+    if (options.fragmentation) {
+        size_t max_memory = options.max_reassembly_memory;
+        if (!max_memory) {
+            size_t count = fragmentation::getFragmentCount(
+                options.max_message_size, getChunkSize()
+            );
+            max_memory = options.max_message_size +
+                         fragmentation::Reassembler::getMessageOverhead(count);
+        }
+        stream.reassembler.reset(new fragmentation::Reassembler(
+            options.max_message_size, max_memory, options.reassembly_timeout
+        ));
+    }
+}
+
+bool Multiplexer::queue(uint8_t stream_id, uint8_t const* begin, uint8_t const* end) {
+    size_t size = end - begin;
+
+    lock_guard<mutex> lock(m_mutex);
+    auto it = m_streams.find(stream_id);
+    if (it == m_streams.end()) {
+        throw UnknownStream(
+            "queue: stream " + to_string(stream_id) + " does not exist"
+        );
+    }
+
+    Stream& stream = it->second;
+    if (size > stream.options.max_message_size) {
+        throw std::invalid_argument(
+            "queue: message of " + to_string(size) + " bytes is bigger than "
+            "the max message size of stream " + to_string(stream_id)
+        );
+    }
+    else if (stream.options.max_queue_size &&
+             stream.queue_size + size > stream.options.max_queue_size) {
+        return false;
+    }
+
+    Outgoing outgoing;
+    outgoing.data.assign(begin, end);
+    if (stream.options.fragmentation) {
+        outgoing.message_id = stream.next_message_id++;
+        outgoing.count = fragmentation::getFragmentCount(size, getChunkSize());
+    }
+    stream.queue.push_back(move(outgoing));
+    stream.queue_size += size;
+    return true;
+}
+
+map<uint8_t, Multiplexer::Stream>::iterator Multiplexer::pickStream() {
+    auto best = m_streams.end();
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        if (it->second.queue.empty()) {
+            continue;
+        }
+        else if (best == m_streams.end() ||
+                 it->second.options.priority > best->second.options.priority) {
+            best = it;
+        }
+        else if (it->second.options.priority == best->second.options.priority &&
+                 best->first <= m_last_stream && it->first > m_last_stream) {
+            // Round-robin: prefer the first stream after the last one
+            // written
+            best = it;
+        }
+    }
+    return best;
+}
+
+size_t Multiplexer::encodeNextFrame(uint8_t id, Stream& stream) {
+    Outgoing& outgoing = stream.queue.front();
+    uint8_t* buffer = m_write_buffer.data();
+    uint8_t* buffer_end = buffer + m_write_buffer.size();
+
+    size_t offset = 0;
+    size_t chunk_size = outgoing.data.size();
+    size_t header_size = STREAM_ID_SIZE;
+    if (stream.options.fragmentation) {
+        offset = outgoing.next_index * getChunkSize();
+        chunk_size = min(getChunkSize(), outgoing.data.size() - offset);
+        header_size += fragmentation::HEADER_SIZE;
+    }
+
+    uint8_t* payload = protocol::encodeFrameHeader(
+        buffer, buffer_end, header_size + chunk_size
+    );
+    payload[0] = id;
+    if (stream.options.fragmentation) {
+        fragmentation::Header header;
+        header.message_id = outgoing.message_id;
+        header.index = outgoing.next_index;
+        header.count = outgoing.count;
+        fragmentation::encodeHeader(payload + STREAM_ID_SIZE, header);
+    }
+    uint8_t const* chunk = outgoing.data.data() + offset;
+    std::copy(chunk, chunk + chunk_size, payload + header_size);
+    uint8_t* end = protocol::encodeFrameTrailer(
+        buffer, payload + header_size + chunk_size
+    );
+
+    stream.queue_size -= chunk_size;
+    if (++outgoing.next_index == outgoing.count) {
+        stream.queue.pop_front();
+    }
+    return end - buffer;
+}
+
+bool Multiplexer::writeNext() {
+    unique_lock<mutex> lock(m_mutex);
+    auto it = pickStream();
+    if (it == m_streams.end()) {
+        return false;
+    }
+
+    m_last_stream = it->first;
+    size_t size = encodeNextFrame(it->first, it->second);
+    lock.unlock();
+
+    writePacket(m_write_buffer.data(), size);
+    return true;
+}
+
+void Multiplexer::flush() {
+    while (writeNext()) {
+    }
+}
+
+size_t Multiplexer::getQueueSize(uint8_t stream_id) const {
+    lock_guard<mutex> lock(m_mutex);
+    auto it = m_streams.find(stream_id);
+    if (it == m_streams.end()) {
+        throw UnknownStream(
+            "getQueueSize: stream " + to_string(stream_id) + " does not exist"
+        );
+    }
+    return it->second.queue_size;
+}
+
+bool Multiplexer::hasQueuedMessages() const {
+    lock_guard<mutex> lock(m_mutex);
+    for (auto const& stream : m_streams) {
+        if (!stream.second.queue.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int Multiplexer::extractPacket(uint8_t const* buffer, size_t size) const {
+    return protocol::extractPacket(buffer, size, m_max_frame_payload_size);
+}
+
+uint8_t Multiplexer::read(vector<uint8_t>& message) {
+    return read(message, getReadTimeout(), getReadTimeout());
+}
+
+uint8_t Multiplexer::read(vector<uint8_t>& message, base::Time const& timeout) {
+    return read(message, timeout, timeout);
+}
+
+uint8_t Multiplexer::read(vector<uint8_t>& message, base::Time const& timeout,
+                          base::Time const& first_byte_timeout) {
+    base::Time deadline = base::Time::now() + timeout;
+    base::Time packet_timeout = timeout;
+    base::Time packet_first_byte_timeout = first_byte_timeout;
+    while (true) {
+        uint8_t* buffer = m_read_buffer.data();
+        size_t size = readPacket(buffer, m_read_buffer.size(),
+                                 packet_timeout, packet_first_byte_timeout);
+        auto payload = protocol::getPayload(buffer, buffer + size);
+        if (payload.first == payload.second) {
+            throw UnknownStream("read: received a frame without a stream ID");
+        }
+
+        uint8_t id = payload.first[0];
+        auto it = m_streams.find(id);
+        if (it == m_streams.end()) {
+            throw UnknownStream(
+                "read: received a frame for stream " + to_string(id) +
+                ", which does not exist"
+            );
+        }
+
+        Stream& stream = it->second;
+        uint8_t const* data = payload.first + STREAM_ID_SIZE;
+        if (!stream.reassembler) {
+            message.assign(data, payload.second);
+            return id;
+        }
+
+        auto header = fragmentation::parseHeader(data, payload.second);
+        uint8_t const* chunk = data + fragmentation::HEADER_SIZE;
+        base::Time now = base::Time::now();
+        if (stream.reassembler->push(header, chunk, payload.second, now)) {
+            message = stream.reassembler->getMessage();
+            return id;
+        }
+
+        // Wait for the next fragments within what remains of the timeout
+        packet_timeout = std::max(base::Time(), deadline - now);
+        packet_first_byte_timeout = packet_timeout;
+    }
+}
@@ -0,0 +1,209 @@
+#ifndef COMMS_PROTOBUF_MULTIPLEXER_HPP
+#define COMMS_PROTOBUF_MULTIPLEXER_HPP
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <iodrivers_base/Driver.hpp>
+#include <comms_protobuf/Fragmentation.hpp>
+#include <comms_protobuf/Protocol.hpp>
+
+namespace comms_protobuf {
+    /** Exception thrown when receiving a frame for a stream that has not
+     * been declared with Multiplexer::addStream
+     */
+    struct UnknownStream : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    /** Several logical streams of messages over a single link
+     *
+     * The payload of each frame starts with the stream ID (one byte). On
+     * streams with fragmentation enabled, it is followed by a fragment
+     * header (see fragmentation) and a chunk of the message. Otherwise, it
+     * is followed by the whole message.
+     */
+    namespace multiplexing {
+        /** Size of the stream ID at the start of each frame payload */
+        static const size_t STREAM_ID_SIZE = 1;
+
+        struct StreamOptions {
+            /** Priority of the stream. Streams with a higher priority are
+             * sent first
+             */
+            int priority = 0;
+
+            /** Maximum size of a message on this stream */
+            size_t max_message_size = 0;
+
+            /** Whether messages bigger than a frame are split in several
+             * frames
+             *
+             * Fragmentation adds fragmentation::HEADER_SIZE bytes to each
+             * frame. Without it, messages must fit in a single frame.
+             */
+            bool fragmentation = false;
+
+            /** Maximum number of message bytes queued on this stream. Zero
+             * for no limit
+             */
+            size_t max_queue_size = 0;
+
+            /** Maximum number of bytes held by partially received messages,
+             * including their bookkeeping, if fragmentation is enabled. Zero
+             * for enough memory to reassemble one message of
+             * max_message_size bytes
+             */
+            size_t max_reassembly_memory = 0;
+
+            /** Time after which a partially received message is dropped, if
+             * fragmentation is enabled
+             */
+            base::Time reassembly_timeout = base::Time::fromSeconds(10);
+        };
+    }
+
+    /**
+     * Multiplexing of several logical streams over one link, with a
+     * priority scheduler
+     *
+     * Messages are queued per stream with queue() and sent frame by frame
+     * by writeNext() or flush(). Before each frame, the scheduler picks the
+     * stream with the highest priority that has data queued, and
+     * round-robins between streams of equal priority. Since big messages on
+     * fragmented streams are sent one fragment per frame, a message queued
+     * on a higher priority stream waits for at most one frame of lower
+     * priority traffic, whose size is bounded by max_frame_payload_size.
+     *
+     * queue() may be called from any thread. writeNext(), flush() and
+     * read() must each be called by a single thread at a time. Typically, a
+     * sender thread loops on flush() while other threads queue messages.
+     *
+     * Both sides must declare the same streams with the same fragmentation
+     * setting. See MultiplexedStream to send protobuf messages on a stream.
+     *
+     * Frames are neither encrypted nor authenticated, and there is no
+     * replay protection. Only use the multiplexer on trusted links, or
+     * below a transport that provides these guarantees.
+     */
+    class Multiplexer : public iodrivers_base::Driver {
+    public:
+        /**
+         * @arg max_frame_payload_size maximum size of the payload of a
+         *   frame, including the stream ID and fragment header. It bounds
+         *   the latency added to high priority streams by the lower
+         *   priority ones
+         * @throw std::invalid_argument if it cannot hold a fragment
+         */
+        explicit Multiplexer(size_t max_frame_payload_size);
+
+        /** Declare a stream
+         *
+         * All streams must be declared before the multiplexer is used
+         *
+         * @throw std::invalid_argument if the stream already exists, or if
+         *   messages of max_message_size cannot be sent on it
+         */
+        void addStream(uint8_t id, multiplexing::StreamOptions const& options);
+
+        /** Queue a message on a stream
+         *
+         * @return false if the message would exceed the stream's
+         *   max_queue_size. The message is not queued
+         * @throw UnknownStream if the stream has not been declared
+         * @throw std::invalid_argument if the message is bigger than the
+         *   stream's max_message_size
+         */
+        bool queue(uint8_t stream_id, uint8_t const* begin, uint8_t const* end);
+
+        /** Write the next frame chosen by the scheduler
+         *
+         * @return false if there was nothing to write
+         */
+        bool writeNext();
+
+        /** Write frames until all queues are empty
+         *
+         * Messages queued by other threads while flushing are written as
+         * well, in priority order
+         */
+        void flush();
+
+        /** Number of message bytes queued on a stream, including the
+         * unsent part of the message being sent
+         */
+        size_t getQueueSize(uint8_t stream_id) const;
+
+        /** Whether some messages are waiting to be written */
+        bool hasQueuedMessages() const;
+
+        /** Read the next complete message
+         *
+         * @return the ID of the stream the message was received on
+         * @throw UnknownStream
+         * @throw InvalidFragment
+         */
+        uint8_t read(std::vector<uint8_t>& message);
+        uint8_t read(std::vector<uint8_t>& message, base::Time const& timeout);
+        uint8_t read(std::vector<uint8_t>& message, base::Time const& timeout,
+                     base::Time const& first_byte_timeout);
+
+    private:
+        struct Outgoing {
+            std::vector<uint8_t> data;
+            uint32_t message_id = 0;
+            uint16_t next_index = 0;
+            uint16_t count = 1;
+        };
+
+        struct Stream {
+            multiplexing::StreamOptions options;
+            std::deque<Outgoing> queue;
+            size_t queue_size = 0;
+            uint32_t next_message_id = 0;
+            std::unique_ptr<fragmentation::Reassembler> reassembler;
+        };
+
+        const size_t m_max_frame_payload_size;
+
+        /** Protects the stream queues */
+        mutable std::mutex m_mutex;
+        std::map<uint8_t, Stream> m_streams;
+
+        /** Stream of the last frame written, for the round-robin between
+         * streams of equal priority
+         */
+        int m_last_stream = -1;
+
+        std::vector<uint8_t> m_write_buffer;
+        std::vector<uint8_t> m_read_buffer;
+
+        int extractPacket(uint8_t const* buffer, size_t size) const;
+
+        /** Maximum number of message bytes in a frame of a fragmented
+         * stream
+         */
+        size_t getChunkSize() const;
+
+        /** Pick the stream whose frame should be written next
+         *
+         * Must be called with m_mutex locked
+         */
+        std::map<uint8_t, Stream>::iterator pickStream();
+
+        /** Encode the next frame of a stream in m_write_buffer, and remove
+         * the message from its queue if it is the last frame
+         *
+         * Must be called with m_mutex locked
+         *
+         * @return the frame size
+         */
+        size_t encodeNextFrame(uint8_t id, Stream& stream);
+    };
+}
+
+#endif
@@ -0,0 +1,314 @@
+#ifndef COMMS_PROTOBUF_PIPELINED_READER_HPP
+#define COMMS_PROTOBUF_PIPELINED_READER_HPP
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <comms_protobuf/Channel.hpp>
+#include <iodrivers_base/Exceptions.hpp>
+
+namespace comms_protobuf {
+    /**
+     * Receive the messages of a channel using several threads
+     *
+     * An I/O thread extracts the frames from the channel, a pool of workers
+     * decrypts and unmarshals them in parallel, and read() returns the
+     * resulting messages in the order in which the frames were received.
+     * This allows to use more than one core to process a single high
+     * bandwidth link.
+     *
+     * The channel must be fully configured (in particular, encryption must
+     * be enabled) before the reader is created, and must not use
+     * fragmentation, compression or delta encoding. It must not be read
+     * from until the reader is destroyed. Writing to the channel from
+     * another thread is fine.
+     *
+     * Errors are reported by read() in order as well: a frame that cannot be
+     * decrypted or unmarshalled makes the matching read() call throw, and the
+     * following calls return the next messages. An I/O error stops the I/O
+     * thread and is thrown by read() once the messages received before it
+     * have been read.
+     */
+    template<typename Local, typename Remote,
+             typename Framing = policies::VarintFraming,
+             typename Integrity = policies::CRC16Integrity,
+             typename Cipher = policies::RuntimeCipher>
+    class PipelinedReader {
+        typedef Channel<Local, Remote, Framing, Integrity, Cipher> ChannelType;
+
+        /** A frame going through the pipeline */
+        struct Slot {
+            enum State {
+                /** Waiting for a frame from the I/O thread */
+                FREE,
+                /** Frame received, waiting for a worker */
+                FRAMED,
+                /** Message or error ready to be returned by read() */
+                DECODED
+            };
+
+            State state = FREE;
+            std::vector<uint8_t> frame;
+            Remote message;
+            protocol::aes_iv iv;
+            std::exception_ptr error;
+        };
+
+        ChannelType& m_channel;
+        bool m_encrypted;
+
+        /** Ring of frames being processed
+         *
+         * Slot N % m_slots.size() holds the N-th frame received. It is
+         * owned by the I/O thread while FREE and by the worker that claimed
+         * it while FRAMED. The mutex only protects the state and the
+         * counters below, the frames are processed without holding it.
+         */
+        std::vector<Slot> m_slots;
+
+        /** Buffer used by the I/O thread to read frames from the channel */
+        std::vector<uint8_t> m_io_buffer;
+
+        std::mutex m_mutex;
+        std::condition_variable m_slot_freed;
+        std::condition_variable m_frame_received;
+        std::condition_variable m_message_decoded;
+        bool m_quit = false;
+
+        /** Number of frames received by the I/O thread */
+        uint64_t m_received = 0;
+        /** Number of frames claimed by the workers */
+        uint64_t m_claimed = 0;
+        /** Number of frames returned by read() */
+        uint64_t m_read = 0;
+
+        /** IVs of the messages returned by read() so far
+         *
+         * It starts as a copy of the channel's, so that it rejects the
+         * channel's own messages and the retired sessions. It is only
+         * accessed by read(), which sees the messages in order
+         */
+        protocol::ReplayWindow m_replay_window;
+
+        /** Timeout of the I/O thread's readPacket calls
+         *
+         * It bounds the time it takes to stop the thread
+         */
+        base::Time m_io_poll_period;
+
+        std::vector<std::thread> m_threads;
+
+    public:
+        /**
+         * @arg channel the channel to read from
+         * @arg worker_count number of threads decrypting and unmarshalling
+         *   the frames
+         * @arg queue_size maximum number of frames being processed or
+         *   waiting to be read. The I/O thread stops reading from the channel
+         *   when it is reached
+         */
+        PipelinedReader(ChannelType& channel, size_t worker_count,
+                        size_t queue_size = 64)
+            : m_channel(channel)
+            , m_encrypted(channel.isEncrypted())
+            , m_slots(std::max<size_t>(1, queue_size))
+            , m_io_buffer(channel.getMaxPacketSize())
+            , m_replay_window(channel.getReplayWindow())
+            , m_io_poll_period(base::Time::fromMilliseconds(100)) {
+            if (channel.isFragmentationEnabled() || channel.isCompressionEnabled() ||
+                channel.isDeltaEncodingEnabled()) {
+                throw std::invalid_argument(
+                    "PipelinedReader does not support fragmented, compressed "
+                    "or delta-encoded channels"
+                );
+            }
+
+            // Create the cipher contexts here, so that any error is reported
+            // by the constructor
+            std::vector<std::unique_ptr<protocol::CipherContext>> ciphers;
+            for (size_t i = 0; i < std::max<size_t>(1, worker_count); ++i) {
+                ciphers.push_back(channel.createCipherContext());
+            }
+
+            m_threads.push_back(std::thread(&PipelinedReader::ioThread, this));
+            for (auto& cipher : ciphers) {
+                m_threads.push_back(std::thread(
+                    &PipelinedReader::workerThread, this, cipher.release()
+                ));
+            }
+        }
+
+        ~PipelinedReader() {
+            stop();
+        }
+
+        /** Stop all threads
+         *
+         * read() cannot be used afterwards
+         */
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_quit = true;
+            }
+            m_slot_freed.notify_all();
+            m_frame_received.notify_all();
+            m_message_decoded.notify_all();
+
+            for (auto& thread : m_threads) {
+                thread.join();
+            }
+            m_threads.clear();
+        }
+
+        Remote read(base::Time const& timeout) {
+            Remote result;
+            read(result, timeout);
+            return result;
+        }
+
+        /** Get the next message
+         *
+         * @throw iodrivers_base::TimeoutError if no message is available
+         *   within the given timeout
+         */
+        void read(Remote& message, base::Time const& timeout) {
+            auto deadline = std::chrono::steady_clock::now() +
+                            std::chrono::microseconds(timeout.toMicroseconds());
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            Slot& slot = m_slots[m_read % m_slots.size()];
+            bool ready = m_message_decoded.wait_until(lock, deadline, [&] {
+                return m_quit || (m_read < m_received &&
+                                  slot.state == Slot::DECODED);
+            });
+            if (m_quit) {
+                throw std::logic_error("PipelinedReader: reader is stopped");
+            }
+            else if (!ready) {
+                throw iodrivers_base::TimeoutError(
+                    iodrivers_base::TimeoutError::PACKET,
+                    "PipelinedReader: no message received within the timeout"
+                );
+            }
+
+            std::exception_ptr error = slot.error;
+            protocol::aes_iv iv = slot.iv;
+            if (!error) {
+                message.Swap(&slot.message);
+            }
+            slot.error = std::exception_ptr();
+            slot.state = Slot::FREE;
+            ++m_read;
+            lock.unlock();
+            m_slot_freed.notify_one();
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            if (m_encrypted) {
+                if (!m_replay_window.isAcceptable(iv)) {
+                    throw ReplayedMessage(
+                        "received an encrypted message whose IV has already "
+                        "been used"
+                    );
+                }
+                m_replay_window.update(iv);
+            }
+        }
+
+    private:
+        void ioThread() {
+            while (true) {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_slot_freed.wait(lock, [this] {
+                    return m_quit || m_received - m_read < m_slots.size();
+                });
+                if (m_quit) {
+                    return;
+                }
+                Slot& slot = m_slots[m_received % m_slots.size()];
+                lock.unlock();
+
+                try {
+                    size_t size = m_channel.readPacket(
+                        m_io_buffer.data(), m_io_buffer.size(),
+                        m_io_poll_period, m_io_poll_period
+                    );
+                    slot.frame.assign(m_io_buffer.data(), m_io_buffer.data() + size);
+                }
+                catch (iodrivers_base::TimeoutError const&) {
+                    continue;
+                }
+                catch (...) {
+                    slot.error = std::current_exception();
+                }
+
+                // The slot may be reused as soon as it is published, so
+                // do not access it afterwards
+                bool failed = static_cast<bool>(slot.error);
+                lock.lock();
+                slot.state = failed ? Slot::DECODED : Slot::FRAMED;
+                ++m_received;
+                lock.unlock();
+                if (failed) {
+                    m_message_decoded.notify_all();
+                    return;
+                }
+                m_frame_received.notify_one();
+            }
+        }
+
+        void workerThread(protocol::CipherContext* cipher_) {
+            std::unique_ptr<protocol::CipherContext> cipher(cipher_);
+            while (true) {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_frame_received.wait(lock, [this] {
+                    return m_quit || (m_claimed < m_received &&
+                                      m_slots[m_claimed % m_slots.size()].state ==
+                                      Slot::FRAMED);
+                });
+                if (m_quit) {
+                    return;
+                }
+                Slot& slot = m_slots[m_claimed % m_slots.size()];
+                ++m_claimed;
+                lock.unlock();
+
+                try {
+                    decode(slot, cipher.get());
+                }
+                catch (...) {
+                    slot.error = std::current_exception();
+                }
+
+                lock.lock();
+                slot.state = Slot::DECODED;
+                lock.unlock();
+                m_message_decoded.notify_all();
+            }
+        }
+
+        void decode(Slot& slot, protocol::CipherContext* cipher) {
+            uint8_t* frame = slot.frame.data();
+            auto payload_range = ChannelType::FrameCodec::getPayload(
+                frame, frame + slot.frame.size()
+            );
+            uint8_t const* begin = payload_range.first;
+            uint8_t const* end = payload_range.second;
+
+            if (cipher) {
+                slot.iv = protocol::getPayloadIV(begin, end);
+                auto plaintext = protocol::decryptPayload(
+                    *cipher, frame + (begin - frame), frame + (end - frame)
+                );
+                begin = plaintext.first;
+                end = plaintext.second;
+            }
+            ChannelType::parsePayload(slot.message, begin, end);
+        }
+    };
+}
+
+#endif
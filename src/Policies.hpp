@@ -0,0 +1,302 @@
+#ifndef COMMS_PROTOBUF_POLICIES_HPP
+#define COMMS_PROTOBUF_POLICIES_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <comms_protobuf/Protocol.hpp>
+
+namespace comms_protobuf {
+    /** Compile-time policies that specialize the frame format of a Channel
+     *
+     * Channel<Local, Remote> uses VarintFraming, CRC16Integrity and
+     * RuntimeCipher, which is the format implemented in protocol. Other
+     * combinations remove the corresponding branches and indirections from
+     * the channel's hot path, at the price of a frame format that both
+     * sides must agree on.
+     */
+    namespace policies {
+        /** Frames start with SYNC_0 SYNC_1 followed by the payload length
+         * encoded as a varint
+         *
+         * This is the format of protocol::encodeFrame
+         */
+        struct VarintFraming {
+            static const size_t MAX_PAYLOAD_SIZE = SIZE_MAX;
+
+            static size_t getHeaderSize(size_t payload_length) {
+                return 2 + std::max<size_t>(
+                    1, protocol::getLengthEncodedSize(payload_length)
+                );
+            }
+
+            /** Encode the frame header
+             *
+             * @return the pointer on the start of the payload
+             */
+            static uint8_t* encodeHeader(uint8_t* buffer, uint8_t* buffer_end,
+                                         size_t payload_length) {
+                buffer[0] = protocol::SYNC_0;
+                buffer[1] = protocol::SYNC_1;
+                return protocol::encodeLength(buffer + 2, buffer_end, payload_length);
+            }
+
+            /** Parse the header of a frame that starts with SYNC_0 SYNC_1
+             *
+             * @return the header size, zero if more bytes are needed, or -1
+             *   if the header is invalid or announces a payload bigger than
+             *   max_payload_size
+             */
+            static int parseHeader(uint8_t const* buffer, size_t size,
+                                   size_t max_payload_size, size_t& payload_length) {
+                auto parsed_length = protocol::parseLength(buffer + 2, buffer + size);
+                if (!parsed_length.second) {
+                    // Wait for more bytes only if the length field could
+                    // still encode a valid length
+                    size_t max_length_field_size = std::max<size_t>(
+                        1, protocol::getLengthEncodedSize(max_payload_size)
+                    );
+                    return size - 2 < max_length_field_size ? 0 : -1;
+                }
+                else if (parsed_length.first > max_payload_size) {
+                    return -1;
+                }
+                payload_length = parsed_length.first;
+                return parsed_length.second - buffer;
+            }
+        };
+
+        /** Frames start with SYNC_0 SYNC_1 followed by the payload length on
+         * Width bytes, little-endian
+         *
+         * With a width of 1, this is compatible with VarintFraming for
+         * payloads smaller than 128 bytes
+         */
+        template<int Width>
+        struct FixedWidthFraming {
+            static_assert(Width >= 1 && Width <= 4,
+                          "FixedWidthFraming supports widths from 1 to 4 bytes");
+
+            static const size_t MAX_PAYLOAD_SIZE =
+                (static_cast<uint64_t>(1) << (8 * Width)) - 1;
+
+            static size_t getHeaderSize(size_t) {
+                return 2 + Width;
+            }
+
+            static uint8_t* encodeHeader(uint8_t* buffer, uint8_t*,
+                                         size_t payload_length) {
+                if (payload_length > MAX_PAYLOAD_SIZE) {
+                    throw std::invalid_argument(
+                        "payload of " + std::to_string(payload_length) +
+                        " bytes does not fit in a " + std::to_string(Width) +
+                        " bytes length field"
+                    );
+                }
+                buffer[0] = protocol::SYNC_0;
+                buffer[1] = protocol::SYNC_1;
+                for (int i = 0; i < Width; ++i) {
+                    buffer[2 + i] = (payload_length >> (8 * i)) & 0xFF;
+                }
+                return buffer + 2 + Width;
+            }
+
+            static int parseHeader(uint8_t const* buffer, size_t size,
+                                   size_t max_payload_size, size_t& payload_length) {
+                if (size < 2 + Width) {
+                    return 0;
+                }
+
+                size_t length = 0;
+                for (int i = 0; i < Width; ++i) {
+                    length |= static_cast<size_t>(buffer[2 + i]) << (8 * i);
+                }
+                if (length > max_payload_size) {
+                    return -1;
+                }
+                payload_length = length;
+                return 2 + Width;
+            }
+        };
+
+        /** Frames end with a CRC16 of their length field and payload */
+        struct CRC16Integrity {
+            static const size_t SIZE = 2;
+
+            static void write(uint8_t const* begin, uint8_t* end) {
+                uint16_t crc = protocol::crc(begin, end);
+                end[0] = crc & 0xFF;
+                end[1] = (crc >> 8) & 0xFF;
+            }
+
+            static bool check(uint8_t const* begin, uint8_t const* end) {
+                uint16_t expected = end[0] | static_cast<uint16_t>(end[1]) << 8;
+                return protocol::crc(begin, end) == expected;
+            }
+        };
+
+        /** No integrity check, for transports that cannot corrupt data */
+        struct NoIntegrity {
+            static const size_t SIZE = 0;
+
+            static void write(uint8_t const*, uint8_t*) {
+            }
+
+            static bool check(uint8_t const*, uint8_t const*) {
+                return true;
+            }
+        };
+
+        /** Encryption can be enabled at runtime with setEncryptionKey */
+        struct RuntimeCipher {
+            static const bool ENABLED = true;
+        };
+
+        /** The channel never encrypts its frames */
+        struct NoCipher {
+            static const bool ENABLED = false;
+        };
+
+        /** Generation and extraction of frames for a framing and an
+         * integrity policy
+         *
+         * All frames start with SYNC_0 SYNC_1. The integrity check covers
+         * the rest of the header and the payload. See protocol for the
+         * meaning of the arguments and return values
+         */
+        template<typename Framing, typename Integrity>
+        struct FrameCodec {
+            static size_t getFrameSize(size_t payload_length) {
+                return Framing::getHeaderSize(payload_length) + payload_length +
+                       Integrity::SIZE;
+            }
+
+            /** Size of the biggest frame for the given max payload size */
+            static size_t getMaxFrameSize(size_t max_payload_size) {
+                return getFrameSize(max_payload_size);
+            }
+
+            static uint8_t* encodeFrameHeader(uint8_t* buffer, uint8_t* buffer_end,
+                                              size_t payload_length) {
+                size_t frame_size = getFrameSize(payload_length);
+                if (static_cast<size_t>(buffer_end - buffer) < frame_size) {
+                    throw std::invalid_argument(
+                        "encodeFrameHeader: provided buffer is too small, it "
+                        "needs to be " + std::to_string(frame_size) + " bytes"
+                    );
+                }
+                return Framing::encodeHeader(buffer, buffer_end, payload_length);
+            }
+
+            static uint8_t* encodeFrameTrailer(uint8_t* buffer, uint8_t* payload_end) {
+                Integrity::write(buffer + 2, payload_end);
+                return payload_end + Integrity::SIZE;
+            }
+
+            static int extractPacket(uint8_t const* buffer, size_t size,
+                                     size_t max_payload_size,
+                                     bool check_integrity = true,
+                                     protocol::RejectionReason* reason = nullptr) {
+                if (reason) {
+                    *reason = protocol::NOT_REJECTED;
+                }
+
+                size_t start = protocol::findSync(buffer, buffer + size) - buffer;
+                if (start != 0) {
+                    if (reason) {
+                        *reason = protocol::REJECTED_GARBAGE;
+                    }
+                    return -start;
+                }
+                else if (size < 3) {
+                    return 0;
+                }
+
+                size_t payload_length = 0;
+                int header_size = Framing::parseHeader(
+                    buffer, size, max_payload_size, payload_length
+                );
+                if (header_size == 0) {
+                    return 0;
+                }
+                else if (header_size < 0) {
+                    return reject(buffer, size, protocol::REJECTED_LENGTH, reason);
+                }
+
+                size_t frame_size = header_size + payload_length + Integrity::SIZE;
+                if (size < frame_size) {
+                    return 0;
+                }
+                uint8_t const* payload_end = buffer + header_size + payload_length;
+                if (check_integrity && !Integrity::check(buffer + 2, payload_end)) {
+                    return reject(buffer, size, protocol::REJECTED_CRC, reason);
+                }
+                return frame_size;
+            }
+
+            static std::pair<uint8_t const*, uint8_t const*> getPayload(
+                uint8_t const* buffer, uint8_t const* buffer_end
+            ) {
+                size_t payload_length = 0;
+                int header_size = Framing::parseHeader(
+                    buffer, buffer_end - buffer, SIZE_MAX, payload_length
+                );
+                return std::make_pair(buffer + header_size,
+                                      buffer + header_size + payload_length);
+            }
+
+        private:
+            static int reject(uint8_t const* buffer, size_t size,
+                              protocol::RejectionReason reason,
+                              protocol::RejectionReason* reason_out) {
+                if (reason_out) {
+                    *reason_out = reason;
+                }
+                return -(protocol::findSync(buffer + 1, buffer + size) - buffer);
+            }
+        };
+
+        /** The protocol frame format, implemented by the functions in
+         * protocol
+         */
+        template<>
+        struct FrameCodec<VarintFraming, CRC16Integrity> {
+            static size_t getFrameSize(size_t payload_length) {
+                return protocol::getFrameSize(payload_length);
+            }
+
+            static size_t getMaxFrameSize(size_t max_payload_size) {
+                return protocol::PACKET_MIN_OVERHEAD +
+                       protocol::getLengthEncodedSize(max_payload_size) +
+                       max_payload_size;
+            }
+
+            static uint8_t* encodeFrameHeader(uint8_t* buffer, uint8_t* buffer_end,
+                                              size_t payload_length) {
+                return protocol::encodeFrameHeader(buffer, buffer_end, payload_length);
+            }
+
+            static uint8_t* encodeFrameTrailer(uint8_t* buffer, uint8_t* payload_end) {
+                return protocol::encodeFrameTrailer(buffer, payload_end);
+            }
+
+            static int extractPacket(uint8_t const* buffer, size_t size,
+                                     size_t max_payload_size,
+                                     bool check_integrity = true,
+                                     protocol::RejectionReason* reason = nullptr) {
+                return protocol::extractPacket(buffer, size, max_payload_size,
+                                               check_integrity, reason);
+            }
+
+            static std::pair<uint8_t const*, uint8_t const*> getPayload(
+                uint8_t const* buffer, uint8_t const* buffer_end
+            ) {
+                return protocol::getPayload(buffer, buffer_end);
+            }
+        };
+    }
+}
+
+#endif
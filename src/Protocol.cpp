@@ -1,25 +1,72 @@
 #include <comms_protobuf/Protocol.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
 #include <openssl/rand.h>
 #include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
 
 using namespace std;
 using namespace comms_protobuf;
 
 static_assert(protocol::CipherContext::MAX_BLOCK_LENGTH == EVP_MAX_BLOCK_LENGTH,
               "max block length differ between EVP (OpenSSL) and our internal value");
+static_assert(std::tuple_size<protocol::aes_key>::value ==
+              protocol::CipherContext::KEY_SIZE,
+              "aes_key and CipherContext::KEY_SIZE differ");
+static_assert(std::tuple_size<protocol::session_id>::value ==
+              protocol::CipherContext::SESSION_ID_SIZE,
+              "session_id and CipherContext::SESSION_ID_SIZE differ");
+
+/** Size of the AEAD nonce. It is made of the last bytes of the IV */
+static const size_t NONCE_SIZE = 12;
+static const size_t NONCE_OFFSET = sizeof(protocol::aes_iv) - NONCE_SIZE;
+
+uint8_t const* protocol::findSync(uint8_t const* begin, uint8_t const* end) {
+    while (begin != end) {
+        auto sync0 = static_cast<uint8_t const*>(
+            std::memchr(begin, SYNC_0, end - begin)
+        );
+        if (!sync0) {
+            return end;
+        }
+        else if (sync0 + 1 == end || sync0[1] == SYNC_1) {
+            return sync0;
+        }
+        begin = sync0 + 1;
+    }
+    return end;
+}
+
+/** Return value of extractPacket when the frame at the start of the buffer
+ * is invalid. It skips to the next possible frame start
+ */
+static int rejectFrame(uint8_t const* buffer, size_t size,
+                       protocol::RejectionReason reason,
+                       protocol::RejectionReason* reason_out) {
+    if (reason_out) {
+        *reason_out = reason;
+    }
+    return -(protocol::findSync(buffer + 1, buffer + size) - buffer);
+}
 
 int protocol::extractPacket(uint8_t const* buffer, size_t size,
-                            size_t max_payload_size) {
-    size_t start = 0;
-    for (start = 0; start < size; ++start) {
-        if (buffer[start] == SYNC_0) {
-            break;
-        }
+                            size_t max_payload_size, bool check_crc,
+                            RejectionReason* reason) {
+    if (reason) {
+        *reason = NOT_REJECTED;
     }
 
+    size_t start = findSync(buffer, buffer + size) - buffer;
     if (start != 0) {
+        if (reason) {
+            *reason = REJECTED_GARBAGE;
+        }
         return -start;
     }
     else if (size < PACKET_MIN_SIZE) {
@@ -30,10 +77,18 @@ int protocol::extractPacket(uint8_t const* buffer, size_t size,
     auto payload_length = parsed_length.first;
     auto length_field_end = parsed_length.second;
     if (!length_field_end) {
-        return -1;
+        // The length field is not terminated within the buffer. Wait for more
+        // bytes only if it could still encode a valid length
+        size_t max_length_field_size = std::max<size_t>(
+            1, getLengthEncodedSize(max_payload_size)
+        );
+        if (size - 2 < max_length_field_size) {
+            return 0;
+        }
+        return rejectFrame(buffer, size, REJECTED_LENGTH, reason);
     }
     if (payload_length > max_payload_size) {
-        return -1;
+        return rejectFrame(buffer, size, REJECTED_LENGTH, reason);
     }
 
     uint8_t const* message_end = length_field_end + payload_length + 2;
@@ -42,12 +97,16 @@ int protocol::extractPacket(uint8_t const* buffer, size_t size,
     }
 
     auto payload_end = length_field_end + payload_length;
+    if (!check_crc) {
+        return 2 + payload_end - buffer;
+    }
+
     auto expected_crc = crc(buffer + 2, payload_end);
     uint16_t actual_crc = payload_end[0] |
                           static_cast<uint16_t>(payload_end[1]) << 8;
 
     if (expected_crc != actual_crc) {
-        return -1;
+        return rejectFrame(buffer, size, REJECTED_CRC, reason);
     }
     return 2 + payload_end - buffer;
 }
@@ -71,20 +130,26 @@ std::pair<uint8_t const*, uint8_t const*> protocol::getPayload(
 uint8_t* protocol::encodeFrame(uint8_t* buffer, uint8_t* buffer_end,
                                uint8_t const* payload_begin,
                                uint8_t const* payload_end) {
-    validateEncodingBufferSize(buffer_end - buffer, payload_end - payload_begin);
+    size_t payload_length = payload_end - payload_begin;
+    uint8_t* payload = encodeFrameHeader(buffer, buffer_end, payload_length);
+    std::memmove(payload, payload_begin, payload_length);
+    return encodeFrameTrailer(buffer, payload + payload_length);
+}
+
+uint8_t* protocol::encodeFrameHeader(uint8_t* buffer, uint8_t* buffer_end,
+                                     size_t payload_length) {
+    validateEncodingBufferSize(buffer_end - buffer, payload_length);
 
     buffer[0] = SYNC_0;
     buffer[1] = SYNC_1;
+    return encodeLength(buffer + 2, buffer_end, payload_length);
+}
 
-    size_t payload_length = payload_end - payload_begin;
-    uint8_t* length_end = encodeLength(buffer + 2, buffer_end, payload_length);
-    std::memcpy(length_end, payload_begin, payload_length);
-
-    uint8_t* message_end = length_end + payload_length + 2;
-    uint16_t calculated_crc = crc(buffer + 2, message_end - 2);
-    message_end[-2] = calculated_crc & 0xFF;
-    message_end[-1] = (calculated_crc >> 8) & 0xFF;
-    return message_end;
+uint8_t* protocol::encodeFrameTrailer(uint8_t* buffer, uint8_t* payload_end) {
+    uint16_t calculated_crc = crc(buffer + 2, payload_end);
+    payload_end[0] = calculated_crc & 0xFF;
+    payload_end[1] = (calculated_crc >> 8) & 0xFF;
+    return payload_end + 2;
 }
 
 pair<size_t, uint8_t const*> protocol::parseLength(
@@ -135,31 +200,97 @@ uint8_t* protocol::encodeLength(uint8_t* begin, uint8_t* end, size_t length) {
     );
 }
 
-uint16_t protocol::crc(uint8_t const* begin, uint8_t const* end) {
-    uint32_t crc = 0x1D0F;
-    for (auto it = begin; it != end; ++it) {
-        crc = crc ^ (static_cast<uint16_t>(*it) << 8);
-        for (int i = 0; i < 8; ++i) {
-            if (crc & 0x8000) {
-                crc = (crc << 1) ^ 0x1021;
-            }
-            else {
-                crc = (crc << 1);
-            }
-        }
-        crc = crc & 0xffff;
+namespace {
+    template<size_t... I> struct IndexSequence {};
+    template<size_t N, size_t... I>
+    struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+    template<size_t... I>
+    struct MakeIndexSequence<0, I...> {
+        typedef IndexSequence<I...> type;
+    };
+
+    /** CRC-CCITT polynomial */
+    constexpr uint16_t CRC_POLYNOMIAL = 0x1021;
+
+    /** Feeds the given number of zero bits into the CRC register */
+    constexpr uint16_t crcShift(uint16_t crc, int bits) {
+        return bits == 0 ? crc :
+            crcShift(static_cast<uint16_t>(
+                (crc & 0x8000) ? ((crc << 1) ^ CRC_POLYNOMIAL) : (crc << 1)
+            ), bits - 1);
+    }
+
+    /** Effect of a zero byte following a byte whose contribution is 'value' */
+    constexpr uint16_t crcNextSlice(uint16_t value) {
+        return static_cast<uint16_t>(
+            (value << 8) ^ crcShift(static_cast<uint16_t>(value & 0xFF00), 8)
+        );
+    }
+
+    /** Contribution of byte 'b' when followed by 'slice' other bytes */
+    constexpr uint16_t crcTableEntry(int slice, uint16_t b) {
+        return slice == 0 ? crcShift(static_cast<uint16_t>(b << 8), 8)
+                          : crcNextSlice(crcTableEntry(slice - 1, b));
     }
 
+    typedef std::array<uint16_t, 256> CRCTableRow;
+
+    template<size_t... I>
+    constexpr CRCTableRow makeCRCTableRow(int slice, IndexSequence<I...>) {
+        return {{ crcTableEntry(slice, I)... }};
+    }
+
+    typedef MakeIndexSequence<256>::type CRCTableIndexes;
+
+    /** Slice-by-8 lookup tables
+     *
+     * CRC_TABLES[i][b] is the CRC contribution of byte b when it is followed
+     * by i other bytes
+     */
+    constexpr std::array<CRCTableRow, 8> CRC_TABLES = {{
+        makeCRCTableRow(0, CRCTableIndexes()),
+        makeCRCTableRow(1, CRCTableIndexes()),
+        makeCRCTableRow(2, CRCTableIndexes()),
+        makeCRCTableRow(3, CRCTableIndexes()),
+        makeCRCTableRow(4, CRCTableIndexes()),
+        makeCRCTableRow(5, CRCTableIndexes()),
+        makeCRCTableRow(6, CRCTableIndexes()),
+        makeCRCTableRow(7, CRCTableIndexes())
+    }};
+}
+
+uint16_t protocol::crc(uint8_t const* begin, uint8_t const* end) {
+    return crc_update(CRC_INIT, begin, end);
+}
+
+uint16_t protocol::crc_update(uint16_t crc, uint8_t const* begin, uint8_t const* end) {
+    auto const& t = CRC_TABLES;
+
+    auto it = begin;
+    for (; end - it >= 8; it += 8) {
+        crc = t[7][it[0] ^ (crc >> 8)] ^ t[6][it[1] ^ (crc & 0xFF)] ^
+              t[5][it[2]] ^ t[4][it[3]] ^ t[3][it[4]] ^ t[2][it[5]] ^
+              t[1][it[6]] ^ t[0][it[7]];
+    }
+    for (; it != end; ++it) {
+        crc = static_cast<uint16_t>((crc << 8) ^ t[0][(crc >> 8) ^ *it]);
+    }
     return crc;
 }
 
+size_t protocol::getFrameSize(size_t payload_length) {
+    // encodeLength always writes at least one byte, even for a zero length
+    size_t length_encoded_size = std::max<size_t>(
+        1, getLengthEncodedSize(payload_length)
+    );
+    // NOTE: MIN_OVERHEAD accounts for one byte of length, thus the -1
+    return PACKET_MIN_OVERHEAD + payload_length + length_encoded_size - 1;
+}
+
 size_t protocol::validateEncodingBufferSize(
     size_t buffer_length, size_t payload_length
 ) {
-    size_t length_encoded_size = getLengthEncodedSize(payload_length);
-    // NOTE: MIN_OVERHEAD accounts for one byte of length, thus the -1
-    size_t expected_buffer_length = PACKET_MIN_OVERHEAD +
-                                    payload_length + length_encoded_size - 1;
+    size_t expected_buffer_length = getFrameSize(payload_length);
     if (expected_buffer_length > buffer_length) {
         throw std::invalid_argument(
             "encodeFrame: provided buffer is too small. It needed to be " +
@@ -171,40 +302,308 @@ size_t protocol::validateEncodingBufferSize(
     return expected_buffer_length;
 }
 
-protocol::CipherContext::CipherContext(string const& psk) {
+protocol::aes_key protocol::deriveKey(string const& psk) {
     static const int NROUNDS = 1000000;
+    aes_key key;
+    uint8_t iv[EVP_MAX_IV_LENGTH];
     int i = EVP_BytesToKey(
         EVP_aes_256_gcm(), EVP_sha256(),
         nullptr, // salt
-        reinterpret_cast<uint8_t const*>(&psk[0]), psk.length(), NROUNDS, key, iv
+        reinterpret_cast<uint8_t const*>(&psk[0]), psk.length(), NROUNDS,
+        key.data(), iv
     );
-    if (i != KEY_SIZE) {
+    if (i != CipherContext::KEY_SIZE) {
         throw std::runtime_error("failed key derivation");
     }
+    return key;
+}
+
+protocol::aes_key protocol::getDerivedKey(string const& psk) {
+    // The cache is indexed by the PSK's digest to avoid keeping the PSK
+    // itself in memory
+    static std::mutex mutex;
+    static std::map<std::array<uint8_t, 32>, aes_key> cache;
+
+    std::array<uint8_t, 32> digest;
+    SHA256(reinterpret_cast<uint8_t const*>(psk.data()), psk.length(),
+           digest.data());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cache.find(digest);
+        if (it != cache.end()) {
+            return it->second;
+        }
+    }
+
+    // Derive outside of the lock, so that different PSKs are derived in
+    // parallel. Threads racing on the same PSK derive the same key
+    aes_key key = deriveKey(psk);
+    std::lock_guard<std::mutex> lock(mutex);
+    cache[digest] = key;
+    return key;
 }
 
-struct ContextGuard {
-    EVP_CIPHER_CTX*& ctx;
-    ContextGuard(EVP_CIPHER_CTX*& ctx)
-        : ctx(ctx) {
-        ctx = EVP_CIPHER_CTX_new();
+string protocol::formatKey(aes_key const& key) {
+    static const char DIGITS[] = "0123456789abcdef";
+    string result;
+    for (uint8_t b : key) {
+        result.push_back(DIGITS[b >> 4]);
+        result.push_back(DIGITS[b & 0xF]);
     }
-    ContextGuard(ContextGuard&) = delete;
-    ~ContextGuard() {
-        EVP_CIPHER_CTX_free(ctx);
+    return result;
+}
+
+static int parseHexDigit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
     }
-};
+    else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
 
-size_t protocol::encrypt(CipherContext& ctx_,
+protocol::aes_key protocol::parseKey(string const& hex) {
+    aes_key key;
+    if (hex.size() != key.size() * 2) {
+        throw std::invalid_argument(
+            "parseKey: expected " + to_string(key.size() * 2) +
+            " hexadecimal digits, got " + to_string(hex.size()) + " characters"
+        );
+    }
+    for (size_t i = 0; i < key.size(); ++i) {
+        int high = parseHexDigit(hex[i * 2]);
+        int low = parseHexDigit(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) {
+            throw std::invalid_argument(
+                "parseKey: invalid hexadecimal digit in key"
+            );
+        }
+        key[i] = high << 4 | low;
+    }
+    return key;
+}
+
+static EVP_CIPHER const* getEVPCipher(protocol::CipherAlgorithm algorithm) {
+    switch (algorithm) {
+        case protocol::AES_256_GCM:
+            return EVP_aes_256_gcm();
+        case protocol::CHACHA20_POLY1305:
+            return EVP_chacha20_poly1305();
+        default:
+            return nullptr;
+    }
+}
+
+/** Time taken to encrypt a buffer with the given algorithm */
+static chrono::steady_clock::duration benchmarkCipher(
+    protocol::CipherAlgorithm algorithm
+) {
+    protocol::aes_key key = {};
+    protocol::CipherContext ctx(key, algorithm);
+    vector<uint8_t> buffer(16384);
+    protocol::aes_tag tag;
+
+    // Keep the best of a few runs to filter out preemptions
+    auto best = chrono::steady_clock::duration::max();
+    for (int i = 0; i < 8; ++i) {
+        auto start = chrono::steady_clock::now();
+        protocol::encrypt(ctx, ctx.nextIV(), buffer.data(), tag,
+                          buffer.data(), buffer.size());
+        best = std::min(best, chrono::steady_clock::now() - start);
+    }
+    return best;
+}
+
+protocol::CipherAlgorithm protocol::getFastestCipherAlgorithm() {
+    static const CipherAlgorithm fastest =
+        benchmarkCipher(CHACHA20_POLY1305) < benchmarkCipher(AES_256_GCM) ?
+        CHACHA20_POLY1305 : AES_256_GCM;
+    return fastest;
+}
+
+protocol::CipherContext::CipherContext(string const& psk, CipherAlgorithm algorithm)
+    : CipherContext(getDerivedKey(psk), algorithm) {
+}
+
+protocol::CipherContext::CipherContext(aes_key const& derived_key,
+                                       CipherAlgorithm algorithm)
+    : algorithm(algorithm == AUTO_CIPHER ? getFastestCipherAlgorithm() : algorithm) {
+    if (!getEVPCipher(this->algorithm)) {
+        throw std::invalid_argument(
+            "unknown cipher algorithm " + to_string(algorithm)
+        );
+    }
+
+    std::copy(derived_key.begin(), derived_key.end(), key);
+    if (1 != RAND_bytes(session.data(), SESSION_ID_SIZE)) {
+        throw std::runtime_error("failed to generate the session ID");
+    }
+    aes_key session_key = deriveSessionKey(derived_key, session);
+
+    // Expand the key schedule once, encrypt only sets the IV. The
+    // decryption contexts get their key from the first message received
+    encryption = EVP_CIPHER_CTX_new();
+    bool success = encryption && EVP_EncryptInit_ex(
+        encryption, getEVPCipher(this->algorithm), NULL, session_key.data(), NULL
+    );
+    for (int i = 0; success && i < CIPHER_ALGORITHM_COUNT; ++i) {
+        auto cipher = getEVPCipher(static_cast<CipherAlgorithm>(i));
+        decryption[i] = EVP_CIPHER_CTX_new();
+        candidate_decryption[i] = EVP_CIPHER_CTX_new();
+        success = decryption[i] && candidate_decryption[i] &&
+            EVP_DecryptInit_ex(decryption[i], cipher, NULL, NULL, NULL) &&
+            EVP_DecryptInit_ex(candidate_decryption[i], cipher, NULL, NULL, NULL);
+    }
+    OPENSSL_cleanse(session_key.data(), session_key.size());
+    if (!success) {
+        EVP_CIPHER_CTX_free(encryption);
+        for (int i = 0; i < CIPHER_ALGORITHM_COUNT; ++i) {
+            EVP_CIPHER_CTX_free(decryption[i]);
+            EVP_CIPHER_CTX_free(candidate_decryption[i]);
+        }
+        throw std::runtime_error("failed to initialize the cipher contexts");
+    }
+}
+
+protocol::CipherContext::~CipherContext() {
+    EVP_CIPHER_CTX_free(encryption);
+    for (int i = 0; i < CIPHER_ALGORITHM_COUNT; ++i) {
+        EVP_CIPHER_CTX_free(decryption[i]);
+        EVP_CIPHER_CTX_free(candidate_decryption[i]);
+    }
+}
+
+protocol::aes_key protocol::deriveSessionKey(aes_key const& key,
+                                             session_id const& session) {
+    static const char LABEL[] = "comms_protobuf session key";
+    uint8_t message[sizeof(LABEL) - 1 + CipherContext::SESSION_ID_SIZE];
+    std::copy(LABEL, LABEL + sizeof(LABEL) - 1, message);
+    std::copy(session.begin(), session.end(), message + sizeof(LABEL) - 1);
+
+    aes_key result;
+    unsigned int length = result.size();
+    if (!HMAC(EVP_sha256(), key.data(), key.size(), message, sizeof(message),
+              result.data(), &length)) {
+        throw std::runtime_error("failed to derive the session key");
+    }
+    return result;
+}
+
+protocol::aes_iv protocol::CipherContext::nextIV() {
+    if (send_counter > MAX_IV_COUNTER) {
+        throw EncryptionFailed("nextIV: exhausted the IV space of this key");
+    }
+
+    aes_iv iv;
+    std::copy(session.begin(), session.end(), iv.begin());
+    uint64_t counter = send_counter++;
+    for (size_t i = SESSION_ID_SIZE; i < iv.size() - 1; ++i) {
+        iv[i] = counter & 0xFF;
+        counter >>= 8;
+    }
+    iv[iv.size() - 1] = algorithm;
+    return iv;
+}
+
+uint64_t protocol::getIVCounter(aes_iv const& iv) {
+    uint64_t counter = 0;
+    for (size_t i = iv.size() - 1; i > CipherContext::SESSION_ID_SIZE; --i) {
+        counter = (counter << 8) | iv[i - 1];
+    }
+    return counter;
+}
+
+protocol::CipherAlgorithm protocol::getIVAlgorithm(aes_iv const& iv) {
+    return static_cast<CipherAlgorithm>(iv[iv.size() - 1]);
+}
+
+protocol::session_id protocol::getIVSession(aes_iv const& iv) {
+    session_id session;
+    std::copy(iv.begin(), iv.begin() + session.size(), session.begin());
+    return session;
+}
+
+void protocol::ReplayWindow::setLocalSession(session_id const& session) {
+    m_has_local_session = true;
+    m_local_session = session;
+}
+
+bool protocol::ReplayWindow::isRetired(session_id const& session) const {
+    auto end = m_retired.begin() + m_retired_count;
+    return std::find(m_retired.begin(), end, session) != end;
+}
+
+void protocol::ReplayWindow::retireCurrentSession() {
+    if (!m_initialized) {
+        return;
+    }
+    m_retired[m_retired_next] = m_session;
+    m_retired_next = (m_retired_next + 1) % MAX_RETIRED_SESSIONS;
+    m_retired_count = std::min(m_retired_count + 1, MAX_RETIRED_SESSIONS);
+    m_initialized = false;
+}
+
+bool protocol::ReplayWindow::isAcceptable(aes_iv const& iv) const {
+    session_id session = getIVSession(iv);
+    if (m_has_local_session && session == m_local_session) {
+        return false;
+    }
+    else if (!m_initialized || session != m_session) {
+        return !isRetired(session);
+    }
+
+    uint64_t counter = getIVCounter(iv);
+    if (counter > m_highest) {
+        return true;
+    }
+    uint64_t age = m_highest - counter;
+    if (age >= WINDOW_SIZE) {
+        return false;
+    }
+    return !(m_received & (static_cast<uint64_t>(1) << age));
+}
+
+void protocol::ReplayWindow::update(aes_iv const& iv) {
+    uint64_t counter = getIVCounter(iv);
+    session_id session = getIVSession(iv);
+    if (!m_initialized || session != m_session) {
+        retireCurrentSession();
+        m_session = session;
+        m_initialized = true;
+        m_highest = counter;
+        m_received = 1;
+    }
+    else if (counter > m_highest) {
+        uint64_t shift = counter - m_highest;
+        m_received = (shift >= WINDOW_SIZE) ? 0 : (m_received << shift);
+        m_received |= 1;
+        m_highest = counter;
+    }
+    else if (m_highest - counter < WINDOW_SIZE) {
+        m_received |= static_cast<uint64_t>(1) << (m_highest - counter);
+    }
+}
+
+void protocol::ReplayWindow::reset() {
+    retireCurrentSession();
+    m_highest = 0;
+    m_received = 0;
+}
+
+size_t protocol::encrypt(CipherContext& ctx_, aes_iv const& iv,
                          uint8_t* ciphertext, aes_tag& tag,
                          uint8_t const* plaintext, size_t plaintext_length) {
 
-    EVP_CIPHER_CTX* ctx;
-    ContextGuard guard(ctx);
+    EVP_CIPHER_CTX* ctx = ctx_.encryption;
 
     /* Initialise the encryption operation. */
-    if (!EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, ctx_.key, ctx_.iv)) {
-        throw EncryptionFailed("encrypt: failed to initialize the AES 256 GCM cypher");
+    if (!EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv.data() + NONCE_OFFSET)) {
+        throw EncryptionFailed("encrypt: failed to initialize the cipher");
     }
 
     int encrypted_length = 0;
@@ -220,23 +619,59 @@ size_t protocol::encrypt(CipherContext& ctx_,
     }
     encrypted_length += operation_length;
 
-    if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, &tag[0])) {
-        throw EncryptionFailed("encrypt: failed to get the AES tag");
+    if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, 16, &tag[0])) {
+        throw EncryptionFailed("encrypt: failed to get the authentication tag");
     }
 
     return encrypted_length;
 }
 
-size_t protocol::decrypt(CipherContext& ctx_,
+size_t protocol::decrypt(CipherContext& ctx_, aes_iv const& iv,
                          uint8_t* plaintext,
                          uint8_t const* ciphertext, size_t ciphertext_length,
                          aes_tag& tag) {
 
-    EVP_CIPHER_CTX* ctx;
-    ContextGuard guard(ctx);
+    CipherAlgorithm algorithm = getIVAlgorithm(iv);
+    if (algorithm >= CIPHER_ALGORITHM_COUNT) {
+        throw DecryptionFailed(
+            "decrypt: unknown cipher algorithm " + to_string(algorithm)
+        );
+    }
 
-    if (!EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, ctx_.key, ctx_.iv)) {
-        throw DecryptionFailed("encrypt: failed to initialize the AES 256 GCM cipher");
+    // A message of another session than the last one is authenticated
+    // with the candidate contexts, which replace the current ones only if
+    // it succeeds. Their key is kept until another unknown session shows
+    // up, so that repeating a forged session ID does not repeat the
+    // derivation
+    session_id session = getIVSession(iv);
+    bool new_session = !ctx_.has_remote_session || session != ctx_.remote_session;
+    EVP_CIPHER_CTX* ctx = ctx_.decryption[algorithm];
+    bool has_candidate_key = ctx_.has_candidate_session &&
+                             session == ctx_.candidate_session;
+    if (new_session && !has_candidate_key) {
+        ctx_.has_candidate_session = false;
+        aes_key key;
+        std::copy(ctx_.key, ctx_.key + key.size(), key.begin());
+        aes_key session_key = deriveSessionKey(key, session);
+        bool success = true;
+        for (int i = 0; success && i < CIPHER_ALGORITHM_COUNT; ++i) {
+            success = EVP_DecryptInit_ex(ctx_.candidate_decryption[i], NULL, NULL,
+                                         session_key.data(), NULL);
+        }
+        OPENSSL_cleanse(key.data(), key.size());
+        OPENSSL_cleanse(session_key.data(), session_key.size());
+        if (!success) {
+            throw DecryptionFailed("decrypt: failed to set the session key");
+        }
+        ctx_.has_candidate_session = true;
+        ctx_.candidate_session = session;
+    }
+    if (new_session) {
+        ctx = ctx_.candidate_decryption[algorithm];
+    }
+
+    if (!EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv.data() + NONCE_OFFSET)) {
+        throw DecryptionFailed("encrypt: failed to initialize the cipher");
     }
 
     int decrypted_length = 0;
@@ -247,9 +682,9 @@ size_t protocol::decrypt(CipherContext& ctx_,
     }
     decrypted_length += operation_length;
 
-    if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG,
+    if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG,
                                  16, const_cast<uint8_t*>(&tag[0]))) {
-        throw DecryptionFailed("encrypt: failed to set the AES tag");
+        throw DecryptionFailed("encrypt: failed to set the authentication tag");
     }
 
     if (1 != EVP_DecryptFinal_ex(ctx, plaintext + decrypted_length, &operation_length)) {
@@ -257,5 +692,38 @@ size_t protocol::decrypt(CipherContext& ctx_,
     }
     decrypted_length += operation_length;
 
+    if (new_session) {
+        // The candidate contexts now hold the key of the previous session
+        std::swap(ctx_.decryption, ctx_.candidate_decryption);
+        std::swap(ctx_.candidate_session, ctx_.remote_session);
+        ctx_.has_candidate_session = ctx_.has_remote_session;
+        ctx_.remote_session = session;
+        ctx_.has_remote_session = true;
+    }
+
     return decrypted_length;
-}
\ No newline at end of file
+}
+protocol::aes_iv protocol::getPayloadIV(uint8_t const* begin, uint8_t const* end) {
+    if (end - begin < static_cast<int>(sizeof(aes_iv) + sizeof(aes_tag))) {
+        throw DecryptionFailed(
+            "received encrypted payload is too small to contain the IV and tag"
+        );
+    }
+
+    aes_iv iv;
+    std::copy(begin, begin + iv.size(), iv.begin());
+    return iv;
+}
+
+pair<uint8_t*, uint8_t*> protocol::decryptPayload(
+    CipherContext& ctx, uint8_t* begin, uint8_t* end
+) {
+    aes_iv iv = getPayloadIV(begin, end);
+    aes_tag tag;
+    uint8_t* tag_start = begin + iv.size();
+    uint8_t* ciphertext = tag_start + tag.size();
+    std::copy(tag_start, ciphertext, tag.begin());
+
+    size_t size = decrypt(ctx, iv, ciphertext, ciphertext, end - ciphertext, tag);
+    return make_pair(ciphertext, ciphertext + size);
+}
@@ -3,8 +3,11 @@
 
 #include <cstdint>
 #include <array>
+#include <string>
 #include <stdexcept>
 
+struct evp_cipher_ctx_st;
+
 namespace comms_protobuf {
     struct DecryptionFailed : std::runtime_error {
         using std::runtime_error::runtime_error;
@@ -12,6 +15,12 @@ namespace comms_protobuf {
     struct EncryptionFailed : std::runtime_error {
         using std::runtime_error::runtime_error;
     };
+    /** Exception thrown when receiving an encrypted message whose IV has
+     * already been seen, or is too old to be checked
+     */
+    struct ReplayedMessage : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
 
     /** Implementation of the framing protocol
      */
@@ -31,14 +40,41 @@ namespace comms_protobuf {
         static const uint8_t SYNC_0 = 0xB5;
         static const uint8_t SYNC_1 = 0x62;
 
+        /** Why extractPacket skipped bytes */
+        enum RejectionReason {
+            NOT_REJECTED,
+            /** Bytes before the first SYNC_0 SYNC_1 pair */
+            REJECTED_GARBAGE,
+            /** Invalid length field, or payload bigger than the maximum */
+            REJECTED_LENGTH,
+            REJECTED_CRC
+        };
+
         /** Extracts packet from the buffer
+         *
+         * Garbage before the first SYNC_0 SYNC_1 pair is skipped. If the frame
+         * at the start of the buffer is invalid (bad length or CRC), the
+         * method skips directly to the next SYNC_0 SYNC_1 pair instead of a
+         * single byte.
          *
          * @arg max_payload_length the maximum payload length expected by
          *   the underlying protocol
+         * @arg check_crc whether the frame's CRC should be verified. Only
+         *   disable it on transports that cannot corrupt data
+         * @arg reason if non-null, set to the reason why bytes were skipped
+         *   when the return value is negative, and to NOT_REJECTED otherwise
          * @return value expected by iodrivers_base::Driver::extractPacket
          */
         int extractPacket(uint8_t const* buffer, size_t size,
-                          size_t max_payload_size);
+                          size_t max_payload_size, bool check_crc = true,
+                          RejectionReason* reason = nullptr);
+
+        /** Find the first possible frame start in the given range
+         *
+         * @return a pointer on the first SYNC_0 SYNC_1 pair, on a SYNC_0 that
+         *   is the last byte of the range, or end if there are none
+         */
+        uint8_t const* findSync(uint8_t const* begin, uint8_t const* end);
 
         /** Get the payload range
          *
@@ -68,6 +104,11 @@ namespace comms_protobuf {
          */
         size_t validateEncodingBufferSize(size_t buffer_length, size_t length);
 
+        /** Compute the size in bytes of a frame containing a payload of the
+         * given length
+         */
+        size_t getFrameSize(size_t payload_length);
+
         /** Compute the size in bytes of the encoded version of the given length
          */
         size_t getLengthEncodedSize(size_t length);
@@ -94,34 +135,347 @@ namespace comms_protobuf {
                              uint8_t const* payload_begin,
                              uint8_t const* payload_end);
 
+        /** Encode the frame header (sync bytes and length) for a payload of
+         * the given length
+         *
+         * Together with encodeFrameTrailer, this allows to generate the
+         * payload directly in the frame buffer
+         *
+         * @throw std::invalid_argument if the buffer is too small to contain
+         *   the whole frame
+         * @return pointer to where the payload must be written
+         */
+        uint8_t* encodeFrameHeader(uint8_t* buffer, uint8_t* buffer_end,
+                                   size_t payload_length);
+
+        /** Encode the frame trailer (CRC) after a payload
+         *
+         * @arg buffer the start of the frame, as given to encodeFrameHeader
+         * @arg payload_end past-the-end of the payload
+         * @return the past-the-end pointer after the encoded frame
+         */
+        uint8_t* encodeFrameTrailer(uint8_t* buffer, uint8_t* payload_end);
+
+        /** Initial CRC state, i.e. the CRC of an empty buffer */
+        static const uint16_t CRC_INIT = 0x1D0F;
+
         /** Computes the 2-byte checksum over the given buffer
+         *
+         * This is equivalent to crc_update(CRC_INIT, begin, end)
          */
         uint16_t crc(uint8_t const* begin, uint8_t const* end);
 
+        /** Updates a CRC state with the given bytes
+         *
+         * This allows to compute the checksum of a buffer that is not
+         * contiguous in memory. Start with CRC_INIT and feed each part in
+         * order, the final state is the checksum.
+         *
+         * The implementation processes the data 8 bytes at a time using lookup
+         * tables generated at compile time (slice-by-8)
+         */
+        uint16_t crc_update(uint16_t crc, uint8_t const* begin, uint8_t const* end);
+
         typedef std::array<uint8_t, 16> aes_tag;
 
+        /** Per-message IV
+         *
+         * It is made of the 8-byte ID of the sender's session, followed by
+         * a 56-bit little-endian message counter and the CipherAlgorithm
+         * used to encrypt the message. They are picked by the sending side
+         * and sent in clear along with each encrypted message.
+         *
+         * Each session encrypts with its own key, derived from the shared
+         * key and the session ID (see deriveSessionKey). The AEAD nonce is
+         * made of the last 12 bytes of the IV, which are unique within a
+         * session.
+         */
+        typedef std::array<uint8_t, 16> aes_iv;
+
+        /** Random ID of an encryption session, see CipherContext */
+        typedef std::array<uint8_t, 8> session_id;
+
+        /** Key derived from a PSK by deriveKey
+         *
+         * It is used by all the cipher algorithms
+         */
+        typedef std::array<uint8_t, 32> aes_key;
+
+        /** AEAD algorithms used to encrypt the payloads
+         *
+         * The algorithm is carried in the IV of each message, so the two
+         * sides of a channel may use different algorithms as long as they
+         * share the key
+         */
+        enum CipherAlgorithm {
+            AES_256_GCM = 0,
+            /** Faster than AES-GCM on CPUs without AES instructions */
+            CHACHA20_POLY1305 = 1,
+            /** Pick the fastest algorithm on this CPU, see
+             * getFastestCipherAlgorithm
+             */
+            AUTO_CIPHER = 255
+        };
+
+        /** Number of actual algorithms in CipherAlgorithm */
+        static const int CIPHER_ALGORITHM_COUNT = 2;
+
+        /** Return the fastest algorithm on this CPU
+         *
+         * The choice is made by a short benchmark (a few milliseconds) on
+         * the first call, and cached for the rest of the process. The
+         * method is thread-safe
+         */
+        CipherAlgorithm getFastestCipherAlgorithm();
+
+        /** Return the algorithm of an encrypted message from its IV */
+        CipherAlgorithm getIVAlgorithm(aes_iv const& iv);
+
+        /** Return the session ID of an encrypted message from its IV */
+        session_id getIVSession(aes_iv const& iv);
+
+        /** Derive the encryption key from a PSK
+         *
+         * This is computationally expensive (a million rounds of SHA-256).
+         * Use getDerivedKey to benefit from the process-wide cache, or derive
+         * the key offline with the comms_protobuf_derive_key tool
+         */
+        aes_key deriveKey(std::string const& psk);
+
+        /** Return the key derived from this PSK
+         *
+         * The derivation is done only once per PSK and process. The method is
+         * thread-safe
+         */
+        aes_key getDerivedKey(std::string const& psk);
+
+        /** Derive the key of an encryption session from the shared key
+         *
+         * This is HMAC-SHA256 of the session ID, keyed with the shared key.
+         * Since the session ID is an input of the key, a message whose IV
+         * claims another session fails authentication
+         */
+        aes_key deriveSessionKey(aes_key const& key, session_id const& session);
+
+        /** Convert a key to its hexadecimal representation */
+        std::string formatKey(aes_key const& key);
+
+        /** Parse a key from its hexadecimal representation
+         *
+         * @throw std::invalid_argument if the string is not a valid key
+         */
+        aes_key parseKey(std::string const& hex);
+
         struct CipherContext {
             static const int KEY_SIZE = 32;
             static const int MAX_BLOCK_LENGTH = 32;
+            static const int SESSION_ID_SIZE = 8;
 
+            /** The shared key */
             uint8_t key[KEY_SIZE];
-            uint8_t iv[KEY_SIZE];
 
-            CipherContext(std::string const& psk);
+            /** Random ID of the session of this context, put in all the IVs
+             * it generates
+             *
+             * Both sides of a channel share the same key, and the IV counter
+             * restarts at zero with each context. Encrypting with a key
+             * derived from a random 64-bit session ID makes sure that no two
+             * contexts reuse a (key, nonce) pair
+             */
+            session_id session;
+
+            /** Maximum value of the IV counter */
+            static const uint64_t MAX_IV_COUNTER =
+                (static_cast<uint64_t>(1) << 56) - 1;
 
+            /** Counter of the next IV returned by nextIV() */
+            uint64_t send_counter = 0;
+
+            /** Algorithm used by encrypt()
+             *
+             * decrypt() uses the algorithm given by the IV
+             */
+            CipherAlgorithm algorithm = AES_256_GCM;
+
+            /** OpenSSL context initialized with the cipher and key of the
+             * session at construction. encrypt() only re-seeds it with the IV
+             */
+            evp_cipher_ctx_st* encryption = nullptr;
+
+            /** Whether decryption is initialized with the key of
+             * remote_session
+             */
+            bool has_remote_session = false;
+
+            /** Session of the last message successfully decrypted */
+            session_id remote_session;
+
+            /** OpenSSL contexts initialized with the key of remote_session,
+             * one per algorithm
+             */
+            evp_cipher_ctx_st* decryption[CIPHER_ALGORITHM_COUNT] = {};
+
+            /** Contexts used to authenticate a message of a new session.
+             * They are swapped with decryption if it succeeds
+             */
+            evp_cipher_ctx_st* candidate_decryption[CIPHER_ALGORITHM_COUNT] = {};
+
+            /** Whether candidate_decryption is initialized with the key of
+             * candidate_session
+             *
+             * This makes repeated messages with the same unknown session
+             * cost a single key derivation
+             */
+            bool has_candidate_session = false;
+
+            /** Session whose key is loaded in candidate_decryption */
+            session_id candidate_session;
+
+            /** Create a context for the given PSK
+             *
+             * The key is obtained through getDerivedKey
+             */
+            CipherContext(std::string const& psk,
+                          CipherAlgorithm algorithm = AES_256_GCM);
+
+            /** Create a context from an already derived key */
+            CipherContext(aes_key const& key,
+                          CipherAlgorithm algorithm = AES_256_GCM);
+            ~CipherContext();
+            CipherContext(CipherContext const&) = delete;
+            CipherContext& operator=(CipherContext const&) = delete;
+
+            /** Return the IV to use for the next encrypted message */
+            aes_iv nextIV();
+
+            /** Maximum size of an encrypted payload (IV, tag and ciphertext)
+             */
             static constexpr int getMaxCiphertextLength(size_t size) {
-                return size + MAX_BLOCK_LENGTH - 1 + sizeof(aes_tag);
+                return size + MAX_BLOCK_LENGTH - 1 +
+                       sizeof(aes_iv) + sizeof(aes_tag);
             }
         };
 
-        size_t encrypt(CipherContext& ctx,
+        /** Sliding-window filter that rejects replayed encrypted messages
+         *
+         * It tracks the counters of the last WINDOW_SIZE IVs received in the
+         * current session of the remote side. Since the session ID selects
+         * the key (see deriveSessionKey), a message can only move the window
+         * to a new session once it has been authenticated with that
+         * session's key, i.e. when the remote side restarted. The previous
+         * session is then retired, and its messages are rejected from then
+         * on.
+         *
+         * Messages of the local session (i.e. sent by this side and
+         * reflected back) are always rejected.
+         *
+         * Only the last MAX_RETIRED_SESSIONS sessions are remembered. A
+         * session that this side never received messages from, e.g. one
+         * that ended before it started, cannot be told apart from a restart
+         * of the remote side.
+         */
+        class ReplayWindow {
+        public:
+            static const int WINDOW_SIZE = 64;
+            static const size_t MAX_RETIRED_SESSIONS = 256;
+
+            /** Set the session of the local cipher context, whose messages
+             * must be rejected
+             */
+            void setLocalSession(session_id const& session);
+
+            /** Whether a message with this IV may be accepted
+             *
+             * This does not modify the window. Call update() once the message
+             * has been authenticated
+             */
+            bool isAcceptable(aes_iv const& iv) const;
+
+            /** Register the IV of an authenticated message */
+            void update(aes_iv const& iv);
+
+            /** Forget the received IVs and retire the current session
+             *
+             * The next authenticated message starts a new window. The local
+             * session is kept
+             */
+            void reset();
+
+        private:
+            bool m_has_local_session = false;
+            session_id m_local_session;
+
+            bool m_initialized = false;
+            session_id m_session;
+            uint64_t m_highest = 0;
+            /** Bit N is set if the counter m_highest - N has been received */
+            uint64_t m_received = 0;
+
+            /** Sessions that were replaced by a newer one
+             *
+             * This is a ring buffer, m_retired_next being the index of the
+             * next entry to overwrite, so that retiring a session does not
+             * allocate
+             */
+            std::array<session_id, MAX_RETIRED_SESSIONS> m_retired;
+            /** Number of valid entries in m_retired */
+            size_t m_retired_count = 0;
+            /** Index in m_retired of the next retired session */
+            size_t m_retired_next = 0;
+
+            bool isRetired(session_id const& session) const;
+            void retireCurrentSession();
+        };
+
+        /** Extract the message counter out of an IV */
+        uint64_t getIVCounter(aes_iv const& iv);
+
+        /** Encrypt with the context's algorithm
+         *
+         * The IV must have been generated by the context's nextIV()
+         */
+        size_t encrypt(CipherContext& ctx, aes_iv const& iv,
                        uint8_t* ciphertext, aes_tag& tag,
                        uint8_t const* plaintext, size_t plaintext_length);
-        size_t decrypt(CipherContext& ctx,
+        /** Decrypt with the algorithm given by the IV
+         *
+         * @throw DecryptionFailed
+         */
+        size_t decrypt(CipherContext& ctx, aes_iv const& iv,
                        uint8_t* plaintext,
                        uint8_t const* ciphertext, size_t ciphertext_length,
                        aes_tag& tag);
 
+        /** Return the IV of an encrypted payload
+         *
+         * @throw DecryptionFailed if the payload is too small to contain
+         *   the IV and tag
+         */
+        aes_iv getPayloadIV(uint8_t const* begin, uint8_t const* end);
+
+        /** Decrypt an encrypted payload (IV, tag and ciphertext) in place
+         *
+         * @return the plaintext range, within [begin, end)
+         * @throw DecryptionFailed
+         */
+        std::pair<uint8_t*, uint8_t*> decryptPayload(
+            CipherContext& ctx, uint8_t* begin, uint8_t* end
+        );
+
+        /** Compute the serialized size of a protobuf message
+         *
+         * The size is cached within the message, which allows to call the
+         * encodeFrame overload that takes the payload length afterwards
+         */
+        template<typename Message>
+        size_t getSerializedSize(Message const& message) {
+#if GOOGLE_PROTOBUF_VERSION >= 3006001
+            return message.ByteSizeLong();
+#else
+            return message.ByteSize();
+#endif
+        }
+
         /** Encode a frame containing the given protobuf message
          *
          * @return the past-the-end pointer after the encoded frame
@@ -129,31 +483,21 @@ namespace comms_protobuf {
         template<typename Message>
         uint8_t* encodeFrame(uint8_t* buffer, uint8_t* buffer_end,
                              Message const& message) {
-#if GOOGLE_PROTOBUF_VERSION >= 3006001
-            size_t payload_length = message.ByteSizeLong();
-#else
-            size_t payload_length = message.ByteSize();
-#endif
-            auto message_end = buffer + validateEncodingBufferSize(
-                buffer_end - buffer, payload_length
-            );
-
-            buffer[0] = SYNC_0;
-            buffer[1] = SYNC_1;
-
-            uint8_t* length_end = encodeLength(
-                buffer + 2, buffer_end, payload_length
-            );
-            message.SerializeWithCachedSizesToArray(length_end);
+            return encodeFrame(buffer, buffer_end, message,
+                               getSerializedSize(message));
+        }
 
-            uint8_t* payload_end = length_end + payload_length;
-            if (payload_end + 2 != message_end) {
-                throw InternalError("message boundary calculations do not match");
-            }
-            uint16_t calculated_crc = crc(buffer + 2, payload_end);
-            payload_end[0] = calculated_crc & 0xFF;
-            payload_end[1] = (calculated_crc >> 8) & 0xFF;
-            return payload_end + 2;
+        /** Encode a frame containing the given protobuf message, whose
+         * serialized size has already been computed by getSerializedSize
+         *
+         * @return the past-the-end pointer after the encoded frame
+        */
+        template<typename Message>
+        uint8_t* encodeFrame(uint8_t* buffer, uint8_t* buffer_end,
+                             Message const& message, size_t payload_length) {
+            uint8_t* payload = encodeFrameHeader(buffer, buffer_end, payload_length);
+            message.SerializeWithCachedSizesToArray(payload);
+            return encodeFrameTrailer(buffer, payload + payload_length);
         }
     }
 }
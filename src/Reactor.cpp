@@ -0,0 +1,146 @@
+#include <comms_protobuf/Reactor.hpp>
+
+#include <iodrivers_base/Exceptions.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace comms_protobuf;
+
+Reactor::Reactor() {
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd == -1) {
+        throw iodrivers_base::UnixError("Reactor: failed to create the epoll instance");
+    }
+    m_stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_stop_fd == -1) {
+        int error = errno;
+        ::close(m_epoll_fd);
+        throw iodrivers_base::UnixError(
+            "Reactor: failed to create the stop eventfd", error
+        );
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_stop_fd, &event) == -1) {
+        int error = errno;
+        ::close(m_stop_fd);
+        ::close(m_epoll_fd);
+        throw iodrivers_base::UnixError(
+            "Reactor: failed to watch the stop eventfd", error
+        );
+    }
+}
+
+Reactor::~Reactor() {
+    ::close(m_stop_fd);
+    ::close(m_epoll_fd);
+}
+
+void Reactor::control(int operation, Handler& handler) {
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    if (handler.wantsWrite()) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.ptr = &handler;
+    if (epoll_ctl(m_epoll_fd, operation, handler.getFileDescriptor(), &event) == -1) {
+        throw iodrivers_base::UnixError("Reactor: failed to update the watched descriptors");
+    }
+}
+
+void Reactor::add(Handler& handler) {
+    control(EPOLL_CTL_ADD, handler);
+    m_handlers.insert(&handler);
+}
+
+void Reactor::update(Handler& handler) {
+    control(EPOLL_CTL_MOD, handler);
+}
+
+void Reactor::remove(Handler& handler) {
+    if (!m_handlers.erase(&handler)) {
+        return;
+    }
+    m_removed.push_back(&handler);
+
+    epoll_event event = {};
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL,
+                  handler.getFileDescriptor(), &event) == -1) {
+        throw iodrivers_base::UnixError("Reactor: failed to remove a handler");
+    }
+}
+
+bool Reactor::isDispatchable(Handler* handler) const {
+    return m_handlers.count(handler) &&
+        std::find(m_removed.begin(), m_removed.end(), handler) == m_removed.end();
+}
+
+int Reactor::poll(base::Time const& timeout) {
+    static const int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+
+    int count = epoll_wait(m_epoll_fd, events, MAX_EVENTS,
+                           timeout.toMilliseconds());
+    if (count == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        throw iodrivers_base::UnixError("Reactor: epoll_wait failed");
+    }
+
+    // A callback may remove, and destroy, any handler, including ones that
+    // have an event later in this batch
+    m_removed.clear();
+    int handled = 0;
+    for (int i = 0; i < count; ++i) {
+        auto handler = static_cast<Handler*>(events[i].data.ptr);
+        if (!handler) {
+            uint64_t value;
+            if (::read(m_stop_fd, &value, sizeof(value)) > 0) {
+                m_running = false;
+            }
+            continue;
+        }
+        else if (!isDispatchable(handler)) {
+            continue;
+        }
+
+        uint32_t flags = events[i].events;
+        if (flags & EPOLLIN) {
+            handler->handleRead();
+            if (!isDispatchable(handler)) {
+                ++handled;
+                continue;
+            }
+        }
+        if (flags & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
+            remove(*handler);
+            handler->handleHangup();
+        }
+        else if ((flags & EPOLLOUT) && handler->wantsWrite()) {
+            handler->handleWrite();
+        }
+        ++handled;
+    }
+    return handled;
+}
+
+void Reactor::run() {
+    m_running = true;
+    while (m_running) {
+        poll(base::Time::fromMilliseconds(-1));
+    }
+}
+
+void Reactor::stop() {
+    uint64_t value = 1;
+    if (::write(m_stop_fd, &value, sizeof(value)) == -1) {
+        throw iodrivers_base::UnixError("Reactor: failed to signal the stop request");
+    }
+}
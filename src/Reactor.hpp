@@ -0,0 +1,115 @@
+#ifndef COMMS_PROTOBUF_REACTOR_HPP
+#define COMMS_PROTOBUF_REACTOR_HPP
+
+#include <base/Time.hpp>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+namespace comms_protobuf {
+    /** Event loop that services many file-descriptor based channels from a
+     * single thread
+     *
+     * It is based on epoll. Objects that want to be notified implement the
+     * Handler interface and register themselves with add(). See
+     * AsyncChannel for the handler that wraps a Channel
+     */
+    class Reactor {
+    public:
+        struct Handler {
+            virtual ~Handler() {}
+
+            /** The file descriptor that should be watched */
+            virtual int getFileDescriptor() const = 0;
+
+            /** Called when the file descriptor has data to read */
+            virtual void handleRead() = 0;
+
+            /** Called when the file descriptor can be written to and
+             * wantsWrite() returned true
+             */
+            virtual void handleWrite() = 0;
+
+            /** Called when the remote side closed the connection or the file
+             * descriptor is in error
+             *
+             * The handler has already been removed from the reactor when this
+             * is called. Pending data has been processed by handleRead()
+             */
+            virtual void handleHangup() {}
+
+            /** Whether the handler has data waiting to be written
+             *
+             * Call Reactor::update when this changes
+             */
+            virtual bool wantsWrite() const = 0;
+        };
+
+        Reactor();
+        ~Reactor();
+        Reactor(Reactor const&) = delete;
+        Reactor& operator=(Reactor const&) = delete;
+
+        /** Start watching the handler's file descriptor
+         *
+         * The handler must stay valid until remove() is called
+         */
+        void add(Handler& handler);
+
+        /** Update the events watched for this handler after its
+         * wantsWrite() changed
+         */
+        void update(Handler& handler);
+
+        /** Stop watching the handler
+         *
+         * It is a no-op if the handler is not registered. It may be called
+         * from within a handler's callbacks, for any handler. Events of the
+         * removed handler that are pending in the current poll() are then
+         * dropped, so the handler may be destroyed right away
+         */
+        void remove(Handler& handler);
+
+        /** Wait for events for at most the given time and process them
+         *
+         * A negative timeout waits until there is at least one event
+         *
+         * @return the number of handlers that had events
+         */
+        int poll(base::Time const& timeout);
+
+        /** Process events until stop() is called */
+        void run();
+
+        /** Make run() return
+         *
+         * This is the only method that may be called from another thread
+         * than the one that runs the reactor
+         */
+        void stop();
+
+    private:
+        int m_epoll_fd;
+        int m_stop_fd;
+        bool m_running = false;
+
+        /** The registered handlers */
+        std::set<Handler*> m_handlers;
+
+        /** Handlers removed since the start of the current poll()
+         *
+         * The events already returned by epoll for them must not be
+         * dispatched, even if they have been registered again
+         */
+        std::vector<Handler*> m_removed;
+
+        void control(int operation, Handler& handler);
+
+        /** Whether events received in the current poll() for this handler
+         * may be dispatched to it
+         */
+        bool isDispatchable(Handler* handler) const;
+    };
+}
+
+#endif
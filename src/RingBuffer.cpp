@@ -0,0 +1,194 @@
+#include <comms_protobuf/RingBuffer.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <iodrivers_base/Exceptions.hpp>
+
+using namespace std;
+using namespace comms_protobuf;
+
+static uint64_t roundToPowerOfTwo(uint64_t value) {
+    uint64_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+/** Sleep until *word is changed from value, or the timeout expires
+ *
+ * Returns early if *word is not equal to value when called
+ */
+static void futexWait(atomic<uint32_t>& word, uint32_t value,
+                      base::Time const& timeout) {
+    int64_t usec = timeout.toMicroseconds();
+    timespec ts = { static_cast<time_t>(usec / 1000000),
+                    static_cast<long>(usec % 1000000) * 1000 };
+    int ret = syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT,
+                      value, &ts, nullptr, 0);
+    if (ret != 0 && errno != EAGAIN && errno != ETIMEDOUT && errno != EINTR) {
+        throw iodrivers_base::UnixError("RingBuffer: futex wait failed");
+    }
+}
+
+static void futexWake(atomic<uint32_t>& word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE,
+            1, nullptr, nullptr, 0);
+}
+
+RingBuffer::RingBuffer(size_t capacity)
+    : m_capacity(getActualCapacity(capacity)) {
+    m_memory.resize(getMemorySize(m_capacity) + CACHE_LINE_SIZE);
+    void* memory = m_memory.data();
+    size_t space = m_memory.size();
+    setup(align(CACHE_LINE_SIZE, sizeof(Control), memory, space), true);
+}
+
+RingBuffer::RingBuffer(void* memory, size_t capacity, bool initialize)
+    : m_capacity(capacity) {
+    if (getActualCapacity(capacity) != capacity) {
+        throw std::invalid_argument("RingBuffer: capacity must be a power of two");
+    }
+    else if (reinterpret_cast<uintptr_t>(memory) % CACHE_LINE_SIZE) {
+        throw std::invalid_argument("RingBuffer: memory must be cache-line aligned");
+    }
+    setup(memory, initialize);
+}
+
+void RingBuffer::setup(void* memory, bool initialize) {
+    if (initialize) {
+        m_control = new(memory) Control();
+        m_control->head = 0;
+        m_control->tail = 0;
+        m_control->write_events = 0;
+        m_control->read_events = 0;
+        m_control->producer_waiting = 0;
+        m_control->consumer_waiting = 0;
+    }
+    else {
+        m_control = static_cast<Control*>(memory);
+    }
+    m_data = reinterpret_cast<uint8_t*>(m_control + 1);
+    m_producer_tail = m_control->tail.load();
+    m_consumer_head = m_control->head.load();
+}
+
+size_t RingBuffer::getMemorySize(size_t capacity) {
+    return sizeof(Control) + capacity;
+}
+
+size_t RingBuffer::getActualCapacity(size_t capacity) {
+    return roundToPowerOfTwo(max<size_t>(1, capacity));
+}
+
+size_t RingBuffer::getCapacity() const {
+    return m_capacity;
+}
+
+size_t RingBuffer::getSize() const {
+    return m_control->head.load(memory_order_acquire) -
+           m_control->tail.load(memory_order_acquire);
+}
+
+size_t RingBuffer::write(uint8_t const* buffer, size_t size) {
+    uint64_t head = m_control->head.load(memory_order_relaxed);
+    if (head + size - m_producer_tail > m_capacity) {
+        m_producer_tail = m_control->tail.load(memory_order_acquire);
+    }
+
+    size = min<uint64_t>(size, m_capacity - (head - m_producer_tail));
+    if (!size) {
+        return 0;
+    }
+
+    size_t offset = head & (m_capacity - 1);
+    size_t first = min<size_t>(size, m_capacity - offset);
+    memcpy(m_data + offset, buffer, first);
+    memcpy(m_data, buffer + first, size - first);
+    m_control->head.store(head + size, memory_order_seq_cst);
+    signal(m_control->write_events, m_control->consumer_waiting);
+    return size;
+}
+
+size_t RingBuffer::read(uint8_t* buffer, size_t size) {
+    uint64_t tail = m_control->tail.load(memory_order_relaxed);
+    if (tail + size > m_consumer_head) {
+        m_consumer_head = m_control->head.load(memory_order_acquire);
+    }
+
+    size = min<uint64_t>(size, m_consumer_head - tail);
+    if (!size) {
+        return 0;
+    }
+
+    size_t offset = tail & (m_capacity - 1);
+    size_t first = min<size_t>(size, m_capacity - offset);
+    memcpy(buffer, m_data + offset, first);
+    memcpy(buffer + first, m_data, size - first);
+    m_control->tail.store(tail + size, memory_order_seq_cst);
+    signal(m_control->read_events, m_control->producer_waiting);
+    return size;
+}
+
+bool RingBuffer::hasData() const {
+    return m_control->head.load(memory_order_seq_cst) !=
+           m_control->tail.load(memory_order_relaxed);
+}
+
+bool RingBuffer::hasRoom() const {
+    return m_control->head.load(memory_order_relaxed) -
+           m_control->tail.load(memory_order_seq_cst) < m_capacity;
+}
+
+bool RingBuffer::waitRead(base::Time const& timeout) {
+    return wait(m_control->write_events, m_control->consumer_waiting,
+                timeout, &RingBuffer::hasData);
+}
+
+bool RingBuffer::waitWrite(base::Time const& timeout) {
+    return wait(m_control->read_events, m_control->producer_waiting,
+                timeout, &RingBuffer::hasRoom);
+}
+
+bool RingBuffer::wait(atomic<uint32_t>& events, atomic<uint32_t>& waiting,
+                      base::Time const& timeout, bool (RingBuffer::*ready)() const) {
+    for (int i = 0; i < SPIN_COUNT; ++i) {
+        if ((this->*ready)()) {
+            return true;
+        }
+    }
+
+    base::Time deadline = base::Time::now() + timeout;
+    while (true) {
+        // Register as a waiter before checking the ring a last time. The
+        // other side updates the ring before checking for waiters, so one
+        // of the two is guaranteed to see the other
+        waiting.store(1, memory_order_seq_cst);
+        uint32_t event = events.load(memory_order_seq_cst);
+        if ((this->*ready)()) {
+            waiting.store(0, memory_order_relaxed);
+            return true;
+        }
+
+        base::Time now = base::Time::now();
+        if (now >= deadline) {
+            waiting.store(0, memory_order_relaxed);
+            return false;
+        }
+        futexWait(events, event, deadline - now);
+    }
+}
+
+void RingBuffer::signal(atomic<uint32_t>& events, atomic<uint32_t>& waiting) {
+    if (waiting.load(memory_order_seq_cst)) {
+        events.fetch_add(1, memory_order_seq_cst);
+        futexWake(events);
+    }
+}
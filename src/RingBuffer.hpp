@@ -0,0 +1,132 @@
+#ifndef COMMS_PROTOBUF_RING_BUFFER_HPP
+#define COMMS_PROTOBUF_RING_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <base/Time.hpp>
+
+namespace comms_protobuf {
+    /**
+     * Lock-free single-producer single-consumer ring of bytes
+     *
+     * One thread may write while another reads, without locking. The read
+     * and write positions live on separate cache lines to avoid false
+     * sharing between the two sides. When a side has to wait, it spins for
+     * a short while and then sleeps on a futex, which the other side only
+     * signals if a waiter is registered.
+     */
+    class RingBuffer {
+    public:
+        static const size_t CACHE_LINE_SIZE = 64;
+
+        /** Number of times a waiting side polls the ring before sleeping */
+        static const int SPIN_COUNT = 1000;
+
+        /** State shared by the producer and the consumer */
+        struct Control {
+            /** Total number of bytes written. Only modified by the producer */
+            alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;
+            /** Futex word incremented by the producer to wake the consumer */
+            std::atomic<uint32_t> write_events;
+            /** Whether the producer is sleeping on read_events */
+            std::atomic<uint32_t> producer_waiting;
+
+            /** Total number of bytes read. Only modified by the consumer */
+            alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail;
+            /** Futex word incremented by the consumer to wake the producer */
+            std::atomic<uint32_t> read_events;
+            /** Whether the consumer is sleeping on write_events */
+            std::atomic<uint32_t> consumer_waiting;
+        };
+
+        /** Create a ring of at least the given capacity
+         *
+         * The capacity is rounded up to the next power of two
+         */
+        explicit RingBuffer(size_t capacity);
+
+        /** Create a ring in externally managed memory
+         *
+         * This is used to share a ring between processes. Both sides create
+         * a RingBuffer object on the same memory, only one of them
+         * initializing it.
+         *
+         * @arg memory a cache-line aligned block of at least
+         *   getMemorySize(capacity) bytes
+         * @arg capacity the ring capacity. It must be a power of two
+         * @arg initialize whether the control block should be initialized
+         */
+        RingBuffer(void* memory, size_t capacity, bool initialize);
+
+        /** Size of the memory block needed by a ring of the given capacity */
+        static size_t getMemorySize(size_t capacity);
+
+        /** The capacity of a ring created with the given requested capacity */
+        static size_t getActualCapacity(size_t capacity);
+
+        RingBuffer(RingBuffer const&) = delete;
+        RingBuffer& operator=(RingBuffer const&) = delete;
+
+        size_t getCapacity() const;
+
+        /** Number of bytes available to read */
+        size_t getSize() const;
+
+        /** Write as many bytes as possible without waiting
+         *
+         * Must only be called by the producer
+         *
+         * @return the number of bytes written
+         */
+        size_t write(uint8_t const* buffer, size_t size);
+
+        /** Read as many bytes as possible without waiting
+         *
+         * Must only be called by the consumer
+         *
+         * @return the number of bytes read
+         */
+        size_t read(uint8_t* buffer, size_t size);
+
+        /** Wait for bytes to be available to read
+         *
+         * @return false on timeout
+         */
+        bool waitRead(base::Time const& timeout);
+
+        /** Wait for room to be available to write
+         *
+         * @return false on timeout
+         */
+        bool waitWrite(base::Time const& timeout);
+
+    private:
+        std::vector<uint8_t> m_memory;
+        Control* m_control;
+        uint8_t* m_data;
+        uint64_t m_capacity;
+
+        /** Last value of the tail seen by the producer
+         *
+         * It avoids touching the consumer's cache line on every write. The
+         * padding keeps it away from the consumer's copy of the head (the
+         * object itself may not be cache-line aligned in C++11)
+         */
+        uint8_t m_producer_padding[CACHE_LINE_SIZE];
+        uint64_t m_producer_tail = 0;
+
+        /** Last value of the head seen by the consumer */
+        uint8_t m_consumer_padding[CACHE_LINE_SIZE];
+        uint64_t m_consumer_head = 0;
+
+        void setup(void* memory, bool initialize);
+        bool wait(std::atomic<uint32_t>& events, std::atomic<uint32_t>& waiting,
+                  base::Time const& timeout, bool (RingBuffer::*ready)() const);
+        void signal(std::atomic<uint32_t>& events, std::atomic<uint32_t>& waiting);
+        bool hasData() const;
+        bool hasRoom() const;
+    };
+}
+
+#endif
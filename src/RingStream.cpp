@@ -0,0 +1,45 @@
+#include <comms_protobuf/RingStream.hpp>
+#include <iodrivers_base/Exceptions.hpp>
+
+using namespace std;
+using namespace comms_protobuf;
+
+RingStream::RingStream(shared_ptr<RingBuffer> rx, shared_ptr<RingBuffer> tx)
+    : m_rx(rx)
+    , m_tx(tx) {
+}
+
+void RingStream::waitRead(base::Time const& timeout) {
+    if (!m_rx->waitRead(timeout)) {
+        throw iodrivers_base::TimeoutError(
+            iodrivers_base::TimeoutError::NONE,
+            "RingStream: no data received within the timeout"
+        );
+    }
+}
+
+void RingStream::waitWrite(base::Time const& timeout) {
+    if (!m_tx->waitWrite(timeout)) {
+        throw iodrivers_base::TimeoutError(
+            iodrivers_base::TimeoutError::NONE,
+            "RingStream: ring still full at the end of the timeout"
+        );
+    }
+}
+
+size_t RingStream::read(uint8_t* buffer, size_t buffer_size) {
+    return m_rx->read(buffer, buffer_size);
+}
+
+size_t RingStream::write(uint8_t const* buffer, size_t buffer_size) {
+    return m_tx->write(buffer, buffer_size);
+}
+
+void comms_protobuf::connectInProcess(iodrivers_base::Driver& a,
+                                      iodrivers_base::Driver& b,
+                                      size_t ring_capacity) {
+    auto a_to_b = make_shared<RingBuffer>(ring_capacity);
+    auto b_to_a = make_shared<RingBuffer>(ring_capacity);
+    a.setMainStream(new RingStream(b_to_a, a_to_b));
+    b.setMainStream(new RingStream(a_to_b, b_to_a));
+}
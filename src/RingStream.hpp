@@ -0,0 +1,38 @@
+#ifndef COMMS_PROTOBUF_RING_STREAM_HPP
+#define COMMS_PROTOBUF_RING_STREAM_HPP
+
+#include <memory>
+#include <iodrivers_base/Driver.hpp>
+#include <iodrivers_base/IOStream.hpp>
+#include <comms_protobuf/RingBuffer.hpp>
+
+namespace comms_protobuf {
+    /** IOStream reading from and writing to in-process rings
+     *
+     * Use connectInProcess to connect two channels living in the same
+     * process. Each side must be used by a single thread at a time.
+     */
+    class RingStream : public iodrivers_base::IOStream {
+        std::shared_ptr<RingBuffer> m_rx;
+        std::shared_ptr<RingBuffer> m_tx;
+
+    public:
+        RingStream(std::shared_ptr<RingBuffer> rx, std::shared_ptr<RingBuffer> tx);
+
+        void waitRead(base::Time const& timeout) override;
+        void waitWrite(base::Time const& timeout) override;
+        size_t read(uint8_t* buffer, size_t buffer_size) override;
+        size_t write(uint8_t const* buffer, size_t buffer_size) override;
+    };
+
+    /** Connect two drivers through a pair of in-process rings
+     *
+     * Each ring holds at least ring_capacity bytes. Since in-process rings
+     * cannot corrupt data, the CRC check may be disabled on channels
+     * connected this way (see Channel::setCRCCheck)
+     */
+    void connectInProcess(iodrivers_base::Driver& a, iodrivers_base::Driver& b,
+                          size_t ring_capacity);
+}
+
+#endif
@@ -0,0 +1,310 @@
+#include <comms_protobuf/SharedMemoryStream.hpp>
+
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iodrivers_base/Exceptions.hpp>
+
+using namespace std;
+using namespace comms_protobuf;
+
+namespace {
+    /** Header at the start of the shared memory segment
+     *
+     * It is followed by the server-to-client and the client-to-server
+     * rings
+     */
+    struct SegmentHeader {
+        /** Set to MAGIC by the server once the rings are initialized */
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint64_t capacity;
+    };
+
+    const uint32_t MAGIC = 0x63707368;
+    const uint32_t VERSION = 1;
+
+    size_t alignToCacheLine(size_t size) {
+        return (size + RingBuffer::CACHE_LINE_SIZE - 1) /
+               RingBuffer::CACHE_LINE_SIZE * RingBuffer::CACHE_LINE_SIZE;
+    }
+
+    size_t getHeaderSize() {
+        return alignToCacheLine(sizeof(SegmentHeader));
+    }
+
+    size_t getRingOffset(size_t capacity, int index) {
+        return getHeaderSize() +
+               index * alignToCacheLine(RingBuffer::getMemorySize(capacity));
+    }
+
+    size_t getSegmentSize(size_t capacity) {
+        return getRingOffset(capacity, 2);
+    }
+
+    /** Whether a capacity read from a segment header can be used as is
+     *
+     * It must be a power of two, and small enough for getSegmentSize not
+     * to overflow
+     */
+    bool isValidCapacity(uint64_t capacity) {
+        return capacity != 0 &&
+               capacity <= numeric_limits<size_t>::max() / 4 &&
+               RingBuffer::getActualCapacity(capacity) == capacity;
+    }
+
+    string getPath(string const& name) {
+        if (name.empty() || name.find('/') != string::npos) {
+            throw std::invalid_argument(
+                "invalid shared memory segment name '" + name + "'"
+            );
+        }
+        return "/" + name;
+    }
+
+    size_t parseCapacity(string const& value, string const& uri) {
+        size_t end = 0;
+        unsigned long long capacity = 0;
+        try {
+            if (!value.empty() && isdigit(static_cast<unsigned char>(value[0]))) {
+                capacity = stoull(value, &end);
+            }
+        }
+        catch (std::out_of_range const&) {
+            end = 0;
+        }
+        if (end == 0 || end != value.size() || capacity == 0 ||
+            capacity > numeric_limits<size_t>::max() / 4) {
+            throw std::invalid_argument(
+                "invalid capacity '" + value + "' in " + uri +
+                ", expected a strictly positive integer"
+            );
+        }
+        return capacity;
+    }
+
+    void* mapSegment(int fd, size_t size) {
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            int error = errno;
+            close(fd);
+            throw iodrivers_base::UnixError(
+                "failed to map the shared memory segment", error
+            );
+        }
+        close(fd);
+        return mapping;
+    }
+}
+
+SharedMemoryStream::SharedMemoryStream(string const& path, bool owner,
+                                       void* mapping, size_t mapping_size)
+    : m_path(path)
+    , m_owner(owner)
+    , m_mapping(mapping)
+    , m_mapping_size(mapping_size) {
+}
+
+SharedMemoryStream::~SharedMemoryStream() {
+    munmap(m_mapping, m_mapping_size);
+    if (m_owner) {
+        shm_unlink(m_path.c_str());
+    }
+}
+
+void SharedMemoryStream::setupRings(size_t capacity, bool owner) {
+    uint8_t* base = static_cast<uint8_t*>(m_mapping);
+    unique_ptr<RingBuffer> to_client(
+        new RingBuffer(base + getRingOffset(capacity, 0), capacity, owner)
+    );
+    unique_ptr<RingBuffer> to_server(
+        new RingBuffer(base + getRingOffset(capacity, 1), capacity, owner)
+    );
+    if (owner) {
+        m_rx = move(to_server);
+        m_tx = move(to_client);
+    }
+    else {
+        m_rx = move(to_client);
+        m_tx = move(to_server);
+    }
+}
+
+SharedMemoryStream* SharedMemoryStream::create(string const& name, size_t capacity,
+                                               bool replace) {
+    string path = getPath(name);
+    capacity = RingBuffer::getActualCapacity(capacity);
+    size_t size = getSegmentSize(capacity);
+
+    if (replace) {
+        shm_unlink(path.c_str());
+    }
+    int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        throw iodrivers_base::UnixError(
+            "failed to create the shared memory segment " + path
+        );
+    }
+    if (ftruncate(fd, size) != 0) {
+        int error = errno;
+        close(fd);
+        shm_unlink(path.c_str());
+        throw iodrivers_base::UnixError(
+            "failed to resize the shared memory segment " + path, error
+        );
+    }
+
+    void* mapping;
+    try {
+        mapping = mapSegment(fd, size);
+    }
+    catch (...) {
+        shm_unlink(path.c_str());
+        throw;
+    }
+
+    unique_ptr<SharedMemoryStream> stream(
+        new SharedMemoryStream(path, true, mapping, size)
+    );
+    stream->setupRings(capacity, true);
+
+    SegmentHeader* header = new(mapping) SegmentHeader();
+    header->version = VERSION;
+    header->capacity = capacity;
+    header->magic.store(MAGIC, memory_order_release);
+    return stream.release();
+}
+
+SharedMemoryStream* SharedMemoryStream::attach(string const& name) {
+    string path = getPath(name);
+    int fd = shm_open(path.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        throw iodrivers_base::UnixError(
+            "failed to open the shared memory segment " + path
+        );
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        int error = errno;
+        close(fd);
+        throw iodrivers_base::UnixError(
+            "failed to get the size of the shared memory segment " + path, error
+        );
+    }
+    size_t size = info.st_size;
+    if (size < getHeaderSize()) {
+        close(fd);
+        throw std::runtime_error(
+            "shared memory segment " + path + " is not initialized"
+        );
+    }
+
+    unique_ptr<SharedMemoryStream> stream(
+        new SharedMemoryStream(path, false, mapSegment(fd, size), size)
+    );
+    SegmentHeader* header = static_cast<SegmentHeader*>(stream->m_mapping);
+    if (header->magic.load(memory_order_acquire) != MAGIC) {
+        throw std::runtime_error(
+            "shared memory segment " + path + " is not initialized"
+        );
+    }
+    else if (header->version != VERSION) {
+        throw std::runtime_error(
+            "shared memory segment " + path + " has an unsupported version"
+        );
+    }
+    else if (!isValidCapacity(header->capacity)) {
+        throw std::runtime_error(
+            "shared memory segment " + path + " has an invalid capacity"
+        );
+    }
+    else if (getSegmentSize(header->capacity) > size) {
+        throw std::runtime_error(
+            "shared memory segment " + path + " is smaller than expected"
+        );
+    }
+
+    stream->setupRings(header->capacity, false);
+    return stream.release();
+}
+
+SharedMemoryStream* SharedMemoryStream::openURI(string const& uri) {
+    static const string SERVER_SCHEME = "shmserver://";
+    static const string CLIENT_SCHEME = "shm://";
+
+    if (uri.compare(0, CLIENT_SCHEME.size(), CLIENT_SCHEME) == 0) {
+        return attach(uri.substr(CLIENT_SCHEME.size()));
+    }
+    else if (uri.compare(0, SERVER_SCHEME.size(), SERVER_SCHEME) != 0) {
+        return nullptr;
+    }
+
+    string name = uri.substr(SERVER_SCHEME.size());
+    size_t capacity = DEFAULT_CAPACITY;
+    bool replace = false;
+    size_t options = name.find('?');
+    if (options != string::npos) {
+        static const string CAPACITY_OPTION = "capacity=";
+        static const string REPLACE_OPTION = "replace=";
+        string all_options = name.substr(options + 1);
+        name = name.substr(0, options);
+
+        size_t start = 0;
+        while (start <= all_options.size()) {
+            size_t end = all_options.find('&', start);
+            if (end == string::npos) {
+                end = all_options.size();
+            }
+            string option = all_options.substr(start, end - start);
+            start = end + 1;
+
+            if (option.compare(0, CAPACITY_OPTION.size(), CAPACITY_OPTION) == 0) {
+                capacity = parseCapacity(option.substr(CAPACITY_OPTION.size()), uri);
+            }
+            else if (option == REPLACE_OPTION + "0" || option == REPLACE_OPTION + "1") {
+                replace = (option.back() == '1');
+            }
+            else {
+                throw std::invalid_argument(
+                    "unknown option '" + option + "' in " + uri
+                );
+            }
+        }
+    }
+    return create(name, capacity, replace);
+}
+
+void SharedMemoryStream::waitRead(base::Time const& timeout) {
+    if (!m_rx->waitRead(timeout)) {
+        throw iodrivers_base::TimeoutError(
+            iodrivers_base::TimeoutError::NONE,
+            "SharedMemoryStream: no data received within the timeout"
+        );
+    }
+}
+
+void SharedMemoryStream::waitWrite(base::Time const& timeout) {
+    if (!m_tx->waitWrite(timeout)) {
+        throw iodrivers_base::TimeoutError(
+            iodrivers_base::TimeoutError::NONE,
+            "SharedMemoryStream: ring still full at the end of the timeout"
+        );
+    }
+}
+
+size_t SharedMemoryStream::read(uint8_t* buffer, size_t buffer_size) {
+    return m_rx->read(buffer, buffer_size);
+}
+
+size_t SharedMemoryStream::write(uint8_t const* buffer, size_t buffer_size) {
+    return m_tx->write(buffer, buffer_size);
+}
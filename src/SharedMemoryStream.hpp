@@ -0,0 +1,78 @@
+#ifndef COMMS_PROTOBUF_SHARED_MEMORY_STREAM_HPP
+#define COMMS_PROTOBUF_SHARED_MEMORY_STREAM_HPP
+
+#include <memory>
+#include <string>
+#include <iodrivers_base/IOStream.hpp>
+#include <comms_protobuf/RingBuffer.hpp>
+
+namespace comms_protobuf {
+    /** IOStream exchanging data with another process through a POSIX
+     * shared memory segment
+     *
+     * The segment holds two RingBuffer, one per direction. One side creates
+     * the segment (shmserver:// URIs), the other attaches to it (shm://
+     * URIs). Each side must be used by a single thread at a time.
+     */
+    class SharedMemoryStream : public iodrivers_base::IOStream {
+    public:
+        /** Default capacity of each ring */
+        static const size_t DEFAULT_CAPACITY = 1 << 20;
+
+        /** Create a segment
+         *
+         * The segment is removed when the stream is destroyed
+         *
+         * @arg name the segment name, without the leading slash
+         * @arg capacity the minimum capacity of each ring
+         * @arg replace if true, an existing segment of the same name is
+         *   removed first, e.g. one left over by a process that did not
+         *   terminate cleanly. Otherwise, creation fails if the segment
+         *   exists, since it might be in use by another server
+         * @throw iodrivers_base::UnixError, with EEXIST if the segment
+         *   exists and replace is false
+         */
+        static SharedMemoryStream* create(std::string const& name,
+                                          size_t capacity = DEFAULT_CAPACITY,
+                                          bool replace = false);
+
+        /** Attach to a segment created by create()
+         *
+         * @arg name the segment name, without the leading slash
+         */
+        static SharedMemoryStream* attach(std::string const& name);
+
+        /** Create a stream from a shmserver://name[?options] or shm://name
+         * URI
+         *
+         * The options of shmserver:// are separated by '&'. capacity=N sets
+         * the capacity of each ring, and replace=1 replaces an existing
+         * segment (see create())
+         *
+         * @return the stream, or null if the URI is not a shared memory URI
+         * @throw std::invalid_argument if the options are invalid
+         */
+        static SharedMemoryStream* openURI(std::string const& uri);
+
+        ~SharedMemoryStream();
+
+        void waitRead(base::Time const& timeout) override;
+        void waitWrite(base::Time const& timeout) override;
+        size_t read(uint8_t* buffer, size_t buffer_size) override;
+        size_t write(uint8_t const* buffer, size_t buffer_size) override;
+
+    private:
+        std::string m_path;
+        bool m_owner;
+        void* m_mapping;
+        size_t m_mapping_size;
+        std::unique_ptr<RingBuffer> m_rx;
+        std::unique_ptr<RingBuffer> m_tx;
+
+        SharedMemoryStream(std::string const& path, bool owner,
+                           void* mapping, size_t mapping_size);
+        void setupRings(size_t capacity, bool owner);
+    };
+}
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef COMMS_PROTOBUF_STATS_HPP
+#define COMMS_PROTOBUF_STATS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+
+namespace comms_protobuf {
+    /** Statistics about the activity of a channel
+     *
+     * All the statistics may be polled from another thread while the
+     * channel is used. Define COMMS_PROTOBUF_DISABLE_STATS to compile out
+     * their recording and the storage of the histograms. The statistics
+     * are header-only, so that the define only needs to be set when
+     * building the code that uses the channels. It changes the layout of
+     * the channels, and must therefore be consistent across a program.
+     */
+    namespace stats {
+#ifdef COMMS_PROTOBUF_DISABLE_STATS
+        static const bool ENABLED = false;
+#else
+        static const bool ENABLED = true;
+#endif
+
+        /** A monotonic counter */
+        class Counter {
+        public:
+            void add(uint64_t value = 1) {
+                if (ENABLED) {
+                    m_value.fetch_add(value, std::memory_order_relaxed);
+                }
+            }
+
+            uint64_t get() const {
+                return m_value.load(std::memory_order_relaxed);
+            }
+
+            void reset() {
+                m_value.store(0, std::memory_order_relaxed);
+            }
+
+        private:
+            std::atomic<uint64_t> m_value{0};
+        };
+
+        /** A histogram of durations with a bounded relative error
+         *
+         * In the spirit of HDR histograms, each power of two is split in
+         * SUB_BUCKET_COUNT linear buckets. Values are reported with a
+         * relative error of at most 1 / SUB_BUCKET_COUNT. Durations are
+         * recorded in nanoseconds, up to 2^(MAX_EXPONENT + 1) - 1 ns (about
+         * 36 minutes). Bigger values are counted in the last bucket.
+         */
+        class LatencyHistogram {
+        public:
+            static const int SUB_BUCKET_BITS = 3;
+            static const uint64_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+            static const int MAX_EXPONENT = 40;
+            static const size_t BUCKET_COUNT =
+                (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKET_COUNT;
+
+            void record(uint64_t duration_ns) {
+                if (!ENABLED) {
+                    return;
+                }
+                m_buckets[getBucketIndex(duration_ns)].fetch_add(
+                    1, std::memory_order_relaxed
+                );
+                m_count.fetch_add(1, std::memory_order_relaxed);
+                m_sum.fetch_add(duration_ns, std::memory_order_relaxed);
+                uint64_t max = m_max.load(std::memory_order_relaxed);
+                while (duration_ns > max &&
+                       !m_max.compare_exchange_weak(max, duration_ns,
+                                                    std::memory_order_relaxed)) {
+                }
+            }
+
+            /** Number of recorded durations */
+            uint64_t getCount() const {
+                return m_count.load(std::memory_order_relaxed);
+            }
+
+            /** Sum of the recorded durations, in nanoseconds */
+            uint64_t getSum() const {
+                return m_sum.load(std::memory_order_relaxed);
+            }
+
+            /** Longest recorded duration, in nanoseconds */
+            uint64_t getMax() const {
+                return m_max.load(std::memory_order_relaxed);
+            }
+
+            /** Duration below which the given fraction of the recorded
+             * durations are, in nanoseconds
+             *
+             * @arg quantile between 0 and 1, e.g. 0.99 for the 99th
+             *   percentile
+             * @return the highest value of the matching bucket, or zero if
+             *   no durations have been recorded
+             */
+            uint64_t getQuantile(double quantile) const {
+                // The buckets are read one by one, use their sum rather than
+                // m_count to get a consistent result while other threads
+                // record durations
+                uint64_t counts[STORED_BUCKET_COUNT];
+                uint64_t total = 0;
+                for (size_t i = 0; i < STORED_BUCKET_COUNT; ++i) {
+                    counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+                    total += counts[i];
+                }
+                if (!ENABLED || !total) {
+                    return 0;
+                }
+
+                uint64_t rank = std::max<uint64_t>(1, std::ceil(quantile * total));
+                uint64_t cumulated = 0;
+                for (size_t i = 0; i < STORED_BUCKET_COUNT - 1; ++i) {
+                    cumulated += counts[i];
+                    if (cumulated >= rank) {
+                        return getBucketLowerBound(i + 1) - 1;
+                    }
+                }
+                return getMax();
+            }
+
+            void reset() {
+                for (auto& bucket : m_buckets) {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+                m_count.store(0, std::memory_order_relaxed);
+                m_sum.store(0, std::memory_order_relaxed);
+                m_max.store(0, std::memory_order_relaxed);
+            }
+
+            /** Index of the bucket containing the given value */
+            static size_t getBucketIndex(uint64_t value) {
+                if (value < SUB_BUCKET_COUNT) {
+                    return value;
+                }
+
+                int exponent = 63 - __builtin_clzll(value);
+                if (exponent > MAX_EXPONENT) {
+                    return BUCKET_COUNT - 1;
+                }
+                uint64_t sub_bucket =
+                    (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+                return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + sub_bucket;
+            }
+
+            /** Smallest value of the given bucket */
+            static uint64_t getBucketLowerBound(size_t index) {
+                if (index < SUB_BUCKET_COUNT) {
+                    return index;
+                }
+
+                int exponent = index / SUB_BUCKET_COUNT + SUB_BUCKET_BITS - 1;
+                uint64_t sub_bucket = index % SUB_BUCKET_COUNT;
+                return (SUB_BUCKET_COUNT + sub_bucket) << (exponent - SUB_BUCKET_BITS);
+            }
+
+        private:
+            /** Only allocate the buckets if statistics are enabled */
+            static const size_t STORED_BUCKET_COUNT = ENABLED ? BUCKET_COUNT : 1;
+
+            std::atomic<uint64_t> m_buckets[STORED_BUCKET_COUNT] = {};
+            std::atomic<uint64_t> m_count{0};
+            std::atomic<uint64_t> m_sum{0};
+            std::atomic<uint64_t> m_max{0};
+        };
+
+        /** Records the time between its construction and destruction in a
+         * histogram
+         *
+         * pause() and resume() exclude a part of the scope, e.g. blocking
+         * I/O, from the recorded duration
+         */
+        class ScopedTimer {
+        public:
+            explicit ScopedTimer(LatencyHistogram& histogram)
+                : m_histogram(histogram) {
+                resume();
+            }
+
+            ~ScopedTimer() {
+                if (ENABLED) {
+                    pause();
+                    m_histogram.record(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            m_elapsed
+                        ).count()
+                    );
+                }
+            }
+
+            void pause() {
+                if (ENABLED) {
+                    m_elapsed += std::chrono::steady_clock::now() - m_start;
+                }
+            }
+
+            void resume() {
+                if (ENABLED) {
+                    m_start = std::chrono::steady_clock::now();
+                }
+            }
+
+            ScopedTimer(ScopedTimer const&) = delete;
+            ScopedTimer& operator=(ScopedTimer const&) = delete;
+
+        private:
+            LatencyHistogram& m_histogram;
+            std::chrono::steady_clock::time_point m_start;
+            std::chrono::steady_clock::duration m_elapsed =
+                std::chrono::steady_clock::duration::zero();
+        };
+    }
+
+    /** Statistics of a Channel, see Channel::getStats */
+    struct ChannelStats {
+        /** Frames generated by the channel */
+        stats::Counter frames_sent;
+        /** Size of the frames generated by the channel */
+        stats::Counter bytes_sent;
+        /** Frames successfully extracted from the byte stream */
+        stats::Counter frames_received;
+        /** Size of the frames extracted from the byte stream */
+        stats::Counter bytes_received;
+        /** Bytes dropped while looking for the start of a frame, including
+         * the bytes of the rejected frames
+         */
+        stats::Counter bytes_skipped;
+        /** Frames rejected because of a bad CRC */
+        stats::Counter crc_failures;
+        /** Frames rejected because their length field is invalid or bigger
+         * than the maximum payload size
+         */
+        stats::Counter oversize_rejections;
+        /** Frames whose payload could not be decrypted or authenticated */
+        stats::Counter decrypt_failures;
+        /** Messages that could not be decoded once the frame was extracted
+         * and decrypted
+         */
+        stats::Counter parse_failures;
+
+        /** Time to encode a message (serialization, compression, framing
+         * and encryption)
+         */
+        stats::LatencyHistogram encode_time;
+        /** Time spent encrypting frames */
+        stats::LatencyHistogram encrypt_time;
+        /** Time spent decrypting frames */
+        stats::LatencyHistogram decrypt_time;
+        /** Time to decode a message from its decrypted bytes */
+        stats::LatencyHistogram parse_time;
+
+        /** Reset all counters and histograms
+         *
+         * Not atomic with respect to concurrent updates
+         */
+        void reset() {
+            for (stats::Counter* counter : {
+                    &frames_sent, &bytes_sent, &frames_received, &bytes_received,
+                    &bytes_skipped, &crc_failures, &oversize_rejections,
+                    &decrypt_failures, &parse_failures }) {
+                counter->reset();
+            }
+            for (stats::LatencyHistogram* histogram : {
+                    &encode_time, &encrypt_time, &decrypt_time, &parse_time }) {
+                histogram->reset();
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,28 @@
+#include <comms_protobuf/Protocol.hpp>
+
+#include <iostream>
+#include <iterator>
+
+using namespace std;
+using namespace comms_protobuf;
+
+int main(int argc, char**) {
+    if (argc != 1) {
+        cerr << "usage: comms_protobuf_derive_key < PSK_FILE\n"
+             << "\n"
+             << "Reads a PSK on standard input and writes the derived key\n"
+             << "in hexadecimal on standard output. A single trailing newline\n"
+             << "is removed from the PSK. Pass the result to\n"
+             << "protocol::parseKey and Channel::setEncryptionKey to avoid\n"
+             << "the key derivation cost at runtime." << endl;
+        return 1;
+    }
+
+    string psk((istreambuf_iterator<char>(cin)), istreambuf_iterator<char>());
+    if (!psk.empty() && psk.back() == '\n') {
+        psk.pop_back();
+    }
+
+    cout << protocol::formatKey(protocol::deriveKey(psk)) << endl;
+    return 0;
+}
@@ -0,0 +1,92 @@
+#ifndef COMMS_PROTOBUF_TEST_ADVERSARIAL_STREAMS_HPP
+#define COMMS_PROTOBUF_TEST_ADVERSARIAL_STREAMS_HPP
+
+#include <comms_protobuf/Protocol.hpp>
+#include <random>
+#include <vector>
+
+/** Generation of worst-case input streams for the frame extraction */
+namespace adversarial_streams {
+    enum Kind {
+        /** Uniformly random bytes */
+        NOISE,
+        /** Back-to-back SYNC_0 SYNC_1 pairs */
+        SYNC_FLOOD,
+        /** Frame starts followed by length fields that never terminate */
+        LONG_VARINTS,
+        /** Frame starts announcing the maximum payload size, repeated more
+         * often than the announced frame size. Each one needs a full CRC
+         * computation before being rejected
+         */
+        TRUNCATED_MAX_FRAMES,
+        /** Valid frames separated by random noise */
+        NOISY_FRAMES,
+        KIND_COUNT
+    };
+
+    inline char const* getName(Kind kind) {
+        static char const* names[] = {
+            "noise", "sync_flood", "long_varints", "truncated_max_frames",
+            "noisy_frames"
+        };
+        return names[kind];
+    }
+
+    inline std::vector<uint8_t> generate(Kind kind, size_t size,
+                                         size_t max_payload_size) {
+        using namespace comms_protobuf;
+
+        std::minstd_rand random(kind);
+        std::vector<uint8_t> stream;
+        stream.reserve(size + max_payload_size + 16);
+        while (stream.size() < size) {
+            switch (kind) {
+                case NOISE:
+                    stream.push_back(random());
+                    break;
+                case SYNC_FLOOD:
+                    stream.push_back(protocol::SYNC_0);
+                    stream.push_back(protocol::SYNC_1);
+                    break;
+                case LONG_VARINTS:
+                    stream.push_back(protocol::SYNC_0);
+                    stream.push_back(protocol::SYNC_1);
+                    stream.insert(stream.end(), 8, 0xFF);
+                    break;
+                case TRUNCATED_MAX_FRAMES: {
+                    uint8_t header[16] = { protocol::SYNC_0, protocol::SYNC_1 };
+                    uint8_t* end = protocol::encodeLength(
+                        header + 2, header + sizeof(header), max_payload_size
+                    );
+                    stream.insert(stream.end(), header, end);
+                    for (int i = 0; i < 16; ++i) {
+                        stream.push_back(random() & 0x7F);
+                    }
+                    break;
+                }
+                case NOISY_FRAMES: {
+                    std::vector<uint8_t> payload(random() % max_payload_size);
+                    for (auto& b : payload) {
+                        b = random();
+                    }
+                    std::vector<uint8_t> frame(protocol::getFrameSize(payload.size()));
+                    protocol::encodeFrame(frame.data(), frame.data() + frame.size(),
+                                          payload.data(),
+                                          payload.data() + payload.size());
+                    stream.insert(stream.end(), frame.begin(), frame.end());
+                    size_t noise = random() % 32;
+                    for (size_t i = 0; i < noise; ++i) {
+                        stream.push_back(random());
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+        stream.resize(size);
+        return stream;
+    }
+}
+
+#endif
@@ -0,0 +1,437 @@
+#include <benchmark/benchmark.h>
+#include "test.pb.h"
+#include "adversarial_streams.hpp"
+#include <comms_protobuf/Channel.hpp>
+#include <comms_protobuf/FrameLogReplayer.hpp>
+#include <comms_protobuf/RingStream.hpp>
+#include <iodrivers_base/TestStream.hpp>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+using namespace std;
+using namespace comms_protobuf;
+
+static const size_t MAX_PAYLOAD_SIZE = 65536 + 64;
+
+static void payloadSizes(benchmark::internal::Benchmark* b) {
+    b->RangeMultiplier(4)->Range(16, 65536);
+}
+
+static vector<uint8_t> makePayload(size_t size) {
+    vector<uint8_t> payload(size);
+    for (size_t i = 0; i < size; ++i) {
+        payload[i] = i * 7;
+    }
+    return payload;
+}
+
+static vector<uint8_t> makeFrame(size_t payload_size) {
+    auto payload = makePayload(payload_size);
+    vector<uint8_t> frame(protocol::getFrameSize(payload_size));
+    protocol::encodeFrame(&frame[0], &frame[0] + frame.size(),
+                          payload.data(), payload.data() + payload.size());
+    return frame;
+}
+
+static void reportThroughput(benchmark::State& state, size_t bytes_per_message) {
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * bytes_per_message);
+}
+
+static protocol::CipherContext& getCipherContext(
+    protocol::CipherAlgorithm algorithm = protocol::AES_256_GCM
+) {
+    static protocol::CipherContext aes("benchmark", protocol::AES_256_GCM);
+    static protocol::CipherContext chacha("benchmark", protocol::CHACHA20_POLY1305);
+    return algorithm == protocol::AES_256_GCM ? aes : chacha;
+}
+
+/** Payload sizes, and cipher algorithms */
+static void cipherArguments(benchmark::internal::Benchmark* b) {
+    b->ArgsProduct({ benchmark::CreateRange(16, 65536, 4),
+                     { protocol::AES_256_GCM, protocol::CHACHA20_POLY1305 } });
+}
+
+static void BM_CRC(benchmark::State& state) {
+    auto payload = makePayload(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            protocol::crc(payload.data(), payload.data() + payload.size())
+        );
+    }
+    reportThroughput(state, payload.size());
+}
+BENCHMARK(BM_CRC)->Apply(payloadSizes);
+
+static void BM_EncodeFrame(benchmark::State& state) {
+    auto payload = makePayload(state.range(0));
+    vector<uint8_t> frame(protocol::getFrameSize(payload.size()));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(protocol::encodeFrame(
+            &frame[0], &frame[0] + frame.size(),
+            payload.data(), payload.data() + payload.size()
+        ));
+    }
+    reportThroughput(state, payload.size());
+}
+BENCHMARK(BM_EncodeFrame)->Apply(payloadSizes);
+
+static void BM_ExtractPacket(benchmark::State& state) {
+    auto frame = makeFrame(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            protocol::extractPacket(frame.data(), frame.size(), MAX_PAYLOAD_SIZE)
+        );
+    }
+    reportThroughput(state, frame.size());
+}
+BENCHMARK(BM_ExtractPacket)->Apply(payloadSizes);
+
+/** Extract all frames from a stream in which the given percentage of frames
+ * has been corrupted, the way iodrivers_base::Driver does it
+ */
+static void BM_ExtractPacketFromCorruptedStream(benchmark::State& state) {
+    size_t const frame_count = 1000;
+    auto frame = makeFrame(state.range(0));
+    vector<uint8_t> stream;
+    for (size_t i = 0; i < frame_count; ++i) {
+        size_t start = stream.size();
+        stream.insert(stream.end(), frame.begin(), frame.end());
+        if (i * 100 < frame_count * state.range(1)) {
+            stream[start + 2 + i % (frame.size() - 2)] ^= 0x10;
+        }
+    }
+
+    for (auto _ : state) {
+        size_t offset = 0;
+        while (offset < stream.size()) {
+            int result = protocol::extractPacket(
+                &stream[offset], stream.size() - offset, MAX_PAYLOAD_SIZE
+            );
+            if (result == 0) {
+                break;
+            }
+            offset += result > 0 ? result : -result;
+        }
+        benchmark::DoNotOptimize(offset);
+    }
+    state.SetItemsProcessed(state.iterations() * frame_count);
+    state.SetBytesProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(BM_ExtractPacketFromCorruptedStream)
+    ->ArgsProduct({ { 16, 256, 4096 }, { 0, 1, 10, 50 } });
+
+static void BM_Encrypt(benchmark::State& state) {
+    auto& ctx = getCipherContext(
+        static_cast<protocol::CipherAlgorithm>(state.range(1))
+    );
+    auto payload = makePayload(state.range(0));
+    vector<uint8_t> ciphertext(
+        protocol::CipherContext::getMaxCiphertextLength(payload.size())
+    );
+    protocol::aes_tag tag;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(protocol::encrypt(
+            ctx, ctx.nextIV(), ciphertext.data(), tag,
+            payload.data(), payload.size()
+        ));
+    }
+    reportThroughput(state, payload.size());
+}
+BENCHMARK(BM_Encrypt)->Apply(cipherArguments);
+
+static void BM_Decrypt(benchmark::State& state) {
+    auto& ctx = getCipherContext(
+        static_cast<protocol::CipherAlgorithm>(state.range(1))
+    );
+    auto payload = makePayload(state.range(0));
+    vector<uint8_t> ciphertext(
+        protocol::CipherContext::getMaxCiphertextLength(payload.size())
+    );
+    protocol::aes_tag tag;
+    auto iv = ctx.nextIV();
+    size_t ciphertext_length = protocol::encrypt(
+        ctx, iv, ciphertext.data(), tag, payload.data(), payload.size()
+    );
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(protocol::decrypt(
+            ctx, iv, payload.data(), ciphertext.data(), ciphertext_length, tag
+        ));
+    }
+    reportThroughput(state, payload.size());
+}
+BENCHMARK(BM_Decrypt)->Apply(cipherArguments);
+
+struct BenchmarkChannel : public Channel<test_channel::Local, test_channel::Local> {
+    BenchmarkChannel()
+        : Channel<test_channel::Local, test_channel::Local>(MAX_PAYLOAD_SIZE) {
+    }
+};
+
+/** Encode a message on one side and read it on the other through the test
+ * stream
+ *
+ * Arguments are the message payload size and whether encryption is enabled
+ */
+static void BM_ChannelRoundTrip(benchmark::State& state) {
+    BenchmarkChannel sender;
+    BenchmarkChannel channel;
+    if (state.range(1)) {
+        sender.setEncryptionKey("benchmark");
+        channel.setEncryptionKey("benchmark");
+    }
+    channel.openURI("test://");
+    auto stream = dynamic_cast<iodrivers_base::TestStream*>(channel.getMainStream());
+
+    test_channel::Local local;
+    local.set_something_else(string(state.range(0), 'a'));
+    test_channel::Local received;
+    vector<uint8_t> frame;
+    for (auto _ : state) {
+        frame.clear();
+        sender.appendFrame(frame, local);
+        stream->pushDataToDriver(frame);
+        channel.read(received);
+    }
+    reportThroughput(state, state.range(0));
+}
+BENCHMARK(BM_ChannelRoundTrip)
+    ->ArgsProduct({ benchmark::CreateRange(16, 65536, 4), { 0, 1 } });
+
+/** Write a message and read it back through in-process rings
+ *
+ * Arguments are the message payload size and whether the CRC is verified
+ * by the receiving side
+ */
+static void BM_InProcessRoundTrip(benchmark::State& state) {
+    BenchmarkChannel sender;
+    BenchmarkChannel receiver;
+    connectInProcess(sender, receiver, 4 * MAX_PAYLOAD_SIZE);
+    receiver.setCRCCheck(state.range(1));
+
+    test_channel::Local local;
+    local.set_something_else(string(state.range(0), 'a'));
+    test_channel::Local received;
+    for (auto _ : state) {
+        sender.write(local);
+        receiver.read(received);
+    }
+    reportThroughput(state, state.range(0));
+}
+BENCHMARK(BM_InProcessRoundTrip)
+    ->ArgsProduct({ benchmark::CreateRange(16, 65536, 4), { 1, 0 } });
+
+template<typename Framing, typename Integrity, typename Cipher>
+struct SmallChannel : public Channel<test_channel::Local, test_channel::Local,
+                                     Framing, Integrity, Cipher> {
+    SmallChannel()
+        : Channel<test_channel::Local, test_channel::Local,
+                  Framing, Integrity, Cipher>(255) {
+    }
+};
+
+/** Write a small message and read it back through in-process rings, with
+ * the given channel policies
+ *
+ * The argument is the message payload size
+ */
+template<typename Framing, typename Integrity, typename Cipher>
+static void BM_PolicyRoundTrip(benchmark::State& state) {
+    SmallChannel<Framing, Integrity, Cipher> sender;
+    SmallChannel<Framing, Integrity, Cipher> receiver;
+    connectInProcess(sender, receiver, 4096);
+
+    test_channel::Local local;
+    local.set_something_else(string(state.range(0), 'a'));
+    test_channel::Local received;
+    for (auto _ : state) {
+        sender.write(local);
+        receiver.read(received);
+    }
+    reportThroughput(state, state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_PolicyRoundTrip, policies::VarintFraming,
+                   policies::CRC16Integrity, policies::RuntimeCipher)
+    ->Arg(16)->Arg(200);
+BENCHMARK_TEMPLATE(BM_PolicyRoundTrip, policies::FixedWidthFraming<1>,
+                   policies::CRC16Integrity, policies::NoCipher)
+    ->Arg(16)->Arg(200);
+BENCHMARK_TEMPLATE(BM_PolicyRoundTrip, policies::FixedWidthFraming<1>,
+                   policies::NoIntegrity, policies::NoCipher)
+    ->Arg(16)->Arg(200);
+
+/** Write a message and read it back through a shared memory segment
+ *
+ * The argument is the message payload size
+ */
+static void BM_SharedMemoryRoundTrip(benchmark::State& state) {
+    BenchmarkChannel server;
+    BenchmarkChannel client;
+    string name = "comms_protobuf_benchmark_" + to_string(getpid());
+    server.openURI("shmserver://" + name);
+    client.openURI("shm://" + name);
+
+    test_channel::Local local;
+    local.set_something_else(string(state.range(0), 'a'));
+    test_channel::Local received;
+    for (auto _ : state) {
+        client.write(local);
+        server.read(received);
+    }
+    reportThroughput(state, state.range(0));
+}
+BENCHMARK(BM_SharedMemoryRoundTrip)->Apply(payloadSizes);
+
+/** Replay a 64 MiB frame log into a channel, as fast as possible
+ *
+ * The argument is the message payload size
+ */
+static void BM_FrameLogReplay(benchmark::State& state) {
+    string path = "/tmp/comms_protobuf_benchmark_" + to_string(getpid()) + ".log";
+    test_channel::Local local;
+    local.set_data(string(state.range(0), 'a'));
+    string payload = local.SerializeAsString();
+    vector<uint8_t> frame(protocol::getFrameSize(payload.size()));
+    uint8_t const* begin = reinterpret_cast<uint8_t const*>(payload.data());
+    protocol::encodeFrame(&frame[0], &frame[0] + frame.size(),
+                          begin, begin + payload.size());
+
+    size_t count = (64 << 20) / frame.size();
+    {
+        FrameLogWriter writer(path);
+        for (size_t i = 0; i < count; ++i) {
+            writer.append(base::Time::fromMicroseconds(i), frame.data(), frame.size());
+        }
+    }
+
+    FrameLogReader reader(path);
+    BenchmarkChannel channel;
+    FrameLogReplayer<test_channel::Local, test_channel::Local> replayer(reader, channel);
+    for (auto _ : state) {
+        reader.rewind();
+        replayer.replay([](test_channel::Local const& message, base::Time const&) {
+            benchmark::DoNotOptimize(message.data().size());
+        });
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    state.SetBytesProcessed(state.iterations() * count * frame.size());
+    unlink(path.c_str());
+    unlink((path + frame_log::INDEX_SUFFIX).c_str());
+}
+BENCHMARK(BM_FrameLogReplay)->Arg(16)->Arg(1024)->Arg(65536)
+    ->Unit(benchmark::kMillisecond);
+
+/** Channel that measures the work done by the extraction loop
+ *
+ * The max message size is the one of a low-bandwidth radio link
+ */
+struct ReplayChannel : public Channel<test_channel::Local, test_channel::Local> {
+    static const size_t MAX_MESSAGE_SIZE = 1024;
+
+    /** Number of extractPacket calls */
+    mutable uint64_t extract_calls = 0;
+
+    ReplayChannel()
+        : Channel<test_channel::Local, test_channel::Local>(MAX_MESSAGE_SIZE) {
+    }
+
+    int extractPacket(uint8_t const* buffer, size_t size) const {
+        extract_calls++;
+        return protocol::extractPacket(buffer, size, MAX_MESSAGE_SIZE);
+    }
+
+    /** Read frames until the available bytes are exhausted */
+    size_t readAvailablePackets(vector<uint8_t>& buffer) {
+        size_t count = 0;
+        try {
+            while (true) {
+                readPacket(buffer.data(), buffer.size(), base::Time(), base::Time());
+                count++;
+            }
+        }
+        catch (iodrivers_base::TimeoutError const&) {
+        }
+        return count;
+    }
+};
+
+/** Feed a stream through the iodrivers_base extraction loop, in chunks as
+ * a radio would deliver them
+ *
+ * Reports the throughput, the extracted frames, the number of
+ * extractPacket calls per stream byte and the worst time spent on a single
+ * chunk, per byte
+ */
+static void benchmarkReplay(benchmark::State& state, vector<uint8_t> const& stream) {
+    size_t const chunk_size = 1024;
+    uint64_t frames = 0;
+    uint64_t extract_calls = 0;
+    double worst_ns_per_byte = 0;
+    for (auto _ : state) {
+        ReplayChannel channel;
+        channel.openURI("test://");
+        auto test_stream =
+            dynamic_cast<iodrivers_base::TestStream*>(channel.getMainStream());
+        vector<uint8_t> buffer(channel.getMaxPacketSize());
+        for (size_t offset = 0; offset < stream.size(); offset += chunk_size) {
+            size_t end = std::min(stream.size(), offset + chunk_size);
+            auto start = std::chrono::steady_clock::now();
+            test_stream->pushDataToDriver(
+                vector<uint8_t>(stream.begin() + offset, stream.begin() + end)
+            );
+            frames += channel.readAvailablePackets(buffer);
+            auto duration = std::chrono::steady_clock::now() - start;
+            double ns_per_byte =
+                std::chrono::duration<double, std::nano>(duration).count() /
+                (end - offset);
+            worst_ns_per_byte = std::max(worst_ns_per_byte, ns_per_byte);
+        }
+        extract_calls += channel.extract_calls;
+    }
+    state.SetBytesProcessed(state.iterations() * stream.size());
+    state.counters["frames"] = benchmark::Counter(
+        frames, benchmark::Counter::kAvgIterations
+    );
+    state.counters["calls_per_byte"] = static_cast<double>(extract_calls) /
+                                      (state.iterations() * stream.size());
+    state.counters["worst_ns_per_byte"] = worst_ns_per_byte;
+}
+
+/** Replay a synthetic adversarial stream, see adversarial_streams::Kind */
+static void BM_AdversarialStream(benchmark::State& state) {
+    auto kind = static_cast<adversarial_streams::Kind>(state.range(0));
+    state.SetLabel(adversarial_streams::getName(kind));
+    auto stream = adversarial_streams::generate(
+        kind, 1 << 20, ReplayChannel::MAX_MESSAGE_SIZE
+    );
+    benchmarkReplay(state, stream);
+}
+BENCHMARK(BM_AdversarialStream)
+    ->DenseRange(0, adversarial_streams::KIND_COUNT - 1);
+
+/** Replay a stream recorded from a real link
+ *
+ * Set COMMS_PROTOBUF_REPLAY_STREAM to the path of the raw recording to
+ * enable this benchmark
+ */
+static bool registerRecordedStream() {
+    char const* path = getenv("COMMS_PROTOBUF_REPLAY_STREAM");
+    if (!path) {
+        return false;
+    }
+
+    ifstream file(path, ios::binary);
+    vector<uint8_t> stream((istreambuf_iterator<char>(file)),
+                           istreambuf_iterator<char>());
+    benchmark::RegisterBenchmark(
+        "BM_RecordedStream",
+        [stream](benchmark::State& state) { benchmarkReplay(state, stream); }
+    );
+    return true;
+}
+static bool recorded_stream_registered = registerRecordedStream();
+
+BENCHMARK_MAIN();
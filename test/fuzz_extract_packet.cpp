@@ -0,0 +1,93 @@
+/** libFuzzer target for the frame extraction
+ *
+ * The first three bytes of the input select the maximum payload size and
+ * whether the CRC is checked. The rest is processed the way
+ * iodrivers_base::Driver does, checking the invariants of extractPacket,
+ * parseLength and getPayload on the way.
+ *
+ * The target is also linked in the test suite, which runs it on
+ * adversarial streams
+ */
+
+#include <comms_protobuf/Protocol.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+using namespace comms_protobuf;
+
+static void check(bool condition) {
+    if (!condition) {
+        abort();
+    }
+}
+
+static void checkParseLength(uint8_t const* begin, uint8_t const* end) {
+    auto parsed = protocol::parseLength(begin, end);
+    if (!parsed.second) {
+        return;
+    }
+    check(parsed.second > begin && parsed.second <= end);
+    check(parsed.second - begin <= static_cast<int>(sizeof(size_t)));
+}
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size) {
+    if (size < 3) {
+        return 0;
+    }
+    size_t max_payload_size = 1 + ((data[0] | data[1] << 8) % 4096);
+    bool check_crc = data[2] & 1;
+    uint8_t const* stream = data + 3;
+    size_t stream_size = size - 3;
+
+    checkParseLength(stream, stream + stream_size);
+
+    size_t offset = 0;
+    while (offset < stream_size) {
+        uint8_t const* buffer = stream + offset;
+        size_t remaining = stream_size - offset;
+        protocol::RejectionReason reason;
+        int result = protocol::extractPacket(buffer, remaining, max_payload_size,
+                                             check_crc, &reason);
+        if (result == 0) {
+            // Waiting for more bytes is only valid on a possible frame start
+            check(reason == protocol::NOT_REJECTED);
+            check(protocol::findSync(buffer, buffer + remaining) == buffer);
+            break;
+        }
+        else if (result < 0) {
+            check(reason != protocol::NOT_REJECTED);
+            check(static_cast<size_t>(-result) <= remaining);
+            offset += -result;
+            continue;
+        }
+
+        check(reason == protocol::NOT_REJECTED);
+        check(static_cast<size_t>(result) <= remaining);
+        check(result >= protocol::PACKET_MIN_SIZE);
+        auto payload = protocol::getPayload(buffer, buffer + result);
+        check(payload.first >= buffer + 2);
+        check(payload.second + 2 == buffer + result);
+        size_t payload_size = payload.second - payload.first;
+        check(payload_size <= max_payload_size);
+
+        size_t length_field_size = payload.first - (buffer + 2);
+        bool minimal_length = length_field_size ==
+            max<size_t>(1, protocol::getLengthEncodedSize(payload_size));
+        if (check_crc && minimal_length) {
+            // A frame accepted with its CRC is exactly the frame we would
+            // generate for its payload
+            vector<uint8_t> frame(result);
+            uint8_t* end = protocol::encodeFrame(
+                frame.data(), frame.data() + frame.size(),
+                payload.first, payload.second
+            );
+            check(end == frame.data() + frame.size());
+            check(memcmp(frame.data(), buffer, result) == 0);
+        }
+        offset += result;
+    }
+    return 0;
+}
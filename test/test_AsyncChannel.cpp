@@ -0,0 +1,213 @@
+#include <gtest/gtest.h>
+#include "test.pb.h"
+#include <comms_protobuf/AsyncChannel.hpp>
+#include <memory>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace comms_protobuf;
+
+struct AsyncTestChannel : public Channel<test_channel::Local, test_channel::Local> {
+    AsyncTestChannel()
+        : Channel<test_channel::Local, test_channel::Local>(100) {
+    }
+};
+
+typedef AsyncChannel<test_channel::Local, test_channel::Local> AsyncTestHandler;
+
+struct AsyncChannelTest : public ::testing::Test {
+    Reactor reactor;
+    AsyncTestChannel channel0;
+    AsyncTestChannel channel1;
+
+    AsyncChannelTest() {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            throw std::runtime_error("failed to create the socket pair");
+        }
+        channel0.setFileDescriptor(fds[0]);
+        channel1.setFileDescriptor(fds[1]);
+    }
+
+    template<typename Predicate>
+    void pollUntil(Predicate predicate) {
+        base::Time deadline = base::Time::now() + base::Time::fromSeconds(2);
+        while (!predicate()) {
+            ASSERT_LT(base::Time::now(), deadline);
+            reactor.poll(base::Time::fromMilliseconds(10));
+        }
+    }
+};
+
+TEST_F(AsyncChannelTest, it_delivers_messages_through_the_callback) {
+    AsyncTestHandler handler0(reactor, channel0, 1024);
+    AsyncTestHandler handler1(reactor, channel1, 1024);
+
+    vector<int> received;
+    handler1.setMessageCallback([&received](test_channel::Local& message) {
+        received.push_back(message.something());
+    });
+
+    for (int i = 0; i < 3; ++i) {
+        test_channel::Local local;
+        local.set_something(i);
+        ASSERT_TRUE(handler0.write(local));
+    }
+    pollUntil([&received]() { return received.size() == 3; });
+    ASSERT_EQ(vector<int>({ 0, 1, 2 }), received);
+}
+
+TEST_F(AsyncChannelTest, it_refuses_messages_while_the_write_queue_is_full) {
+    AsyncTestHandler handler0(reactor, channel0, 1024);
+    AsyncTestHandler handler1(reactor, channel1, 1024);
+    size_t received = 0;
+    handler1.setMessageCallback([&received](test_channel::Local&) {
+        ++received;
+    });
+    bool drained = false;
+    handler0.setDrainedCallback([&drained]() { drained = true; });
+
+    test_channel::Local local;
+    local.set_something_else(string(90, 'a'));
+    size_t sent = 0;
+    while (handler0.write(local)) {
+        ++sent;
+        ASSERT_LT(sent, 1000000);
+    }
+    ASSERT_GE(handler0.getQueueSize(), 1024);
+
+    pollUntil([&]() { return drained && received == sent; });
+    ASSERT_EQ(0, handler0.getQueueSize());
+    ASSERT_TRUE(handler0.write(local));
+}
+
+TEST_F(AsyncChannelTest, it_reports_decoding_errors_through_the_error_callback) {
+    AsyncTestHandler handler1(reactor, channel1, 1024);
+    size_t errors = 0;
+    handler1.setErrorCallback([&errors](std::exception const&) { ++errors; });
+    size_t received = 0;
+    handler1.setMessageCallback([&received](test_channel::Local&) {
+        ++received;
+    });
+
+    uint8_t invalid[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x37, 0xF0 };
+    channel0.writePacket(invalid, 10);
+    test_channel::Local local;
+    local.set_something(10);
+    channel0.write(local);
+
+    pollUntil([&]() { return errors == 1 && received == 1; });
+}
+
+TEST_F(AsyncChannelTest, it_unregisters_the_channel_when_the_remote_side_closes) {
+    AsyncTestHandler handler1(reactor, channel1, 1024);
+    channel0.close();
+
+    pollUntil([&]() { return handler1.isClosed(); });
+}
+
+TEST_F(AsyncChannelTest, it_reports_a_read_error_at_most_once_when_the_remote_side_closes) {
+    AsyncTestHandler handler1(reactor, channel1, 1024);
+    size_t errors = 0;
+    handler1.setErrorCallback([&errors](std::exception const&) { ++errors; });
+    channel0.close();
+
+    pollUntil([&]() { return handler1.isClosed(); });
+    ASSERT_GE(1, errors);
+}
+
+TEST_F(AsyncChannelTest, it_refuses_to_write_once_the_remote_side_closed) {
+    AsyncTestHandler handler1(reactor, channel1, 1024);
+    channel0.close();
+    pollUntil([&]() { return handler1.isClosed(); });
+
+    test_channel::Local local;
+    local.set_something(10);
+    ASSERT_FALSE(handler1.write(local));
+}
+
+TEST_F(AsyncChannelTest, it_returns_to_the_reactor_while_the_remote_side_keeps_sending) {
+    AsyncTestHandler handler1(reactor, channel1, 1024);
+    test_channel::Local local;
+    local.set_something(10);
+
+    size_t received = 0;
+    handler1.setMessageCallback([&](test_channel::Local&) {
+        ++received;
+        if (received < 1000) {
+            channel0.write(local);
+        }
+    });
+    channel0.write(local);
+
+    reactor.poll(base::Time::fromMilliseconds(100));
+    ASSERT_LT(received, 1000);
+    pollUntil([&]() { return received == 1000; });
+}
+
+/** Reactor handler on one end of a socket pair, whose read callback is
+ * given by the test
+ */
+struct SocketHandler : public Reactor::Handler {
+    int fds[2];
+    std::function<void()> on_read;
+    size_t read_count = 0;
+
+    SocketHandler() {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            throw std::runtime_error("failed to create the socket pair");
+        }
+    }
+    ~SocketHandler() {
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+
+    int getFileDescriptor() const override { return fds[0]; }
+    void handleRead() override {
+        ++read_count;
+        if (on_read) {
+            on_read();
+        }
+    }
+    void handleWrite() override {}
+    bool wantsWrite() const override { return false; }
+};
+
+TEST_F(AsyncChannelTest, it_does_not_dispatch_events_to_a_handler_removed_in_the_same_batch) {
+    std::unique_ptr<SocketHandler> handlers[2] = {
+        std::unique_ptr<SocketHandler>(new SocketHandler),
+        std::unique_ptr<SocketHandler>(new SocketHandler)
+    };
+    size_t reads = 0;
+    for (int i = 0; i < 2; ++i) {
+        handlers[i]->on_read = [&, i]() {
+            ++reads;
+            reactor.remove(*handlers[1 - i]);
+            handlers[1 - i].reset();
+        };
+        reactor.add(*handlers[i]);
+        ASSERT_EQ(1, ::write(handlers[i]->fds[1], "a", 1));
+    }
+
+    ASSERT_EQ(1, reactor.poll(base::Time::fromMilliseconds(100)));
+    ASSERT_EQ(1, reads);
+    for (auto& handler : handlers) {
+        if (handler) {
+            reactor.remove(*handler);
+        }
+    }
+}
+
+TEST_F(AsyncChannelTest, it_accepts_a_handler_removing_itself_before_a_hangup) {
+    SocketHandler handler;
+    handler.on_read = [&]() { reactor.remove(handler); };
+    reactor.add(handler);
+    ASSERT_EQ(1, ::write(handler.fds[1], "a", 1));
+    ::shutdown(handler.fds[1], SHUT_WR);
+
+    ASSERT_EQ(1, reactor.poll(base::Time::fromMilliseconds(100)));
+    ASSERT_EQ(1, handler.read_count);
+    reactor.remove(handler);
+}
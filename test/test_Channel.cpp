@@ -52,6 +52,98 @@ TEST_F(ChannelTest, it_can_send_a_message) {
     ASSERT_EQ(10, local.something());
 }
 
+static vector<test_channel::Local> makeLocalMessages(int count) {
+    vector<test_channel::Local> messages(count);
+    for (int i = 0; i < count; ++i) {
+        messages[i].set_something(i);
+    }
+    return messages;
+}
+
+static vector<int> decodeLocalMessages(vector<uint8_t> buffer) {
+    vector<int> result;
+    size_t offset = 0;
+    while (offset < buffer.size()) {
+        int size = protocol::extractPacket(
+            &buffer[offset], buffer.size() - offset, 100
+        );
+        if (size <= 0) {
+            throw std::runtime_error("invalid frame in buffer");
+        }
+        auto payload = protocol::getPayload(&buffer[offset], &buffer[offset + size]);
+        test_channel::Local message;
+        message.ParseFromArray(payload.first, payload.second - payload.first);
+        result.push_back(message.something());
+        offset += size;
+    }
+    return result;
+}
+
+TEST_F(ChannelTest, it_writes_a_batch_of_messages) {
+    auto messages = makeLocalMessages(3);
+    driver.writeBatch(messages.begin(), messages.end());
+
+    ASSERT_EQ(0, driver.getWriteQueueSize());
+    ASSERT_EQ(vector<int>({ 0, 1, 2 }), decodeLocalMessages(readDataFromDriver()));
+}
+
+TEST_F(ChannelTest, it_queues_messages_in_coalescing_mode_until_flushed) {
+    driver.setWriteCoalescing(1000, base::Time::fromSeconds(3600));
+    auto messages = makeLocalMessages(3);
+    for (auto const& msg : messages) {
+        driver.write(msg);
+    }
+    ASSERT_TRUE(readDataFromDriver().empty());
+
+    driver.flush();
+    ASSERT_EQ(vector<int>({ 0, 1, 2 }), decodeLocalMessages(readDataFromDriver()));
+}
+
+TEST_F(ChannelTest, it_flushes_the_coalescing_queue_when_it_would_overflow) {
+    test_channel::Local local;
+    local.set_something(1);
+    size_t frame_size = protocol::getFrameSize(
+        protocol::getSerializedSize(local)
+    );
+
+    driver.setWriteCoalescing(frame_size * 2, base::Time::fromSeconds(3600));
+    auto messages = makeLocalMessages(3);
+    for (auto const& msg : messages) {
+        driver.write(msg);
+    }
+    ASSERT_EQ(vector<int>({ 0, 1 }), decodeLocalMessages(readDataFromDriver()));
+    driver.flush();
+    ASSERT_EQ(vector<int>({ 2 }), decodeLocalMessages(readDataFromDriver()));
+}
+
+TEST_F(ChannelTest, it_refuses_to_write_a_message_bigger_than_max_message_size) {
+    test_channel::Local local;
+    local.set_something_else(string(200, 'a'));
+    ASSERT_THROW(driver.write(local), std::invalid_argument);
+
+    vector<test_channel::Local> messages = makeLocalMessages(2);
+    messages.push_back(local);
+    ASSERT_THROW(driver.writeBatch(messages.begin(), messages.end()),
+                 std::invalid_argument);
+    driver.flush();
+    ASSERT_EQ(vector<int>({ 0, 1 }), decodeLocalMessages(readDataFromDriver()));
+
+    driver.setWriteCoalescing(1000, base::Time::fromSeconds(3600));
+    ASSERT_THROW(driver.write(local), std::invalid_argument);
+    ASSERT_EQ(0, driver.getWriteQueueSize());
+
+    vector<uint8_t> buffer;
+    ASSERT_THROW(driver.appendFrame(buffer, local), std::invalid_argument);
+    ASSERT_TRUE(buffer.empty());
+}
+
+TEST_F(ChannelTest, it_flushes_the_coalescing_queue_once_the_delay_expired) {
+    driver.setWriteCoalescing(1000, base::Time());
+    auto messages = makeLocalMessages(2);
+    driver.write(messages[0]);
+    ASSERT_EQ(vector<int>({ 0 }), decodeLocalMessages(readDataFromDriver()));
+}
+
 TEST_F(ChannelTest, it_can_receive_a_message) {
     test_channel::Remote remote;
     remote.set_something_else(10);
@@ -62,6 +154,83 @@ TEST_F(ChannelTest, it_can_receive_a_message) {
     ASSERT_EQ(10, received.something_else());
 }
 
+TEST_F(ChannelTest, it_can_receive_a_message_into_an_existing_object) {
+    test_channel::Remote received;
+    received.set_something("some string");
+
+    test_channel::Remote remote;
+    remote.set_something_else(10);
+    pushMessageToDriver(remote);
+    driver.read(received);
+    ASSERT_EQ(10, received.something_else());
+
+    remote.set_something("other string");
+    pushMessageToDriver(remote);
+    driver.read(received);
+    ASSERT_EQ("other string", received.something());
+}
+
+TEST_F(ChannelTest, it_can_receive_messages_on_an_arena) {
+    driver.enableArena(1024);
+
+    test_channel::Remote remote;
+    remote.set_something("first");
+    pushMessageToDriver(remote);
+    remote.set_something("second");
+    pushMessageToDriver(remote);
+
+    test_channel::Remote& first = driver.readOnArena();
+    test_channel::Remote& second = driver.readOnArena();
+    ASSERT_EQ("first", first.something());
+    ASSERT_EQ("second", second.something());
+    driver.resetArena();
+
+    pushMessageToDriver(remote);
+    ASSERT_EQ("second", driver.readOnArena().something());
+}
+
+TEST_F(ChannelTest, it_refuses_to_read_on_the_arena_if_it_is_not_enabled) {
+    ASSERT_FALSE(driver.isArenaEnabled());
+    ASSERT_THROW(driver.readOnArena(), std::logic_error);
+}
+
+TEST_F(ChannelTest, it_reads_all_the_available_messages_at_once) {
+    for (int i = 0; i < 3; ++i) {
+        test_channel::Remote remote;
+        remote.set_something_else(i);
+        pushMessageToDriver(remote);
+    }
+
+    vector<test_channel::Remote> messages;
+    ASSERT_EQ(3, driver.readAll(messages));
+    ASSERT_EQ(3, messages.size());
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(i, messages[i].something_else());
+    }
+}
+
+TEST_F(ChannelTest, it_passes_all_the_available_messages_to_a_callback) {
+    for (int i = 0; i < 3; ++i) {
+        test_channel::Remote remote;
+        remote.set_something_else(i);
+        pushMessageToDriver(remote);
+    }
+
+    vector<int> received;
+    size_t count = driver.drain([&received](test_channel::Remote& message) {
+        received.push_back(message.something_else());
+    });
+    ASSERT_EQ(3, count);
+    ASSERT_EQ(vector<int>({ 0, 1, 2 }), received);
+}
+
+TEST_F(ChannelTest, readAll_times_out_if_no_message_is_available) {
+    vector<test_channel::Remote> messages;
+    ASSERT_THROW(driver.readAll(messages, base::Time::fromMilliseconds(10)),
+                 iodrivers_base::TimeoutError);
+    ASSERT_TRUE(messages.empty());
+}
+
 TEST_F(ChannelTest, it_throws_if_receiving_a_message_that_is_valid_for_extractPacket_but_invalid_for_protobuf) {
     uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x37, 0xF0 };
     pushDataToDriver(buffer, buffer + 10);
@@ -79,33 +248,242 @@ struct SymmetricChannel : public Channel<test_channel::Local, test_channel::Loca
 
 struct EncryptedChannelTest :
     public ::testing::Test, iodrivers_base::Fixture<SymmetricChannel> {
+    /** The other side of the channel */
+    SymmetricChannel remote;
+
+    EncryptedChannelTest() {
+        driver.openURI("test://");
+    }
+
+    vector<uint8_t> makeRemoteFrame(int value) {
+        test_channel::Local local;
+        local.set_something(value);
+        vector<uint8_t> frame;
+        remote.appendFrame(frame, local);
+        return frame;
+    }
 };
 
 TEST_F(EncryptedChannelTest, it_can_handle_encrypted_communication) {
     driver.setEncryptionKey("test");
-    driver.openURI("test://");
+    remote.setEncryptionKey("test");
+
+    this->pushDataToDriver(makeRemoteFrame(10));
+    auto decrypted = driver.read();
+    ASSERT_EQ(10, decrypted.something());
+}
+
+TEST_F(EncryptedChannelTest, it_accepts_a_key_derived_offline) {
+    remote.setEncryptionKey("test");
+    driver.setEncryptionKey(protocol::parseKey(
+        protocol::formatKey(protocol::deriveKey("test"))
+    ));
+    this->pushDataToDriver(makeRemoteFrame(10));
+    ASSERT_EQ(10, driver.read().something());
+}
+
+TEST_F(EncryptedChannelTest, it_decrypts_messages_sent_with_another_cipher_algorithm) {
+    remote.setEncryptionKey("test", protocol::CHACHA20_POLY1305);
+    ASSERT_EQ(protocol::CHACHA20_POLY1305, remote.getCipherAlgorithm());
+    driver.setEncryptionKey("test", protocol::AES_256_GCM);
+
+    this->pushDataToDriver(makeRemoteFrame(10));
+    ASSERT_EQ(10, driver.read().something());
+}
+
+TEST_F(EncryptedChannelTest, it_rejects_a_communication_with_the_wrong_key) {
+    remote.setEncryptionKey("test");
+    driver.setEncryptionKey("other");
+    this->pushDataToDriver(makeRemoteFrame(10));
+    ASSERT_THROW(driver.read(), DecryptionFailed);
+}
+
+TEST_F(EncryptedChannelTest, it_uses_a_different_IV_for_each_message) {
+    driver.setEncryptionKey("test");
+    remote.setEncryptionKey("test");
+
+    auto first = makeRemoteFrame(10);
+    auto second = makeRemoteFrame(10);
+    ASSERT_EQ(first.size(), second.size());
+    ASSERT_NE(first, second);
+
+    this->pushDataToDriver(first);
+    this->pushDataToDriver(second);
+    ASSERT_EQ(10, driver.read().something());
+    ASSERT_EQ(10, driver.read().something());
+}
+
+TEST_F(EncryptedChannelTest, it_rejects_a_replayed_message) {
+    driver.setEncryptionKey("test");
+    remote.setEncryptionKey("test");
+
+    auto frame = makeRemoteFrame(10);
+    this->pushDataToDriver(frame);
+    driver.read();
+    this->pushDataToDriver(frame);
+    ASSERT_THROW(driver.read(), ReplayedMessage);
+}
+
+TEST_F(EncryptedChannelTest, it_rejects_its_own_messages_reflected_back) {
+    driver.setEncryptionKey("test");
 
     test_channel::Local local;
     local.set_something(10);
     driver.write(local);
+    this->pushDataToDriver(readDataFromDriver());
+    ASSERT_THROW(driver.read(), ReplayedMessage);
+}
 
-    auto buffer = readDataFromDriver();
-    this->pushDataToDriver(buffer);
-    auto decrypted = driver.read();
-    ASSERT_EQ(10, decrypted.something());
+TEST_F(EncryptedChannelTest, it_rejects_the_messages_of_a_previous_session_of_the_remote_side) {
+    driver.setEncryptionKey("test");
+    remote.setEncryptionKey("test");
+    auto old_first = makeRemoteFrame(1);
+    auto old_second = makeRemoteFrame(2);
+    this->pushDataToDriver(old_first);
+    ASSERT_EQ(1, driver.read().something());
+
+    // The remote side restarts
+    remote.setEncryptionKey("test");
+    this->pushDataToDriver(makeRemoteFrame(3));
+    ASSERT_EQ(3, driver.read().something());
+
+    this->pushDataToDriver(old_second);
+    ASSERT_THROW(driver.read(), ReplayedMessage);
+    this->pushDataToDriver(makeRemoteFrame(4));
+    ASSERT_EQ(4, driver.read().something());
 }
 
-TEST_F(EncryptedChannelTest, it_rejects_a_communication_with_the_wrong_key) {
+static BufferPolicy makeExactSharedBufferPolicy() {
+    BufferPolicy policy;
+    policy.frame_count = 1;
+    policy.shared_io_buffer = true;
+    return policy;
+}
+
+struct ExactBufferChannel : public Channel<test_channel::Local, test_channel::Local> {
+    typedef test_channel::Local Local;
+
+    ExactBufferChannel()
+        : Channel<Local, Local>(100, makeExactSharedBufferPolicy()) {
+    }
+};
+
+struct BufferPolicyTest :
+    public ::testing::Test, iodrivers_base::Fixture<ExactBufferChannel> {
+};
+
+TEST_F(BufferPolicyTest, it_sizes_the_buffers_for_a_single_encrypted_frame) {
+    size_t expected = protocol::getFrameSize(
+        protocol::CipherContext::getMaxCiphertextLength(100)
+    );
+    size_t actual = ExactBufferChannel::getBufferSize(100, driver.getBufferPolicy());
+    ASSERT_LE(expected, actual);
+    ASSERT_GT(expected * 2, actual);
+}
+
+TEST_F(BufferPolicyTest, it_exchanges_max_size_encrypted_messages_through_the_shared_buffer) {
     driver.setEncryptionKey("test");
-    driver.openURI("test://");
+    ExactBufferChannel receiver;
+    receiver.setEncryptionKey("test");
 
+    test_channel::Local local;
+    local.set_something_else(string(98, 'a'));
+    ASSERT_EQ(100, protocol::getSerializedSize(local));
+    driver.write(local);
+    auto frame = readDataFromDriver();
+
+    test_channel::Local received;
+    ASSERT_TRUE(receiver.decodeFrame(received, frame.data(), frame.size(),
+                                     base::Time::now()));
+    ASSERT_EQ(string(98, 'a'), received.something_else());
+}
+
+struct FragmentedChannelTest :
+    public ::testing::Test, iodrivers_base::Fixture<SymmetricChannel> {
+    FragmentedChannelTest() {
+        driver.enableFragmentation(10000, 20000, base::Time::fromSeconds(1));
+    }
+};
+
+TEST_F(FragmentedChannelTest, it_sends_a_small_message_in_a_single_frame) {
     test_channel::Local local;
     local.set_something(10);
     driver.write(local);
 
-    auto buffer = readDataFromDriver();
+    auto frame = readDataFromDriver();
+    ASSERT_EQ(protocol::getFrameSize(
+        fragmentation::HEADER_SIZE + protocol::getSerializedSize(local)
+    ), frame.size());
+    this->pushDataToDriver(frame);
+    ASSERT_EQ(10, driver.read().something());
+}
 
-    driver.setEncryptionKey("other");
-    this->pushDataToDriver(buffer);
-    ASSERT_THROW(driver.read(), DecryptionFailed);
+TEST_F(FragmentedChannelTest, it_splits_a_message_bigger_than_a_frame) {
+    test_channel::Local local;
+    local.set_something_else(string(5000, 'a'));
+    driver.write(local);
+
+    auto frames = readDataFromDriver();
+    ASSERT_GT(frames.size(), 5000);
+    this->pushDataToDriver(frames);
+    ASSERT_EQ(string(5000, 'a'), driver.read().something_else());
+}
+
+TEST_F(FragmentedChannelTest, it_splits_encrypted_messages) {
+    driver.setEncryptionKey("test");
+    SymmetricChannel remote;
+    remote.setEncryptionKey("test");
+    remote.enableFragmentation(10000, 20000, base::Time::fromSeconds(1));
+
+    test_channel::Local local;
+    local.set_something_else(string(5000, 'a'));
+    vector<uint8_t> frames;
+    remote.appendFrame(frames, local);
+    this->pushDataToDriver(frames);
+    ASSERT_EQ(string(5000, 'a'), driver.read().something_else());
+}
+
+TEST_F(FragmentedChannelTest, drain_keeps_the_fragments_of_an_incomplete_message) {
+    test_channel::Local small;
+    small.set_something(10);
+    test_channel::Local big;
+    big.set_something_else(string(500, 'a'));
+    vector<uint8_t> frames;
+    driver.appendFrame(frames, small);
+    size_t small_size = frames.size();
+    driver.appendFrame(frames, big);
+
+    size_t first_fragment_size = protocol::getFrameSize(100);
+    this->pushDataToDriver(vector<uint8_t>(
+        frames.begin(), frames.begin() + small_size + first_fragment_size
+    ));
+    vector<test_channel::Local> messages;
+    ASSERT_EQ(1, driver.readAll(messages, base::Time()));
+    ASSERT_EQ(10, messages.at(0).something());
+
+    this->pushDataToDriver(vector<uint8_t>(
+        frames.begin() + small_size + first_fragment_size, frames.end()
+    ));
+    ASSERT_EQ(1, driver.readAll(messages, base::Time()));
+    ASSERT_EQ(string(500, 'a'), messages.at(1).something_else());
+}
+
+TEST_F(FragmentedChannelTest, it_times_out_if_fragments_are_missing) {
+    test_channel::Local local;
+    local.set_something_else(string(500, 'a'));
+    driver.write(local);
+
+    auto frames = readDataFromDriver();
+    frames.resize(frames.size() / 2);
+    this->pushDataToDriver(frames);
+    ASSERT_THROW(driver.read(base::Time::fromMilliseconds(10)),
+                 iodrivers_base::TimeoutError);
+}
+
+TEST_F(FragmentedChannelTest, it_rejects_messages_bigger_than_the_max_reassembled_size) {
+    test_channel::Local local;
+    local.set_something_else(string(15000, 'a'));
+    driver.write(local);
+    this->pushDataToDriver(readDataFromDriver());
+    ASSERT_THROW(driver.read(), InvalidFragment);
 }
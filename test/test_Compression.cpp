@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+#include <random>
+#include "test.pb.h"
+#include <comms_protobuf/Channel.hpp>
+#include <iodrivers_base/FixtureGTest.hpp>
+
+using namespace std;
+using namespace comms_protobuf;
+
+static string getIncompressibleData(size_t size) {
+    minstd_rand random;
+    string data(size, 0);
+    for (auto& c : data) {
+        c = random();
+    }
+    return data;
+}
+
+struct CompressionTest : public ::testing::TestWithParam<compression::Algorithm> {
+    vector<uint8_t> getCompressibleData(size_t size) {
+        vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; ++i) {
+            data[i] = "compressible"[i % 12];
+        }
+        return data;
+    }
+};
+
+TEST_P(CompressionTest, it_compresses_and_decompresses_data) {
+    if (!compression::isAvailable(GetParam())) {
+        return;
+    }
+
+    compression::Options options;
+    options.algorithm = GetParam();
+    compression::Codec codec(options);
+
+    auto data = getCompressibleData(1000);
+    vector<uint8_t> compressed(data.size());
+    size_t size = codec.compress(compressed.data(), compressed.size(),
+                                 data.data(), data.size());
+    ASSERT_GT(size, 0);
+    ASSERT_LT(size, 100);
+
+    vector<uint8_t> decompressed(data.size());
+    codec.decompress(GetParam(), decompressed.data(), decompressed.size(),
+                     compressed.data(), size);
+    ASSERT_EQ(data, decompressed);
+}
+
+TEST_P(CompressionTest, it_reports_that_the_compressed_data_does_not_fit) {
+    if (!compression::isAvailable(GetParam())) {
+        return;
+    }
+
+    compression::Options options;
+    options.algorithm = GetParam();
+    compression::Codec codec(options);
+
+    string incompressible = getIncompressibleData(1000);
+    vector<uint8_t> data(incompressible.begin(), incompressible.end());
+    vector<uint8_t> compressed(data.size() / 2);
+    ASSERT_EQ(0, codec.compress(compressed.data(), compressed.size(),
+                                data.data(), data.size()));
+}
+
+TEST_P(CompressionTest, it_throws_if_the_compressed_data_is_corrupted) {
+    if (!compression::isAvailable(GetParam())) {
+        return;
+    }
+
+    compression::Options options;
+    options.algorithm = GetParam();
+    compression::Codec codec(options);
+
+    auto data = getCompressibleData(1000);
+    vector<uint8_t> compressed(data.size());
+    size_t size = codec.compress(compressed.data(), compressed.size(),
+                                 data.data(), data.size());
+    vector<uint8_t> decompressed(data.size());
+    ASSERT_THROW(codec.decompress(GetParam(), decompressed.data(),
+                                  decompressed.size(), compressed.data(), size / 2),
+                 DecompressionFailed);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Algorithms, CompressionTest,
+    ::testing::Values(compression::LZ4, compression::ZSTD)
+);
+
+TEST(CompressionAvailabilityTest, it_rejects_an_algorithm_that_is_not_built_in) {
+    compression::Options options;
+    options.algorithm = compression::LZ4;
+    if (compression::isAvailable(compression::LZ4)) {
+        ASSERT_NO_THROW(compression::Codec codec(options));
+    }
+    else {
+        ASSERT_THROW(compression::Codec codec(options), std::invalid_argument);
+    }
+}
+
+struct CompressedChannel : public Channel<test_channel::Local, test_channel::Local> {
+    typedef test_channel::Local Local;
+
+    CompressedChannel()
+        : Channel<Local, Local>(1000) {
+    }
+};
+
+struct CompressedChannelTest :
+    public ::testing::Test, iodrivers_base::Fixture<CompressedChannel> {
+    /** The other side of the channel */
+    CompressedChannel remote;
+
+    bool enable(compression::Algorithm algorithm) {
+        if (!compression::isAvailable(algorithm)) {
+            return false;
+        }
+
+        compression::Options options;
+        options.algorithm = algorithm;
+        options.threshold = 64;
+        driver.enableCompression(options);
+        remote.enableCompression(options);
+        return true;
+    }
+
+    /** Send a message from the remote side and read it */
+    test_channel::Local roundTrip(test_channel::Local const& local) {
+        vector<uint8_t> frame;
+        remote.appendFrame(frame, local);
+        last_frame_size = frame.size();
+        pushDataToDriver(frame);
+        return driver.read();
+    }
+
+    size_t last_frame_size = 0;
+};
+
+TEST_F(CompressedChannelTest, it_sends_small_messages_uncompressed) {
+    ASSERT_TRUE(enable(compression::NONE));
+
+    test_channel::Local local;
+    local.set_something(10);
+    ASSERT_EQ(10, roundTrip(local).something());
+    ASSERT_EQ(protocol::getFrameSize(1 + protocol::getSerializedSize(local)),
+              last_frame_size);
+}
+
+TEST_F(CompressedChannelTest, it_compresses_messages_above_the_threshold) {
+    for (auto algorithm : { compression::LZ4, compression::ZSTD }) {
+        if (!enable(algorithm)) {
+            continue;
+        }
+
+        test_channel::Local local;
+        local.set_something_else(string(900, 'a'));
+        ASSERT_EQ(string(900, 'a'), roundTrip(local).something_else());
+        ASSERT_LT(last_frame_size, 100);
+    }
+}
+
+TEST_F(CompressedChannelTest, it_sends_incompressible_messages_uncompressed) {
+    for (auto algorithm : { compression::LZ4, compression::ZSTD }) {
+        if (!enable(algorithm)) {
+            continue;
+        }
+
+        string data = getIncompressibleData(500);
+        test_channel::Local local;
+        local.set_data(data);
+        ASSERT_EQ(data, roundTrip(local).data());
+        ASSERT_EQ(protocol::getFrameSize(1 + protocol::getSerializedSize(local)),
+                  last_frame_size);
+    }
+}
+
+TEST_F(CompressedChannelTest, it_compresses_encrypted_and_fragmented_messages) {
+    if (!enable(compression::LZ4)) {
+        return;
+    }
+    for (auto channel : { &driver, &remote }) {
+        channel->setEncryptionKey("test");
+        channel->enableFragmentation(100000, 100000, base::Time::fromSeconds(1));
+    }
+
+    test_channel::Local local;
+    local.set_something_else(string(50000, 'a'));
+    ASSERT_EQ(string(50000, 'a'), roundTrip(local).something_else());
+
+    string data = getIncompressibleData(5000);
+    local.set_data(data);
+    ASSERT_EQ(data, roundTrip(local).data());
+    ASSERT_GT(last_frame_size, 5000);
+}
+
+TEST_F(CompressedChannelTest, it_rejects_an_announced_size_bigger_than_the_max_message_size) {
+    ASSERT_TRUE(enable(compression::NONE));
+
+    uint8_t payload[16] = { compression::LZ4 };
+    uint8_t* end = protocol::encodeLength(payload + 1, payload + 16, 2000);
+    uint8_t buffer[64];
+    uint8_t* frame_end = protocol::encodeFrame(buffer, buffer + 64, payload, end);
+    pushDataToDriver(buffer, frame_end);
+    ASSERT_THROW(driver.read(), DecompressionFailed);
+}
+
+TEST_F(CompressedChannelTest, it_rejects_an_empty_message) {
+    ASSERT_TRUE(enable(compression::NONE));
+
+    uint8_t buffer[64];
+    uint8_t* frame_end = protocol::encodeFrame(buffer, buffer + 64, buffer, buffer);
+    pushDataToDriver(buffer, frame_end);
+    ASSERT_THROW(driver.read(), DecompressionFailed);
+}
@@ -0,0 +1,206 @@
+#include <gtest/gtest.h>
+#include "test.pb.h"
+#include <comms_protobuf/Channel.hpp>
+#include <comms_protobuf/DeltaReflection.hpp>
+#include <iodrivers_base/FixtureGTest.hpp>
+
+using namespace std;
+using namespace comms_protobuf;
+using test_channel::Telemetry;
+
+struct DeltaTest : public ::testing::Test {
+    Telemetry reference;
+    Telemetry delta;
+    vector<uint32_t> cleared_fields;
+
+    DeltaTest() {
+        reference.set_status(1);
+        reference.set_name("vehicle");
+        reference.add_values(1);
+        reference.add_values(2);
+        reference.mutable_position()->set_x(10);
+        reference.mutable_position()->set_y(20);
+        reference.mutable_origin();
+    }
+
+    Telemetry roundTrip(Telemetry const& message) {
+        delta::diff(reference, message, delta, cleared_fields);
+        Telemetry result(reference);
+        delta::apply(result, delta, cleared_fields);
+        return result;
+    }
+};
+
+TEST_F(DeltaTest, it_only_keeps_the_changed_fields) {
+    Telemetry message(reference);
+    message.set_status(2);
+    delta::diff(reference, message, delta, cleared_fields);
+
+    Telemetry expected;
+    expected.set_status(2);
+    ASSERT_EQ(expected.SerializeAsString(), delta.SerializeAsString());
+    ASSERT_TRUE(cleared_fields.empty());
+}
+
+TEST_F(DeltaTest, it_reconstructs_changed_fields) {
+    Telemetry message(reference);
+    message.set_status(2);
+    message.set_values(1, 42);
+    message.mutable_position()->set_y(30);
+    Telemetry result = roundTrip(message);
+    ASSERT_EQ(message.SerializeAsString(), result.SerializeAsString());
+}
+
+TEST_F(DeltaTest, it_reconstructs_cleared_fields) {
+    Telemetry message(reference);
+    message.set_status(0);
+    message.clear_values();
+    message.clear_origin();
+    message.mutable_position()->set_x(0);
+    Telemetry result = roundTrip(message);
+    ASSERT_EQ(message.SerializeAsString(), result.SerializeAsString());
+    ASSERT_FALSE(result.has_origin());
+}
+
+TEST_F(DeltaTest, it_replaces_repeated_fields_instead_of_appending) {
+    Telemetry message(reference);
+    message.clear_values();
+    message.add_values(3);
+    Telemetry result = roundTrip(message);
+    ASSERT_EQ(1, result.values_size());
+    ASSERT_EQ(3, result.values(0));
+}
+
+TEST_F(DeltaTest, it_encodes_and_parses_a_header) {
+    delta::Header header;
+    header.type = delta::DELTA;
+    header.keyframe_id = 300;
+    header.cleared_fields = { 1, 2, 1000 };
+
+    vector<uint8_t> buffer(delta::getHeaderSize(header));
+    ASSERT_EQ(buffer.data() + buffer.size(), delta::encodeHeader(buffer.data(), header));
+
+    delta::Header parsed;
+    ASSERT_EQ(buffer.data() + buffer.size(),
+              delta::parseHeader(buffer.data(), buffer.data() + buffer.size(), parsed));
+    ASSERT_EQ(delta::DELTA, parsed.type);
+    ASSERT_EQ(300, parsed.keyframe_id);
+    ASSERT_EQ(header.cleared_fields, parsed.cleared_fields);
+}
+
+TEST_F(DeltaTest, it_rejects_a_truncated_header) {
+    delta::Header header;
+    header.type = delta::DELTA;
+    header.cleared_fields = { 1, 2 };
+
+    vector<uint8_t> buffer(delta::getHeaderSize(header));
+    delta::encodeHeader(buffer.data(), header);
+
+    delta::Header parsed;
+    ASSERT_THROW(delta::parseHeader(buffer.data(), buffer.data() + buffer.size() - 1,
+                                    parsed),
+                 InvalidDelta);
+}
+
+TEST_F(DeltaTest, it_rejects_an_unknown_type) {
+    uint8_t buffer[] = { 2, 0 };
+    delta::Header parsed;
+    ASSERT_THROW(delta::parseHeader(buffer, buffer + 2, parsed), InvalidDelta);
+}
+
+struct TelemetryChannel : public Channel<Telemetry, Telemetry> {
+    TelemetryChannel()
+        : Channel<Telemetry, Telemetry>(1000) {
+    }
+};
+
+struct DeltaChannelTest :
+    public ::testing::Test, iodrivers_base::Fixture<TelemetryChannel> {
+
+    Telemetry message;
+
+    DeltaChannelTest() {
+        driver.enableDeltaEncoding(3);
+        message.set_status(1);
+        message.set_name(string(100, 'a'));
+        message.mutable_position()->set_x(10);
+    }
+
+    vector<uint8_t> write(Telemetry const& message) {
+        driver.write(message);
+        return readDataFromDriver();
+    }
+
+    Telemetry read(vector<uint8_t> const& frame) {
+        pushDataToDriver(frame);
+        return driver.read();
+    }
+};
+
+TEST_F(DeltaChannelTest, it_sends_deltas_between_keyframes) {
+    vector<size_t> sizes;
+    for (int i = 0; i < 7; ++i) {
+        message.mutable_position()->set_x(i);
+        auto frame = write(message);
+        sizes.push_back(frame.size());
+        ASSERT_EQ(message.SerializeAsString(), read(frame).SerializeAsString());
+    }
+
+    for (int i : { 0, 3, 6 }) {
+        ASSERT_GT(sizes[i], 100);
+    }
+    for (int i : { 1, 2, 4, 5 }) {
+        ASSERT_LT(sizes[i], 30);
+    }
+}
+
+TEST_F(DeltaChannelTest, it_decodes_deltas_after_a_lost_delta) {
+    read(write(message));
+    write(message);
+    message.set_status(2);
+    ASSERT_EQ(2, read(write(message)).status());
+}
+
+TEST_F(DeltaChannelTest, it_throws_on_deltas_against_a_lost_keyframe) {
+    write(message);
+    auto delta = write(message);
+    ASSERT_THROW(read(delta), MissingKeyframe);
+
+    driver.requestKeyframe();
+    message.set_status(2);
+    ASSERT_EQ(2, read(write(message)).status());
+    message.set_status(3);
+    ASSERT_EQ(3, read(write(message)).status());
+}
+
+TEST_F(DeltaChannelTest, it_does_not_use_a_rejected_keyframe_as_reference) {
+    for (int i = 0; i < 3; ++i) {
+        read(write(message));
+    }
+
+    Telemetry oversized(message);
+    oversized.set_name(string(2000, 'a'));
+    ASSERT_THROW(driver.write(oversized), std::invalid_argument);
+
+    message.set_status(2);
+    ASSERT_EQ(2, read(write(message)).status());
+    message.set_status(3);
+    ASSERT_EQ(3, read(write(message)).status());
+}
+
+TEST_F(DeltaChannelTest, it_combines_with_compression) {
+    compression::Options options;
+    options.algorithm = compression::NONE;
+    driver.enableCompression(options);
+    if (compression::isAvailable(compression::LZ4)) {
+        options.algorithm = compression::LZ4;
+        options.threshold = 0;
+        driver.enableCompression(options);
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        message.set_status(i);
+        ASSERT_EQ(message.SerializeAsString(),
+                  read(write(message)).SerializeAsString());
+    }
+}
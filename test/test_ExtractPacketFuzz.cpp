@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include "adversarial_streams.hpp"
+
+using namespace std;
+using namespace comms_protobuf;
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size);
+
+struct ExtractPacketFuzzTest : public ::testing::Test {
+    void run(vector<uint8_t> const& stream, size_t max_payload_size,
+             bool check_crc) {
+        vector<uint8_t> input = {
+            static_cast<uint8_t>((max_payload_size - 1) & 0xFF),
+            static_cast<uint8_t>((max_payload_size - 1) >> 8),
+            static_cast<uint8_t>(check_crc)
+        };
+        input.insert(input.end(), stream.begin(), stream.end());
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+};
+
+TEST_F(ExtractPacketFuzzTest, it_processes_adversarial_streams) {
+    for (int kind = 0; kind < adversarial_streams::KIND_COUNT; ++kind) {
+        SCOPED_TRACE(adversarial_streams::getName(
+            static_cast<adversarial_streams::Kind>(kind)
+        ));
+        for (size_t max_payload_size : { 1, 100, 4096 }) {
+            auto stream = adversarial_streams::generate(
+                static_cast<adversarial_streams::Kind>(kind), 20000, max_payload_size
+            );
+            run(stream, max_payload_size, true);
+            run(stream, max_payload_size, false);
+        }
+    }
+}
+
+TEST_F(ExtractPacketFuzzTest, it_processes_truncated_inputs) {
+    uint8_t data[] = { 0, 1, 1, protocol::SYNC_0, protocol::SYNC_1, 0x80 };
+    for (size_t size = 0; size <= sizeof(data); ++size) {
+        LLVMFuzzerTestOneInput(data, size);
+    }
+}
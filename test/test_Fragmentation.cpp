@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+#include <comms_protobuf/Fragmentation.hpp>
+
+using namespace std;
+using namespace comms_protobuf;
+using namespace comms_protobuf::fragmentation;
+
+struct FragmentationTest : public ::testing::Test {
+    base::Time now = base::Time::fromSeconds(10);
+    Reassembler reassembler;
+
+    FragmentationTest()
+        : reassembler(100, 2 * Reassembler::getMessageOverhead(2) + 50,
+                      base::Time::fromSeconds(1)) {
+    }
+
+    bool push(uint32_t id, uint16_t index, uint16_t count, string const& data) {
+        Header header;
+        header.message_id = id;
+        header.index = index;
+        header.count = count;
+        uint8_t const* begin = reinterpret_cast<uint8_t const*>(data.data());
+        return reassembler.push(header, begin, begin + data.size(), now);
+    }
+
+    string getMessage() const {
+        auto const& message = reassembler.getMessage();
+        return string(message.begin(), message.end());
+    }
+};
+
+TEST_F(FragmentationTest, it_encodes_and_parses_a_header) {
+    Header header;
+    header.message_id = 0x12345678;
+    header.index = 0x102;
+    header.count = 0x304;
+    uint8_t buffer[HEADER_SIZE];
+    ASSERT_EQ(buffer + HEADER_SIZE, encodeHeader(buffer, header));
+
+    Header parsed = parseHeader(buffer, buffer + HEADER_SIZE);
+    ASSERT_EQ(header.message_id, parsed.message_id);
+    ASSERT_EQ(header.index, parsed.index);
+    ASSERT_EQ(header.count, parsed.count);
+}
+
+TEST_F(FragmentationTest, it_rejects_a_header_whose_index_is_past_the_count) {
+    Header header;
+    header.index = 2;
+    header.count = 2;
+    uint8_t buffer[HEADER_SIZE];
+    encodeHeader(buffer, header);
+    ASSERT_THROW(parseHeader(buffer, buffer + HEADER_SIZE), InvalidFragment);
+}
+
+TEST_F(FragmentationTest, it_computes_the_fragment_count) {
+    ASSERT_EQ(1, getFragmentCount(0, 10));
+    ASSERT_EQ(1, getFragmentCount(10, 10));
+    ASSERT_EQ(2, getFragmentCount(11, 10));
+    ASSERT_THROW(getFragmentCount(MAX_FRAGMENT_COUNT + 1, 1), std::invalid_argument);
+}
+
+TEST_F(FragmentationTest, it_reassembles_out_of_order_and_interleaved_fragments) {
+    ASSERT_FALSE(push(1, 1, 2, "def"));
+    ASSERT_FALSE(push(2, 0, 2, "123"));
+    ASSERT_TRUE(push(1, 0, 2, "abc"));
+    ASSERT_EQ("abcdef", getMessage());
+    ASSERT_TRUE(push(2, 1, 2, "456"));
+    ASSERT_EQ("123456", getMessage());
+    ASSERT_EQ(0, reassembler.getPendingCount());
+    ASSERT_EQ(0, reassembler.getMemoryUsage());
+}
+
+TEST_F(FragmentationTest, it_ignores_duplicate_fragments) {
+    ASSERT_FALSE(push(1, 0, 2, "abc"));
+    ASSERT_FALSE(push(1, 0, 2, "abc"));
+    ASSERT_TRUE(push(1, 1, 2, "def"));
+    ASSERT_EQ("abcdef", getMessage());
+}
+
+TEST_F(FragmentationTest, it_drops_incomplete_messages_after_the_timeout) {
+    push(1, 0, 2, "abc");
+    now = now + base::Time::fromSeconds(2);
+    ASSERT_FALSE(push(1, 1, 2, "def"));
+    ASSERT_EQ(1, reassembler.getPendingCount());
+    ASSERT_EQ(Reassembler::getMessageOverhead(2) + 3, reassembler.getMemoryUsage());
+}
+
+TEST_F(FragmentationTest, it_drops_the_oldest_message_to_stay_within_the_memory_limit) {
+    push(1, 0, 2, string(30, 'a'));
+    now = now + base::Time::fromMilliseconds(1);
+    push(2, 0, 2, string(30, 'b'));
+    ASSERT_EQ(1, reassembler.getPendingCount());
+    ASSERT_EQ(Reassembler::getMessageOverhead(2) + 30, reassembler.getMemoryUsage());
+    ASSERT_TRUE(push(2, 1, 2, "c"));
+    ASSERT_EQ(string(30, 'b') + "c", getMessage());
+}
+
+TEST_F(FragmentationTest, it_counts_the_bookkeeping_of_the_announced_fragments) {
+    ASSERT_THROW(push(1, 0, MAX_FRAGMENT_COUNT, "a"), InvalidFragment);
+    ASSERT_EQ(0, reassembler.getPendingCount());
+    ASSERT_EQ(0, reassembler.getMemoryUsage());
+
+    ASSERT_FALSE(push(2, 0, 2, "abc"));
+    ASSERT_FALSE(push(3, 0, 5, "abc"));
+    ASSERT_EQ(1, reassembler.getPendingCount());
+    ASSERT_EQ(Reassembler::getMessageOverhead(5) + 3, reassembler.getMemoryUsage());
+}
+
+TEST_F(FragmentationTest, it_drops_the_oldest_message_to_stay_within_the_pending_count) {
+    Reassembler reassembler(100, 100000, base::Time::fromSeconds(1), 2);
+    Header header;
+    header.count = 2;
+    uint8_t data[1] = { 0 };
+    for (uint32_t id = 0; id < 3; ++id) {
+        header.message_id = id;
+        reassembler.push(header, data, data + 1, now);
+        now = now + base::Time::fromMilliseconds(1);
+    }
+    ASSERT_EQ(2, reassembler.getPendingCount());
+
+    header.index = 1;
+    header.message_id = 0;
+    ASSERT_FALSE(reassembler.push(header, data, data + 1, now));
+    header.message_id = 2;
+    ASSERT_TRUE(reassembler.push(header, data, data + 1, now));
+}
+
+TEST_F(FragmentationTest, it_does_not_keep_messages_made_of_a_single_fragment) {
+    ASSERT_TRUE(push(1, 0, 1, "abc"));
+    ASSERT_EQ("abc", getMessage());
+    ASSERT_EQ(0, reassembler.getPendingCount());
+    ASSERT_EQ(0, reassembler.getMemoryUsage());
+}
+
+TEST_F(FragmentationTest, it_rejects_a_message_bigger_than_the_max_message_size) {
+    Reassembler reassembler(10, Reassembler::getMessageOverhead(2) + 100,
+                            base::Time::fromSeconds(1));
+    Header header;
+    header.count = 2;
+    uint8_t data[8] = { 0 };
+    reassembler.push(header, data, data + 8, now);
+    header.index = 1;
+    ASSERT_THROW(reassembler.push(header, data, data + 8, now), InvalidFragment);
+    ASSERT_EQ(0, reassembler.getPendingCount());
+}
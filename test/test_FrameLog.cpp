@@ -0,0 +1,338 @@
+#include <gtest/gtest.h>
+#include "test.pb.h"
+#include <comms_protobuf/FrameLogReplayer.hpp>
+#include <iodrivers_base/FixtureGTest.hpp>
+#include <fstream>
+#include <unistd.h>
+
+using namespace std;
+using namespace comms_protobuf;
+using namespace comms_protobuf::frame_log;
+
+struct LoggedChannel : public Channel<test_channel::Local, test_channel::Local> {
+    typedef test_channel::Local Local;
+
+    LoggedChannel()
+        : Channel<Local, Local>(100) {
+    }
+};
+
+typedef FrameLogReplayer<test_channel::Local, test_channel::Local> Replayer;
+
+struct FrameLogTest : public ::testing::Test, iodrivers_base::Fixture<LoggedChannel> {
+    string path;
+    /** The other side of the channel */
+    LoggedChannel remote;
+
+    FrameLogTest() {
+        path = "/tmp/comms_protobuf_test_FrameLog." + to_string(getpid()) + ".log";
+        driver.openURI("test://");
+    }
+
+    ~FrameLogTest() {
+        unlink(path.c_str());
+        unlink((path + INDEX_SUFFIX).c_str());
+    }
+
+    vector<uint8_t> makeFrame(string const& payload) {
+        vector<uint8_t> frame(protocol::getFrameSize(payload.size()));
+        uint8_t const* begin = reinterpret_cast<uint8_t const*>(payload.data());
+        protocol::encodeFrame(&frame[0], &frame[0] + frame.size(),
+                              begin, begin + payload.size());
+        return frame;
+    }
+
+    void append(FrameLogWriter& writer, int64_t ms, string const& payload) {
+        auto frame = makeFrame(payload);
+        writer.append(base::Time::fromMilliseconds(ms), frame.data(), frame.size());
+    }
+
+    /** Overwrite the offset of an entry of the log's index */
+    void setIndexOffset(size_t entry, uint64_t offset) {
+        fstream index(path + INDEX_SUFFIX, ios::in | ios::out | ios::binary);
+        index.seekp(FILE_HEADER_SIZE + entry * INDEX_ENTRY_SIZE + 8);
+        for (int i = 0; i < 8; ++i, offset >>= 8) {
+            index.put(offset & 0xFF);
+        }
+    }
+
+    void writeIndexedLog() {
+        WriterOptions options;
+        options.index_interval = 100;
+        FrameLogWriter writer(path, options);
+        for (int i = 0; i < 100; ++i) {
+            append(writer, i * 10, to_string(i));
+        }
+    }
+
+    string readPayload(Record const& record) {
+        auto payload = protocol::getPayload(record.frame, record.frame + record.size);
+        return string(payload.first, payload.second);
+    }
+
+    /** Send messages from the remote side, and read them with the driver
+     * while recording them in the log
+     */
+    void recordMessages(vector<test_channel::Local> const& messages) {
+        FrameLogWriter writer(path);
+        driver.setReceiveLog(&writer);
+        vector<uint8_t> frames;
+        for (auto const& message : messages) {
+            remote.appendFrame(frames, message);
+        }
+        pushDataToDriver(frames);
+        for (size_t i = 0; i < messages.size(); ++i) {
+            driver.read();
+        }
+        driver.setReceiveLog(nullptr);
+    }
+};
+
+TEST_F(FrameLogTest, it_reads_back_the_appended_frames) {
+    {
+        FrameLogWriter writer(path);
+        append(writer, 1, "first");
+        append(writer, 2, "second");
+        ASSERT_EQ(2, writer.getFrameCount());
+    }
+
+    FrameLogReader reader(path);
+    Record record;
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(base::Time::fromMilliseconds(1), record.time);
+    ASSERT_EQ("first", readPayload(record));
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(base::Time::fromMilliseconds(2), record.time);
+    ASSERT_EQ("second", readPayload(record));
+    ASSERT_FALSE(reader.next(record));
+
+    reader.rewind();
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ("first", readPayload(record));
+}
+
+TEST_F(FrameLogTest, it_truncates_the_file_to_the_log_size_on_close) {
+    WriterOptions options;
+    options.growth_size = 4096;
+    FrameLogWriter writer(path, options);
+    for (int i = 0; i < 1000; ++i) {
+        append(writer, i, string(10, 'a'));
+    }
+    writer.close();
+
+    ifstream file(path, ios::binary | ios::ate);
+    ASSERT_EQ(writer.getSize(), static_cast<uint64_t>(file.tellg()));
+    ASSERT_EQ(FILE_HEADER_SIZE + 1000 * (RECORD_HEADER_SIZE + makeFrame(string(10, 'a')).size()),
+              writer.getSize());
+}
+
+TEST_F(FrameLogTest, it_stops_at_the_end_of_a_log_that_was_not_closed) {
+    FrameLogWriter writer(path);
+    append(writer, 1, "first");
+    writer.sync();
+
+    FrameLogReader reader(path);
+    Record record;
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ("first", readPayload(record));
+    ASSERT_FALSE(reader.next(record));
+}
+
+TEST_F(FrameLogTest, it_builds_a_sparse_index_and_seeks_with_it) {
+    WriterOptions options;
+    options.index_interval = 100;
+    {
+        FrameLogWriter writer(path, options);
+        for (int i = 0; i < 100; ++i) {
+            append(writer, i * 10, to_string(i));
+        }
+    }
+
+    FrameLogReader reader(path);
+    auto const& index = reader.getIndex();
+    ASSERT_GT(index.size(), 5);
+    ASSERT_LT(index.size(), 50);
+    ASSERT_EQ(base::Time(), index[0].time);
+    ASSERT_EQ(FILE_HEADER_SIZE, index[0].offset);
+
+    Record record;
+    reader.seek(base::Time::fromMilliseconds(425));
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ("43", readPayload(record));
+    reader.seek(base::Time::fromMilliseconds(430));
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ("43", readPayload(record));
+    reader.seek(base::Time::fromMilliseconds(0));
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ("0", readPayload(record));
+    reader.seek(base::Time::fromMilliseconds(10000));
+    ASSERT_FALSE(reader.next(record));
+}
+
+TEST_F(FrameLogTest, it_stops_loading_the_index_at_an_entry_before_the_first_record) {
+    writeIndexedLog();
+    setIndexOffset(3, 0);
+
+    FrameLogReader reader(path);
+    ASSERT_EQ(3, reader.getIndex().size());
+}
+
+TEST_F(FrameLogTest, it_stops_loading_the_index_at_a_non_increasing_entry) {
+    writeIndexedLog();
+    uint64_t offset = FrameLogReader(path).getIndex()[2].offset;
+    setIndexOffset(3, offset);
+
+    FrameLogReader reader(path);
+    ASSERT_EQ(3, reader.getIndex().size());
+}
+
+TEST_F(FrameLogTest, it_scans_the_log_if_the_index_entry_does_not_point_to_a_record) {
+    writeIndexedLog();
+    FrameLogReader original(path);
+    auto entry = original.getIndex()[4];
+    setIndexOffset(4, entry.offset + 1);
+
+    FrameLogReader reader(path);
+    ASSERT_EQ(entry.offset + 1, reader.getIndex()[4].offset);
+    reader.seek(entry.time + base::Time::fromMilliseconds(5));
+    Record record;
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(entry.time + base::Time::fromMilliseconds(10), record.time);
+}
+
+TEST_F(FrameLogTest, it_seeks_without_the_index) {
+    {
+        FrameLogWriter writer(path);
+        for (int i = 0; i < 10; ++i) {
+            append(writer, i * 10, to_string(i));
+        }
+    }
+    unlink((path + INDEX_SUFFIX).c_str());
+
+    FrameLogReader reader(path);
+    ASSERT_TRUE(reader.getIndex().empty());
+    reader.seek(base::Time::fromMilliseconds(55));
+    Record record;
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ("6", readPayload(record));
+}
+
+TEST_F(FrameLogTest, it_rejects_a_file_that_is_not_a_frame_log) {
+    ofstream(path) << "this is not a frame log";
+    ASSERT_THROW(FrameLogReader reader(path), InvalidFrameLog);
+}
+
+TEST_F(FrameLogTest, it_rejects_a_truncated_record) {
+    {
+        FrameLogWriter writer(path);
+        append(writer, 1, "first");
+    }
+    truncate(path.c_str(), FILE_HEADER_SIZE + RECORD_HEADER_SIZE + 2);
+
+    FrameLogReader reader(path);
+    Record record;
+    ASSERT_THROW(reader.next(record), InvalidFrameLog);
+}
+
+TEST_F(FrameLogTest, it_records_the_frames_received_by_a_channel) {
+    auto before = base::Time::now();
+    recordMessages({ test_channel::Local() });
+
+    FrameLogReader reader(path);
+    Record record;
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_LE(before, record.time);
+    ASSERT_LE(record.time, base::Time::now());
+    ASSERT_EQ(static_cast<int>(record.size),
+              protocol::extractPacket(record.frame, record.size, 100));
+    ASSERT_FALSE(reader.next(record));
+}
+
+TEST_F(FrameLogTest, it_replays_the_recorded_messages_into_a_channel) {
+    vector<test_channel::Local> messages(3);
+    for (int i = 0; i < 3; ++i) {
+        messages[i].set_something(i);
+    }
+    recordMessages(messages);
+
+    FrameLogReader reader(path);
+    LoggedChannel channel;
+    Replayer replayer(reader, channel);
+    vector<int> received;
+    size_t count = replayer.replay(
+        [&received](test_channel::Local const& message, base::Time const&) {
+            received.push_back(message.something());
+        }
+    );
+    ASSERT_EQ(3, count);
+    ASSERT_EQ(vector<int>({ 0, 1, 2 }), received);
+    ASSERT_EQ(3, channel.getStats().frames_received.get());
+}
+
+TEST_F(FrameLogTest, it_replays_encrypted_and_fragmented_messages) {
+    for (auto channel : { &driver, &remote }) {
+        channel->setEncryptionKey("test");
+        channel->enableFragmentation(10000, 20000, base::Time::fromSeconds(1));
+    }
+    test_channel::Local message;
+    message.set_something_else(string(5000, 'a'));
+    recordMessages({ message });
+
+    FrameLogReader reader(path);
+    LoggedChannel channel;
+    channel.setEncryptionKey("test");
+    channel.enableFragmentation(10000, 20000, base::Time::fromSeconds(1));
+    Replayer replayer(reader, channel);
+    string received;
+    ASSERT_EQ(1, replayer.replay(
+        [&received](test_channel::Local const& message, base::Time const&) {
+            received = message.something_else();
+        }
+    ));
+    ASSERT_EQ(string(5000, 'a'), received);
+}
+
+TEST_F(FrameLogTest, it_resumes_after_a_frame_that_cannot_be_decoded) {
+    {
+        FrameLogWriter writer(path);
+        append(writer, 1, "\xff");
+        test_channel::Local message;
+        message.set_something(42);
+        append(writer, 2, message.SerializeAsString());
+    }
+
+    FrameLogReader reader(path);
+    LoggedChannel channel;
+    Replayer replayer(reader, channel);
+    int received = 0;
+    auto callback = [&received](test_channel::Local const& message,
+                                base::Time const&) {
+        received = message.something();
+    };
+    ASSERT_THROW(replayer.replay(callback), InvalidProtobufMessage);
+    ASSERT_EQ(1, replayer.replay(callback));
+    ASSERT_EQ(42, received);
+}
+
+TEST_F(FrameLogTest, it_replays_in_real_time) {
+    {
+        test_channel::Local message;
+        FrameLogWriter writer(path);
+        for (int i = 0; i < 3; ++i) {
+            append(writer, 1000 + i * 100, message.SerializeAsString());
+        }
+    }
+
+    FrameLogReader reader(path);
+    LoggedChannel channel;
+    ReplayOptions options;
+    options.mode = REAL_TIME;
+    options.speed = 2;
+    Replayer replayer(reader, channel, options);
+
+    auto start = base::Time::now();
+    ASSERT_EQ(3, replayer.replay([](test_channel::Local const&, base::Time const&) {}));
+    auto duration = base::Time::now() - start;
+    ASSERT_LE(base::Time::fromMilliseconds(100), duration);
+    ASSERT_GT(base::Time::fromMilliseconds(180), duration);
+}
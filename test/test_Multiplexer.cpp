@@ -0,0 +1,208 @@
+#include <gtest/gtest.h>
+#include "test.pb.h"
+#include <comms_protobuf/MultiplexedStream.hpp>
+#include <iodrivers_base/FixtureGTest.hpp>
+#include <map>
+#include <thread>
+
+using namespace std;
+using namespace comms_protobuf;
+using namespace comms_protobuf::multiplexing;
+
+static const uint8_t CONTROL = 1;
+static const uint8_t BULK = 2;
+static const uint8_t TELEMETRY = 3;
+
+struct TestMultiplexer : public Multiplexer {
+    TestMultiplexer()
+        : Multiplexer(100) {
+        StreamOptions control;
+        control.priority = 10;
+        control.max_message_size = 50;
+        addStream(CONTROL, control);
+
+        StreamOptions bulk;
+        bulk.max_message_size = 10000;
+        bulk.fragmentation = true;
+        bulk.max_queue_size = 20000;
+        addStream(BULK, bulk);
+
+        StreamOptions telemetry;
+        telemetry.max_message_size = 50;
+        addStream(TELEMETRY, telemetry);
+    }
+};
+
+struct MultiplexerTest : public ::testing::Test, iodrivers_base::Fixture<TestMultiplexer> {
+    MultiplexerTest() {
+        driver.openURI("test://");
+    }
+
+    void queue(uint8_t stream, string const& data) {
+        uint8_t const* begin = reinterpret_cast<uint8_t const*>(data.data());
+        ASSERT_TRUE(driver.queue(stream, begin, begin + data.size()));
+    }
+
+    /** Stream IDs of the frames in a buffer */
+    vector<uint8_t> getFrameStreams(vector<uint8_t> const& buffer) {
+        vector<uint8_t> result;
+        size_t offset = 0;
+        while (offset < buffer.size()) {
+            int size = protocol::extractPacket(&buffer[offset], buffer.size() - offset,
+                                               100);
+            if (size <= 0) {
+                throw std::runtime_error("invalid frame in buffer");
+            }
+            auto payload = protocol::getPayload(&buffer[offset],
+                                                &buffer[offset + size]);
+            result.push_back(payload.first[0]);
+            offset += size;
+        }
+        return result;
+    }
+
+    pair<uint8_t, string> read() {
+        vector<uint8_t> message;
+        uint8_t stream = driver.read(message, base::Time::fromMilliseconds(10));
+        return make_pair(stream, string(message.begin(), message.end()));
+    }
+};
+
+TEST_F(MultiplexerTest, it_sends_and_receives_messages_on_several_streams) {
+    queue(TELEMETRY, "telemetry");
+    queue(BULK, string(500, 'b'));
+    driver.flush();
+    pushDataToDriver(readDataFromDriver());
+
+    ASSERT_EQ(make_pair(TELEMETRY, string("telemetry")), read());
+    ASSERT_EQ(make_pair(BULK, string(500, 'b')), read());
+}
+
+TEST_F(MultiplexerTest, it_preempts_bulk_traffic_between_fragments) {
+    queue(BULK, string(1000, 'b'));
+    ASSERT_TRUE(driver.writeNext());
+    ASSERT_TRUE(driver.writeNext());
+    queue(CONTROL, "stop");
+    driver.flush();
+
+    auto frames = getFrameStreams(readDataFromDriver());
+    ASSERT_EQ(BULK, frames[0]);
+    ASSERT_EQ(BULK, frames[1]);
+    ASSERT_EQ(CONTROL, frames[2]);
+    ASSERT_TRUE(std::all_of(frames.begin() + 3, frames.end(),
+                            [](uint8_t id) { return id == BULK; }));
+}
+
+TEST_F(MultiplexerTest, it_delivers_the_control_message_while_bulk_is_reassembled) {
+    queue(BULK, string(1000, 'b'));
+    driver.writeNext();
+    queue(CONTROL, "stop");
+    driver.flush();
+    pushDataToDriver(readDataFromDriver());
+
+    ASSERT_EQ(make_pair(CONTROL, string("stop")), read());
+    ASSERT_EQ(make_pair(BULK, string(1000, 'b')), read());
+}
+
+TEST_F(MultiplexerTest, it_round_robins_between_streams_of_equal_priority) {
+    queue(BULK, string(200, 'b'));
+    queue(TELEMETRY, "1");
+    queue(TELEMETRY, "2");
+    driver.flush();
+
+    auto frames = getFrameStreams(readDataFromDriver());
+    vector<uint8_t> expected = { BULK, TELEMETRY, BULK, TELEMETRY, BULK };
+    ASSERT_EQ(expected, frames);
+}
+
+TEST_F(MultiplexerTest, it_refuses_a_message_that_would_exceed_the_queue_size) {
+    queue(BULK, string(10000, 'b'));
+    queue(BULK, string(10000, 'b'));
+    uint8_t data[1] = {};
+    ASSERT_FALSE(driver.queue(BULK, data, data + 1));
+    ASSERT_EQ(20000, driver.getQueueSize(BULK));
+
+    driver.writeNext();
+    ASSERT_TRUE(driver.queue(BULK, data, data + 1));
+}
+
+TEST_F(MultiplexerTest, it_refuses_a_message_bigger_than_the_stream_max_size) {
+    string data(51, 'c');
+    uint8_t const* begin = reinterpret_cast<uint8_t const*>(data.data());
+    ASSERT_THROW(driver.queue(CONTROL, begin, begin + data.size()),
+                 std::invalid_argument);
+}
+
+TEST_F(MultiplexerTest, it_refuses_a_non_fragmented_stream_whose_messages_do_not_fit_a_frame) {
+    StreamOptions options;
+    options.max_message_size = 100;
+    ASSERT_THROW(driver.addStream(4, options), std::invalid_argument);
+    ASSERT_THROW(driver.addStream(CONTROL, StreamOptions()), std::invalid_argument);
+}
+
+TEST_F(MultiplexerTest, it_rejects_frames_for_an_unknown_stream) {
+    uint8_t payload[] = { 42, 1, 2 };
+    uint8_t buffer[16];
+    uint8_t* end = protocol::encodeFrame(buffer, buffer + 16, payload, payload + 3);
+    pushDataToDriver(buffer, end);
+    vector<uint8_t> message;
+    ASSERT_THROW(driver.read(message), UnknownStream);
+}
+
+TEST_F(MultiplexerTest, it_sends_protobuf_messages_on_a_stream) {
+    StreamOptions options;
+    options.max_message_size = 1000;
+    options.fragmentation = true;
+    MultiplexedStream<test_channel::Local, test_channel::Local> stream(
+        driver, 4, options
+    );
+
+    test_channel::Local local;
+    local.set_something_else(string(300, 'a'));
+    ASSERT_TRUE(stream.queue(local));
+    driver.flush();
+    pushDataToDriver(readDataFromDriver());
+
+    vector<uint8_t> bytes;
+    ASSERT_EQ(4, driver.read(bytes));
+    test_channel::Local received;
+    stream.parse(received, bytes);
+    ASSERT_EQ(string(300, 'a'), received.something_else());
+}
+
+TEST_F(MultiplexerTest, messages_may_be_queued_on_a_stream_from_several_threads) {
+    StreamOptions options;
+    options.max_message_size = 50;
+    MultiplexedStream<test_channel::Local, test_channel::Local> stream(
+        driver, 4, options
+    );
+
+    vector<thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&stream, i]() {
+            test_channel::Local local;
+            local.set_something_else(string(10 + 10 * i, 'a' + i));
+            for (int j = 0; j < 100; ++j) {
+                stream.queue(local);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    driver.flush();
+    pushDataToDriver(readDataFromDriver());
+
+    map<string, int> counts;
+    vector<uint8_t> bytes;
+    test_channel::Local received;
+    for (int i = 0; i < 400; ++i) {
+        ASSERT_EQ(4, driver.read(bytes));
+        stream.parse(received, bytes);
+        counts[received.something_else()]++;
+    }
+    ASSERT_EQ(4, counts.size());
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_EQ(100, counts[string(10 + 10 * i, 'a' + i)]);
+    }
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include "test.pb.h"
+#include <comms_protobuf/PipelinedReader.hpp>
+#include <sys/socket.h>
+
+using namespace std;
+using namespace comms_protobuf;
+
+typedef Channel<test_channel::Local, test_channel::Local> PipelinedTestChannel;
+typedef PipelinedReader<test_channel::Local, test_channel::Local> TestReader;
+
+struct PipelinedReaderTest : public ::testing::Test {
+    PipelinedTestChannel sender;
+    PipelinedTestChannel receiver;
+
+    PipelinedReaderTest()
+        : sender(100)
+        , receiver(100) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            throw std::runtime_error("failed to create the socket pair");
+        }
+        sender.setFileDescriptor(fds[0]);
+        receiver.setFileDescriptor(fds[1]);
+    }
+
+    void setEncryptionKey() {
+        protocol::aes_key key;
+        key.fill(0x42);
+        sender.setEncryptionKey(key);
+        receiver.setEncryptionKey(key);
+    }
+
+    void writeMessages(int count) {
+        for (int i = 0; i < count; ++i) {
+            test_channel::Local local;
+            local.set_something(i);
+            sender.write(local);
+        }
+    }
+};
+
+TEST_F(PipelinedReaderTest, it_returns_the_messages_in_order) {
+    TestReader reader(receiver, 4, 8);
+    writeMessages(100);
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(i, reader.read(base::Time::fromSeconds(1)).something());
+    }
+}
+
+TEST_F(PipelinedReaderTest, it_decrypts_the_messages) {
+    setEncryptionKey();
+    TestReader reader(receiver, 4, 8);
+    writeMessages(100);
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(i, reader.read(base::Time::fromSeconds(1)).something());
+    }
+}
+
+TEST_F(PipelinedReaderTest, it_rejects_replayed_messages) {
+    setEncryptionKey();
+    TestReader reader(receiver, 2);
+
+    vector<uint8_t> frame;
+    test_channel::Local local;
+    local.set_something(10);
+    sender.appendFrame(frame, local);
+    sender.writePacket(frame.data(), frame.size());
+    sender.writePacket(frame.data(), frame.size());
+    local.set_something(20);
+    sender.write(local);
+
+    ASSERT_EQ(10, reader.read(base::Time::fromSeconds(1)).something());
+    ASSERT_THROW(reader.read(base::Time::fromSeconds(1)), ReplayedMessage);
+    ASSERT_EQ(20, reader.read(base::Time::fromSeconds(1)).something());
+}
+
+TEST_F(PipelinedReaderTest, it_rejects_the_receiver_own_messages_reflected_back) {
+    setEncryptionKey();
+    TestReader reader(receiver, 2);
+
+    vector<uint8_t> frame;
+    test_channel::Local local;
+    local.set_something(10);
+    receiver.appendFrame(frame, local);
+    sender.writePacket(frame.data(), frame.size());
+    local.set_something(20);
+    sender.write(local);
+
+    ASSERT_THROW(reader.read(base::Time::fromSeconds(1)), ReplayedMessage);
+    ASSERT_EQ(20, reader.read(base::Time::fromSeconds(1)).something());
+}
+
+TEST_F(PipelinedReaderTest, it_reports_invalid_messages_in_order) {
+    TestReader reader(receiver, 2);
+
+    writeMessages(1);
+    uint8_t invalid[5] = { 1, 2, 3, 4, 5 };
+    uint8_t buffer[32];
+    uint8_t* end = protocol::encodeFrame(buffer, buffer + 32, invalid, invalid + 5);
+    sender.writePacket(buffer, end - buffer);
+    writeMessages(2);
+
+    ASSERT_EQ(0, reader.read(base::Time::fromSeconds(1)).something());
+    ASSERT_THROW(reader.read(base::Time::fromSeconds(1)), InvalidProtobufMessage);
+    ASSERT_EQ(0, reader.read(base::Time::fromSeconds(1)).something());
+    ASSERT_EQ(1, reader.read(base::Time::fromSeconds(1)).something());
+}
+
+TEST_F(PipelinedReaderTest, it_times_out_if_no_message_is_received) {
+    TestReader reader(receiver, 2);
+    ASSERT_THROW(reader.read(base::Time::fromMilliseconds(10)),
+                 iodrivers_base::TimeoutError);
+}
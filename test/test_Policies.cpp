@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include "test.pb.h"
+#include <comms_protobuf/Channel.hpp>
+#include <iodrivers_base/FixtureGTest.hpp>
+
+using namespace std;
+using namespace comms_protobuf;
+using namespace comms_protobuf::policies;
+
+template<typename Framing, typename Integrity, typename Cipher, size_t MaxSize = 100>
+struct PolicyChannel : public Channel<test_channel::Local, test_channel::Local,
+                                      Framing, Integrity, Cipher> {
+    typedef test_channel::Local Local;
+    typedef Channel<Local, Local, Framing, Integrity, Cipher> Base;
+
+    PolicyChannel()
+        : Base(MaxSize) {
+    }
+};
+
+typedef PolicyChannel<FixedWidthFraming<1>, NoIntegrity, NoCipher> TinyChannel;
+typedef PolicyChannel<FixedWidthFraming<2>, CRC16Integrity, RuntimeCipher> FixedChannel;
+
+template<typename Driver>
+struct PolicyChannelTest : public ::testing::Test, iodrivers_base::Fixture<Driver> {
+    /** The other side of the channel */
+    Driver remote;
+
+    /** Send a message from the remote side and read it */
+    test_channel::Local roundTrip(test_channel::Local const& local) {
+        std::vector<uint8_t> frame;
+        remote.appendFrame(frame, local);
+        last_frame_size = frame.size();
+        this->pushDataToDriver(frame);
+        return this->driver.read();
+    }
+
+    size_t last_frame_size = 0;
+};
+
+typedef PolicyChannelTest<TinyChannel> TinyChannelTest;
+typedef PolicyChannelTest<FixedChannel> FixedChannelTest;
+
+TEST_F(TinyChannelTest, it_sends_frames_with_a_single_byte_length_and_no_crc) {
+    test_channel::Local local;
+    local.set_something_else("hello");
+    ASSERT_EQ("hello", roundTrip(local).something_else());
+    ASSERT_EQ(3 + protocol::getSerializedSize(local), last_frame_size);
+}
+
+TEST_F(TinyChannelTest, it_resynchronizes_on_garbage) {
+    test_channel::Local local;
+    local.set_something(42);
+    driver.write(local);
+    auto frame = readDataFromDriver();
+
+    uint8_t garbage[] = { 0, protocol::SYNC_0, 1, 2 };
+    pushDataToDriver(garbage, garbage + sizeof(garbage));
+    pushDataToDriver(frame);
+    ASSERT_EQ(42, driver.read().something());
+    ASSERT_EQ(sizeof(garbage), driver.getStats().bytes_skipped.get());
+}
+
+TEST_F(TinyChannelTest, it_rejects_a_length_bigger_than_the_max_message_size) {
+    uint8_t frame[] = { protocol::SYNC_0, protocol::SYNC_1, 101 };
+    pushDataToDriver(frame, frame + sizeof(frame));
+    ASSERT_THROW(driver.read(base::Time::fromMilliseconds(10)),
+                 iodrivers_base::TimeoutError);
+    ASSERT_EQ(1, driver.getStats().oversize_rejections.get());
+}
+
+TEST_F(FixedChannelTest, it_round_trips_encrypted_and_fragmented_messages) {
+    for (auto channel : { &driver, &remote }) {
+        channel->setEncryptionKey("test");
+        channel->enableFragmentation(10000, 10000, base::Time::fromSeconds(1));
+    }
+
+    test_channel::Local local;
+    local.set_something_else(string(1000, 'a'));
+    ASSERT_EQ(string(1000, 'a'), roundTrip(local).something_else());
+}
+
+TEST_F(FixedChannelTest, it_rejects_frames_with_a_bad_crc) {
+    test_channel::Local local;
+    local.set_something(42);
+    driver.write(local);
+    auto frame = readDataFromDriver();
+    frame[5] ^= 1;
+    pushDataToDriver(frame);
+    ASSERT_THROW(driver.read(base::Time::fromMilliseconds(10)),
+                 iodrivers_base::TimeoutError);
+    ASSERT_EQ(1, driver.getStats().crc_failures.get());
+}
+
+TEST(PoliciesTest, a_single_byte_length_is_compatible_with_the_protocol_frames) {
+    typedef FrameCodec<FixedWidthFraming<1>, CRC16Integrity> Codec;
+    uint8_t payload[] = { 1, 2, 3 };
+    uint8_t expected[16];
+    uint8_t* expected_end = protocol::encodeFrame(expected, expected + 16,
+                                                  payload, payload + 3);
+
+    // A one-byte length is a valid varint for lengths below 128
+    uint8_t buffer[16];
+    uint8_t* data = Codec::encodeFrameHeader(buffer, buffer + 16, 3);
+    std::copy(payload, payload + 3, data);
+    uint8_t* end = Codec::encodeFrameTrailer(buffer, data + 3);
+    ASSERT_EQ(vector<uint8_t>(expected, expected_end), vector<uint8_t>(buffer, end));
+}
+
+TEST(PoliciesTest, the_generic_codec_matches_the_protocol_for_varint_frames) {
+    typedef PolicyChannel<VarintFraming, CRC16Integrity, RuntimeCipher> Default;
+    static_assert(std::is_base_of<Channel<test_channel::Local, test_channel::Local>,
+                                  Default>::value,
+                  "the default policies must be the plain Channel");
+
+    // Use the generic template instead of the specialization that forwards
+    // to protocol
+    struct GenericIntegrity : CRC16Integrity {};
+    typedef FrameCodec<VarintFraming, GenericIntegrity> Generic;
+
+    vector<uint8_t> payload(300, 0x42);
+    vector<uint8_t> expected(400);
+    uint8_t* expected_end = protocol::encodeFrame(
+        expected.data(), expected.data() + expected.size(),
+        payload.data(), payload.data() + payload.size()
+    );
+    expected.resize(expected_end - expected.data());
+
+    vector<uint8_t> frame(Generic::getFrameSize(payload.size()));
+    uint8_t* data = Generic::encodeFrameHeader(
+        frame.data(), frame.data() + frame.size(), payload.size()
+    );
+    std::copy(payload.begin(), payload.end(), data);
+    Generic::encodeFrameTrailer(frame.data(), data + payload.size());
+    ASSERT_EQ(expected, frame);
+
+    protocol::RejectionReason reason;
+    for (size_t size = 0; size < frame.size(); ++size) {
+        ASSERT_EQ(0, Generic::extractPacket(frame.data(), size, 300, true, &reason));
+    }
+    ASSERT_EQ(static_cast<int>(frame.size()),
+              Generic::extractPacket(frame.data(), frame.size(), 300, true, &reason));
+    ASSERT_LT(Generic::extractPacket(frame.data(), frame.size(), 299, true, &reason), 0);
+    ASSERT_EQ(protocol::REJECTED_LENGTH, reason);
+
+    // The reason is optional, as in protocol::extractPacket
+    ASSERT_LT(Generic::extractPacket(frame.data(), frame.size(), 299), 0);
+    frame.back() ^= 0xFF;
+    ASSERT_LT(Generic::extractPacket(frame.data(), frame.size(), 300), 0);
+    uint8_t garbage[] = { 0, protocol::SYNC_0 };
+    ASSERT_LT(Generic::extractPacket(garbage, sizeof(garbage), 300), 0);
+}
+
+TEST(PoliciesTest, it_refuses_a_max_message_size_that_does_not_fit_the_length_field) {
+    typedef PolicyChannel<FixedWidthFraming<1>, NoIntegrity, NoCipher, 256> TooBig;
+    ASSERT_THROW(TooBig channel, std::invalid_argument);
+}
+
+TEST(PoliciesTest, it_refuses_encryption_if_the_ciphertext_does_not_fit_the_length_field) {
+    typedef PolicyChannel<FixedWidthFraming<1>, NoIntegrity, RuntimeCipher, 255> Small;
+    Small channel;
+    ASSERT_THROW(channel.setEncryptionKey("test"), std::invalid_argument);
+    ASSERT_FALSE(channel.isEncrypted());
+}
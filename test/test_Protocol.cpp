@@ -119,6 +119,47 @@ TEST_F(ProtocolTest, it_computes_the_CRC) {
     ASSERT_EQ(0x9189, crc);
 }
 
+static uint16_t bitwiseCRC(uint8_t const* begin, uint8_t const* end) {
+    uint32_t crc = 0x1D0F;
+    for (auto it = begin; it != end; ++it) {
+        crc = crc ^ (static_cast<uint16_t>(*it) << 8);
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+        crc = crc & 0xffff;
+    }
+    return crc;
+}
+
+TEST_F(ProtocolTest, it_computes_the_same_CRC_than_the_bitwise_algorithm) {
+    vector<uint8_t> buffer(1027);
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        buffer[i] = (i * 7919) >> 3;
+    }
+
+    for (size_t size = 0; size < buffer.size(); size += 13) {
+        ASSERT_EQ(bitwiseCRC(&buffer[0], &buffer[size]),
+                  protocol::crc(&buffer[0], &buffer[size]));
+    }
+}
+
+TEST_F(ProtocolTest, it_computes_the_CRC_incrementally) {
+    vector<uint8_t> buffer(100);
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        buffer[i] = i * 3;
+    }
+
+    uint8_t const* end = buffer.data() + buffer.size();
+    uint16_t expected = protocol::crc(buffer.data(), end);
+    for (size_t split = 0; split < buffer.size(); ++split) {
+        uint16_t crc = protocol::crc_update(
+            protocol::CRC_INIT, buffer.data(), buffer.data() + split
+        );
+        crc = protocol::crc_update(crc, buffer.data() + split, end);
+        ASSERT_EQ(expected, crc);
+    }
+}
+
 TEST_F(ProtocolTest, it_recognizes_a_well_formed_packet) {
     uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x37, 0xF0 };
     ASSERT_EQ(10, protocol::extractPacket(buffer, 10, 100));
@@ -169,6 +210,15 @@ TEST_F(ProtocolTest, it_creates_a_well_formed_packet) {
     ASSERT_THAT(buffer, ElementsAreArray(expected));
 }
 
+TEST_F(ProtocolTest, it_creates_a_well_formed_packet_with_an_empty_payload) {
+    uint8_t buffer[5];
+    ASSERT_EQ(5, protocol::getFrameSize(0));
+
+    uint8_t* end = protocol::encodeFrame(buffer, buffer + 5, buffer, buffer);
+    ASSERT_EQ(end, buffer + 5);
+    ASSERT_EQ(5, protocol::extractPacket(buffer, 5, 100));
+}
+
 TEST_F(ProtocolTest, it_throws_if_trying_to_encode_a_packet_in_a_buffer_too_small) {
     uint8_t buffer[10];
     uint8_t payload[5] = { 1, 2, 3, 4, 5 };
@@ -187,24 +237,50 @@ TEST_F(ProtocolTest, it_rejects_the_whole_buffer_if_there_is_no_SYNC_0) {
     ASSERT_EQ(-5, protocol::extractPacket(buffer, 5, 100));
 }
 
+TEST_F(ProtocolTest, it_skips_a_SYNC_0_byte_not_followed_by_SYNC_1) {
+    uint8_t buffer[6] = { 0xB5, 2, 0xB5, 0xB5, 0x62, 5 };
+    ASSERT_EQ(-3, protocol::extractPacket(buffer, 6, 100));
+}
+
+TEST_F(ProtocolTest, it_waits_for_more_bytes_if_the_length_field_may_still_be_valid) {
+    uint8_t buffer[5] = { 0xB5, 0x62, 0x80, 0x80, 0x80 };
+    ASSERT_EQ(0, protocol::extractPacket(buffer, 5, 0x1000000));
+}
+
+TEST_F(ProtocolTest, it_skips_to_the_next_sync_pair_when_rejecting_a_packet) {
+    uint8_t buffer[14] = { 0xB5, 0x62, 0x05, 1, 0xB5, 3, 0xB5, 0x62, 0x37, 0xF1,
+                           0xB5, 0x62, 0x37, 0xF1 };
+    ASSERT_EQ(-6, protocol::extractPacket(buffer, 14, 100));
+}
+
+TEST_F(ProtocolTest, it_keeps_a_trailing_SYNC_0_when_rejecting_a_packet) {
+    uint8_t buffer[11] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x37, 0xF1, 0xB5 };
+    ASSERT_EQ(-10, protocol::extractPacket(buffer, 11, 100));
+}
+
 TEST_F(ProtocolTest, it_rejects_a_packet_whose_length_is_above_the_max_length) {
     uint8_t buffer[5] = { 0xB5, 0x62, 0x81, 0x1, 0x2 };
-    ASSERT_EQ(-1, protocol::extractPacket(buffer, 5, 0x80));
+    ASSERT_EQ(-5, protocol::extractPacket(buffer, 5, 0x80));
 }
 
 TEST_F(ProtocolTest, it_rejects_a_packet_whose_field_length_is_above_the_max_field_length) {
     uint8_t buffer[5] = { 0xB5, 0x62, 0x80, 0x80, 0x80 };
-    ASSERT_EQ(-1, protocol::extractPacket(buffer, 5, 100));
+    ASSERT_EQ(-5, protocol::extractPacket(buffer, 5, 100));
 }
 
 TEST_F(ProtocolTest, it_rejects_a_packet_whose_CRC_MSB_does_not_match) {
     uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x37, 0xF1 };
-    ASSERT_EQ(-1, protocol::extractPacket(buffer, 10, 100));
+    ASSERT_EQ(-10, protocol::extractPacket(buffer, 10, 100));
 }
 
 TEST_F(ProtocolTest, it_rejects_a_packet_whose_CRC_LSB_does_not_match) {
     uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x38, 0xF0 };
-    ASSERT_EQ(-1, protocol::extractPacket(buffer, 10, 100));
+    ASSERT_EQ(-10, protocol::extractPacket(buffer, 10, 100));
+}
+
+TEST_F(ProtocolTest, it_accepts_a_packet_with_an_invalid_CRC_if_the_check_is_disabled) {
+    uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x00, 0x00 };
+    ASSERT_EQ(10, protocol::extractPacket(buffer, 10, 100, false));
 }
 
 TEST_F(ProtocolTest, it_encrypts_and_decrypts_a_plaintext) {
@@ -213,10 +289,12 @@ TEST_F(ProtocolTest, it_encrypts_and_decrypts_a_plaintext) {
     uint8_t encrypted[protocol::CipherContext::getMaxCiphertextLength(10)];
     size_t encrypted_size = 0;
     protocol::aes_tag tag;
+    protocol::aes_iv iv;
     {
         protocol::CipherContext encryption_ctx("some psk");
+        iv = encryption_ctx.nextIV();
         encrypted_size = protocol::encrypt(
-            encryption_ctx, encrypted, tag, buffer, 10
+            encryption_ctx, iv, encrypted, tag, buffer, 10
         );
     }
     ASSERT_LE(encrypted_size, protocol::CipherContext::getMaxCiphertextLength(10));
@@ -225,7 +303,7 @@ TEST_F(ProtocolTest, it_encrypts_and_decrypts_a_plaintext) {
     size_t final_size;
     {
         protocol::CipherContext decryption_ctx("some psk");
-        final_size = protocol::decrypt(decryption_ctx, final,
+        final_size = protocol::decrypt(decryption_ctx, iv, final,
                                        encrypted, encrypted_size, tag);
     }
 
@@ -233,6 +311,25 @@ TEST_F(ProtocolTest, it_encrypts_and_decrypts_a_plaintext) {
     EXPECT_THAT(final, ElementsAreArray(buffer));
 }
 
+TEST_F(ProtocolTest, it_reuses_the_cipher_context_for_successive_messages) {
+    protocol::CipherContext ctx("some psk");
+
+    for (uint8_t i = 0; i < 3; ++i) {
+        uint8_t buffer[10] = { i, 0x62, 0x05, 1, 2, 3, 4, 5, 0x38, 0xF0 };
+        uint8_t encrypted[protocol::CipherContext::getMaxCiphertextLength(10)];
+        protocol::aes_tag tag;
+        protocol::aes_iv iv = ctx.nextIV();
+        size_t encrypted_size = protocol::encrypt(ctx, iv, encrypted, tag,
+                                                  buffer, 10);
+
+        uint8_t final[10];
+        size_t final_size = protocol::decrypt(ctx, iv, final, encrypted,
+                                              encrypted_size, tag);
+        ASSERT_EQ(10, final_size);
+        EXPECT_THAT(final, ElementsAreArray(buffer));
+    }
+}
+
 TEST_F(ProtocolTest, it_detects_modifications_to_the_tag) {
     uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x38, 0xF0 };
 
@@ -240,14 +337,15 @@ TEST_F(ProtocolTest, it_detects_modifications_to_the_tag) {
     protocol::CipherContext ctx("some psk");
 
     protocol::aes_tag tag;
+    protocol::aes_iv iv = ctx.nextIV();
     size_t encrypted_size = protocol::encrypt(
-        ctx, encrypted, tag, buffer, 10
+        ctx, iv, encrypted, tag, buffer, 10
     );
     tag[2] += 1;
 
     uint8_t final[10];
     ASSERT_THROW(
-        (protocol::decrypt(ctx, final, encrypted, encrypted_size, tag)),
+        (protocol::decrypt(ctx, iv, final, encrypted, encrypted_size, tag)),
         DecryptionFailed
     );
 }
@@ -259,14 +357,303 @@ TEST_F(ProtocolTest, it_detects_modifications_to_the_encrypted_data) {
     protocol::CipherContext ctx("some psk");
 
     protocol::aes_tag tag;
+    protocol::aes_iv iv = ctx.nextIV();
     size_t encrypted_size = protocol::encrypt(
-        ctx, encrypted, tag, buffer, 10
+        ctx, iv, encrypted, tag, buffer, 10
     );
     encrypted[2] += 1;
 
     uint8_t final[10];
     ASSERT_THROW(
-        (protocol::decrypt(ctx, final, encrypted, encrypted_size, tag)),
+        (protocol::decrypt(ctx, iv, final, encrypted, encrypted_size, tag)),
         DecryptionFailed
     );
 }
+
+TEST_F(ProtocolTest, it_detects_a_modification_of_the_IV) {
+    uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x38, 0xF0 };
+
+    uint8_t encrypted[protocol::CipherContext::getMaxCiphertextLength(10)];
+    protocol::CipherContext ctx("some psk");
+
+    protocol::aes_tag tag;
+    protocol::aes_iv iv = ctx.nextIV();
+    size_t encrypted_size = protocol::encrypt(
+        ctx, iv, encrypted, tag, buffer, 10
+    );
+    iv[5] += 1;
+
+    uint8_t final[10];
+    ASSERT_THROW(
+        (protocol::decrypt(ctx, iv, final, encrypted, encrypted_size, tag)),
+        DecryptionFailed
+    );
+}
+
+TEST_F(ProtocolTest, it_generates_IVs_made_of_the_session_a_counter_and_the_algorithm) {
+    protocol::CipherContext ctx("some psk", protocol::CHACHA20_POLY1305);
+    ctx.send_counter = 0x02030405060708;
+    auto iv = ctx.nextIV();
+
+    auto const& s = ctx.session;
+    uint8_t expected[16] = { s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7],
+                             8, 7, 6, 5, 4, 3, 2, protocol::CHACHA20_POLY1305 };
+    ASSERT_THAT(iv, ElementsAreArray(expected));
+    ASSERT_EQ(ctx.session, protocol::getIVSession(iv));
+    ASSERT_EQ(0x02030405060708, protocol::getIVCounter(iv));
+    ASSERT_EQ(protocol::CHACHA20_POLY1305, protocol::getIVAlgorithm(iv));
+    ASSERT_EQ(0x02030405060709, protocol::getIVCounter(ctx.nextIV()));
+}
+
+TEST_F(ProtocolTest, it_refuses_to_generate_an_IV_past_the_max_counter) {
+    protocol::CipherContext ctx("some psk");
+    ctx.send_counter = protocol::CipherContext::MAX_IV_COUNTER;
+    ctx.nextIV();
+    ASSERT_THROW(ctx.nextIV(), EncryptionFailed);
+}
+
+TEST_F(ProtocolTest, it_decrypts_with_the_algorithm_given_by_the_IV) {
+    uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x38, 0xF0 };
+    protocol::CipherContext decryption_ctx("some psk", protocol::AES_256_GCM);
+
+    for (auto algorithm : { protocol::AES_256_GCM, protocol::CHACHA20_POLY1305 }) {
+        protocol::CipherContext encryption_ctx("some psk", algorithm);
+        uint8_t encrypted[protocol::CipherContext::getMaxCiphertextLength(10)];
+        protocol::aes_tag tag;
+        protocol::aes_iv iv = encryption_ctx.nextIV();
+        size_t encrypted_size = protocol::encrypt(
+            encryption_ctx, iv, encrypted, tag, buffer, 10
+        );
+
+        uint8_t decrypted[10];
+        ASSERT_EQ(10, protocol::decrypt(decryption_ctx, iv, decrypted,
+                                        encrypted, encrypted_size, tag));
+        ASSERT_THAT(decrypted, ElementsAreArray(buffer));
+
+        // Claiming the other algorithm must fail the authentication
+        iv[15] = 1 - algorithm;
+        ASSERT_THROW(protocol::decrypt(decryption_ctx, iv, decrypted,
+                                       encrypted, encrypted_size, tag),
+                     DecryptionFailed);
+    }
+}
+
+TEST_F(ProtocolTest, it_rejects_an_IV_with_an_unknown_algorithm) {
+    protocol::CipherContext ctx("some psk");
+    auto iv = ctx.nextIV();
+    iv[15] = 2;
+    uint8_t data[4] = {};
+    protocol::aes_tag tag = {};
+    ASSERT_THROW(protocol::decrypt(ctx, iv, data, data, 4, tag), DecryptionFailed);
+}
+
+TEST_F(ProtocolTest, it_resolves_the_automatic_cipher_selection) {
+    auto fastest = protocol::getFastestCipherAlgorithm();
+    ASSERT_TRUE(fastest == protocol::AES_256_GCM ||
+                fastest == protocol::CHACHA20_POLY1305);
+    ASSERT_EQ(fastest, protocol::getFastestCipherAlgorithm());
+
+    protocol::CipherContext ctx("some psk", protocol::AUTO_CIPHER);
+    ASSERT_EQ(fastest, ctx.algorithm);
+}
+
+static protocol::aes_iv makeIV(uint8_t session, uint64_t counter) {
+    protocol::aes_iv iv;
+    std::fill(iv.begin(), iv.begin() + 8, session);
+    for (int i = 8; i < 16; ++i, counter >>= 8) {
+        iv[i] = counter & 0xFF;
+    }
+    return iv;
+}
+
+TEST_F(ProtocolTest, the_replay_window_accepts_increasing_counters) {
+    protocol::ReplayWindow window;
+    for (uint64_t i = 0; i < 200; i += 3) {
+        ASSERT_TRUE(window.isAcceptable(makeIV(1, i)));
+        window.update(makeIV(1, i));
+    }
+}
+
+TEST_F(ProtocolTest, the_replay_window_rejects_an_already_received_counter) {
+    protocol::ReplayWindow window;
+    window.update(makeIV(1, 10));
+    window.update(makeIV(1, 12));
+    ASSERT_FALSE(window.isAcceptable(makeIV(1, 10)));
+    ASSERT_FALSE(window.isAcceptable(makeIV(1, 12)));
+}
+
+TEST_F(ProtocolTest, the_replay_window_accepts_out_of_order_counters_within_the_window) {
+    protocol::ReplayWindow window;
+    window.update(makeIV(1, 100));
+    ASSERT_TRUE(window.isAcceptable(makeIV(1, 99)));
+    ASSERT_TRUE(window.isAcceptable(makeIV(1, 37)));
+    window.update(makeIV(1, 37));
+    ASSERT_FALSE(window.isAcceptable(makeIV(1, 37)));
+}
+
+TEST_F(ProtocolTest, the_replay_window_rejects_counters_older_than_the_window) {
+    protocol::ReplayWindow window;
+    window.update(makeIV(1, 100));
+    ASSERT_FALSE(window.isAcceptable(makeIV(1, 36)));
+}
+
+TEST_F(ProtocolTest, the_replay_window_starts_a_new_window_on_session_change) {
+    protocol::ReplayWindow window;
+    window.update(makeIV(1, 100));
+    ASSERT_TRUE(window.isAcceptable(makeIV(2, 0)));
+    window.update(makeIV(2, 0));
+    ASSERT_FALSE(window.isAcceptable(makeIV(2, 0)));
+    ASSERT_TRUE(window.isAcceptable(makeIV(2, 1)));
+}
+
+TEST_F(ProtocolTest, the_replay_window_rejects_the_messages_of_a_retired_session) {
+    protocol::ReplayWindow window;
+    window.update(makeIV(1, 100));
+    window.update(makeIV(2, 0));
+    ASSERT_FALSE(window.isAcceptable(makeIV(1, 101)));
+    ASSERT_FALSE(window.isAcceptable(makeIV(1, 0)));
+
+    window.reset();
+    ASSERT_FALSE(window.isAcceptable(makeIV(2, 1)));
+    ASSERT_TRUE(window.isAcceptable(makeIV(3, 0)));
+}
+
+TEST_F(ProtocolTest, the_replay_window_forgets_the_oldest_retired_session_first) {
+    protocol::ReplayWindow window;
+    auto sessionIV = [](size_t session, uint64_t counter) {
+        protocol::aes_iv iv = makeIV(0, counter);
+        iv[0] = session & 0xFF;
+        iv[1] = session >> 8;
+        return iv;
+    };
+    size_t count = protocol::ReplayWindow::MAX_RETIRED_SESSIONS + 1;
+    for (size_t i = 1; i <= count + 1; ++i) {
+        window.update(sessionIV(i, 0));
+    }
+    ASSERT_TRUE(window.isAcceptable(sessionIV(1, 1)));
+    for (size_t i = 2; i <= count; ++i) {
+        ASSERT_FALSE(window.isAcceptable(sessionIV(i, 1)));
+    }
+}
+
+TEST_F(ProtocolTest, the_replay_window_rejects_the_messages_of_the_local_session) {
+    protocol::ReplayWindow window;
+    protocol::session_id local;
+    local.fill(1);
+    window.setLocalSession(local);
+    ASSERT_FALSE(window.isAcceptable(makeIV(1, 0)));
+    ASSERT_TRUE(window.isAcceptable(makeIV(2, 0)));
+}
+
+TEST_F(ProtocolTest, it_derives_a_different_key_for_each_session) {
+    auto key = protocol::deriveKey("some psk");
+    protocol::session_id a, b;
+    a.fill(1);
+    b.fill(2);
+    ASSERT_EQ(protocol::deriveSessionKey(key, a), protocol::deriveSessionKey(key, a));
+    ASSERT_NE(protocol::deriveSessionKey(key, a), protocol::deriveSessionKey(key, b));
+    ASSERT_NE(key, protocol::deriveSessionKey(key, a));
+}
+
+TEST_F(ProtocolTest, it_rejects_a_message_whose_IV_claims_another_session) {
+    uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x38, 0xF0 };
+    protocol::CipherContext sender("some psk");
+    protocol::CipherContext receiver("some psk");
+
+    uint8_t encrypted[protocol::CipherContext::getMaxCiphertextLength(10)];
+    protocol::aes_tag tag;
+    protocol::aes_iv iv = sender.nextIV();
+    size_t encrypted_size = protocol::encrypt(sender, iv, encrypted, tag, buffer, 10);
+
+    uint8_t decrypted[10];
+    protocol::aes_iv forged = iv;
+    forged[0] ^= 1;
+    ASSERT_THROW(protocol::decrypt(receiver, forged, decrypted,
+                                   encrypted, encrypted_size, tag),
+                 DecryptionFailed);
+    ASSERT_EQ(10, protocol::decrypt(receiver, iv, decrypted,
+                                    encrypted, encrypted_size, tag));
+    ASSERT_THAT(decrypted, ElementsAreArray(buffer));
+}
+
+TEST_F(ProtocolTest, it_formats_and_parses_a_key) {
+    protocol::aes_key key;
+    for (size_t i = 0; i < key.size(); ++i) {
+        key[i] = i * 9;
+    }
+    auto formatted = protocol::formatKey(key);
+    ASSERT_EQ("0009121b242d363f48515a636c757e87"
+              "9099a2abb4bdc6cfd8e1eaf3fc050e17", formatted);
+    ASSERT_EQ(key, protocol::parseKey(formatted));
+}
+
+TEST_F(ProtocolTest, it_rejects_an_invalid_key_string) {
+    ASSERT_THROW(protocol::parseKey("0011"), std::invalid_argument);
+    ASSERT_THROW(protocol::parseKey(string(64, 'g')), std::invalid_argument);
+}
+
+TEST_F(ProtocolTest, it_returns_the_same_key_from_the_cache_than_from_the_derivation) {
+    ASSERT_EQ(protocol::deriveKey("some psk"),
+              protocol::getDerivedKey("some psk"));
+}
+
+TEST_F(ProtocolTest, contexts_created_from_the_PSK_and_the_derived_key_are_compatible) {
+    uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x38, 0xF0 };
+    protocol::CipherContext from_psk("some psk");
+    protocol::CipherContext from_key(protocol::deriveKey("some psk"));
+
+    uint8_t encrypted[protocol::CipherContext::getMaxCiphertextLength(10)];
+    protocol::aes_tag tag;
+    protocol::aes_iv iv = from_psk.nextIV();
+    size_t encrypted_size = protocol::encrypt(from_psk, iv, encrypted, tag,
+                                              buffer, 10);
+
+    uint8_t final[10];
+    protocol::decrypt(from_key, iv, final, encrypted, encrypted_size, tag);
+    EXPECT_THAT(final, ElementsAreArray(buffer));
+}
+
+TEST_F(ProtocolTest, it_keeps_the_key_of_an_unknown_session_for_the_next_message) {
+    uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x38, 0xF0 };
+    protocol::CipherContext sender("some psk");
+    protocol::CipherContext receiver("some psk");
+
+    uint8_t encrypted[protocol::CipherContext::getMaxCiphertextLength(10)];
+    protocol::aes_tag tag;
+    protocol::aes_iv iv = sender.nextIV();
+    size_t encrypted_size = protocol::encrypt(sender, iv, encrypted, tag, buffer, 10);
+
+    uint8_t decrypted[10];
+    protocol::aes_iv forged = iv;
+    forged[0] ^= 1;
+    protocol::session_id forged_session = protocol::getIVSession(forged);
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_THROW(protocol::decrypt(receiver, forged, decrypted,
+                                       encrypted, encrypted_size, tag),
+                     DecryptionFailed);
+        ASSERT_TRUE(receiver.has_candidate_session);
+        ASSERT_EQ(forged_session, receiver.candidate_session);
+    }
+    ASSERT_EQ(10, protocol::decrypt(receiver, iv, decrypted,
+                                    encrypted, encrypted_size, tag));
+    ASSERT_THAT(decrypted, ElementsAreArray(buffer));
+}
+
+TEST_F(ProtocolTest, it_decrypts_again_the_previous_session_after_a_session_change) {
+    uint8_t buffer[10] = { 0xB5, 0x62, 0x05, 1, 2, 3, 4, 5, 0x38, 0xF0 };
+    protocol::CipherContext first("some psk");
+    protocol::CipherContext second("some psk");
+    protocol::CipherContext receiver("some psk");
+
+    for (auto sender : { &first, &second, &first, &first }) {
+        uint8_t encrypted[protocol::CipherContext::getMaxCiphertextLength(10)];
+        protocol::aes_tag tag;
+        protocol::aes_iv iv = sender->nextIV();
+        size_t encrypted_size = protocol::encrypt(*sender, iv, encrypted, tag, buffer, 10);
+
+        uint8_t decrypted[10];
+        ASSERT_EQ(10, protocol::decrypt(receiver, iv, decrypted,
+                                        encrypted, encrypted_size, tag));
+        ASSERT_THAT(decrypted, ElementsAreArray(buffer));
+    }
+}
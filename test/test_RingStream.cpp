@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+#include "test.pb.h"
+#include <comms_protobuf/Channel.hpp>
+#include <comms_protobuf/RingStream.hpp>
+#include <thread>
+
+using namespace std;
+using namespace comms_protobuf;
+
+TEST(RingBufferTest, it_rounds_the_capacity_to_the_next_power_of_two) {
+    RingBuffer ring(100);
+    ASSERT_EQ(128, ring.getCapacity());
+}
+
+TEST(RingBufferTest, it_returns_the_bytes_in_order_across_the_end_of_the_ring) {
+    RingBuffer ring(16);
+    vector<uint8_t> input(40);
+    for (size_t i = 0; i < input.size(); ++i) {
+        input[i] = i;
+    }
+
+    vector<uint8_t> output;
+    size_t written = 0;
+    while (output.size() < input.size()) {
+        written += ring.write(&input[written], min<size_t>(input.size() - written, 7));
+        uint8_t buffer[5];
+        size_t size = ring.read(buffer, 5);
+        output.insert(output.end(), buffer, buffer + size);
+    }
+    ASSERT_EQ(input, output);
+}
+
+TEST(RingBufferTest, it_does_not_write_more_than_its_capacity) {
+    RingBuffer ring(16);
+    uint8_t buffer[20] = { 0 };
+    ASSERT_EQ(16, ring.write(buffer, 20));
+    ASSERT_EQ(0, ring.write(buffer, 20));
+    ASSERT_EQ(16, ring.getSize());
+}
+
+TEST(RingBufferTest, waiting_times_out_if_no_data_is_written) {
+    RingBuffer ring(16);
+    ASSERT_FALSE(ring.waitRead(base::Time::fromMilliseconds(10)));
+}
+
+TEST(RingBufferTest, waiting_returns_once_data_is_written_by_another_thread) {
+    RingBuffer ring(16);
+    std::thread producer([&ring]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        uint8_t byte = 42;
+        ring.write(&byte, 1);
+    });
+    ASSERT_TRUE(ring.waitRead(base::Time::fromSeconds(1)));
+    producer.join();
+    ASSERT_EQ(1, ring.getSize());
+}
+
+typedef Channel<test_channel::Local, test_channel::Local> InProcessChannel;
+
+struct RingStreamTest : public ::testing::Test {
+    InProcessChannel channel0;
+    InProcessChannel channel1;
+
+    RingStreamTest()
+        : channel0(100)
+        , channel1(100) {
+    }
+};
+
+TEST_F(RingStreamTest, it_connects_two_channels) {
+    connectInProcess(channel0, channel1, 1024);
+
+    test_channel::Local local;
+    local.set_something(10);
+    channel0.write(local);
+    ASSERT_EQ(10, channel1.read(base::Time::fromSeconds(1)).something());
+    local.set_something(20);
+    channel1.write(local);
+    ASSERT_EQ(20, channel0.read(base::Time::fromSeconds(1)).something());
+}
+
+TEST_F(RingStreamTest, it_transfers_more_than_the_ring_capacity_between_threads) {
+    connectInProcess(channel0, channel1, 256);
+    channel0.setWriteTimeout(base::Time::fromSeconds(1));
+    channel1.setCRCCheck(false);
+
+    std::thread producer([this]() {
+        test_channel::Local local;
+        local.set_something_else(string(50, 'a'));
+        for (int i = 0; i < 1000; ++i) {
+            local.set_something(i);
+            channel0.write(local);
+        }
+    });
+
+    test_channel::Local received;
+    for (int i = 0; i < 1000; ++i) {
+        channel1.read(received, base::Time::fromSeconds(1));
+        ASSERT_EQ(i, received.something());
+    }
+    producer.join();
+}
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+#include "test.pb.h"
+#include <comms_protobuf/Channel.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace comms_protobuf;
+
+typedef Channel<test_channel::Local, test_channel::Local> SharedMemoryChannel;
+
+struct SharedMemoryStreamTest : public ::testing::Test {
+    string name;
+    SharedMemoryChannel server;
+    SharedMemoryChannel client;
+
+    SharedMemoryStreamTest()
+        : name("comms_protobuf_test_" + to_string(getpid()))
+        , server(100)
+        , client(100) {
+    }
+};
+
+TEST_F(SharedMemoryStreamTest, it_exchanges_messages_in_both_directions) {
+    server.openURI("shmserver://" + name + "?capacity=4096");
+    client.openURI("shm://" + name);
+
+    test_channel::Local local;
+    local.set_something(10);
+    client.write(local);
+    ASSERT_EQ(10, server.read(base::Time::fromSeconds(1)).something());
+    local.set_something(20);
+    server.write(local);
+    ASSERT_EQ(20, client.read(base::Time::fromSeconds(1)).something());
+}
+
+TEST_F(SharedMemoryStreamTest, it_throws_when_attaching_to_a_non_existent_segment) {
+    ASSERT_THROW(client.openURI("shm://" + name), iodrivers_base::UnixError);
+}
+
+TEST_F(SharedMemoryStreamTest, it_removes_the_segment_when_the_server_is_closed) {
+    server.openURI("shmserver://" + name);
+    server.close();
+    ASSERT_THROW(client.openURI("shm://" + name), iodrivers_base::UnixError);
+}
+
+TEST_F(SharedMemoryStreamTest, it_aligns_the_rings_of_small_capacities) {
+    server.openURI("shmserver://" + name + "?capacity=32");
+    client.openURI("shm://" + name);
+
+    test_channel::Local local;
+    local.set_something(10);
+    client.write(local);
+    ASSERT_EQ(10, server.read(base::Time::fromSeconds(1)).something());
+}
+
+TEST_F(SharedMemoryStreamTest, it_refuses_to_replace_an_existing_segment_by_default) {
+    server.openURI("shmserver://" + name);
+    SharedMemoryChannel other(100);
+    try {
+        other.openURI("shmserver://" + name);
+        FAIL() << "creating an existing segment did not throw";
+    }
+    catch (iodrivers_base::UnixError const& e) {
+        ASSERT_EQ(EEXIST, e.error);
+    }
+
+    client.openURI("shm://" + name);
+    test_channel::Local local;
+    local.set_something(10);
+    client.write(local);
+    ASSERT_EQ(10, server.read(base::Time::fromSeconds(1)).something());
+}
+
+TEST_F(SharedMemoryStreamTest, it_replaces_an_existing_segment_if_requested) {
+    server.openURI("shmserver://" + name);
+    SharedMemoryChannel other(100);
+    other.openURI("shmserver://" + name + "?capacity=4096&replace=1");
+    client.openURI("shm://" + name);
+
+    test_channel::Local local;
+    local.set_something(10);
+    client.write(local);
+    ASSERT_EQ(10, other.read(base::Time::fromSeconds(1)).something());
+}
+
+TEST_F(SharedMemoryStreamTest, it_rejects_invalid_capacities) {
+    for (string capacity : { "", "abc", "0", "-1", "10k", "99999999999999999999999" }) {
+        ASSERT_THROW(server.openURI("shmserver://" + name + "?capacity=" + capacity),
+                     std::invalid_argument) << capacity;
+    }
+    ASSERT_THROW(server.openURI("shmserver://" + name + "?replace=yes"),
+                 std::invalid_argument);
+}
+
+TEST_F(SharedMemoryStreamTest, it_refuses_to_attach_to_a_segment_with_an_invalid_capacity) {
+    server.openURI("shmserver://" + name + "?capacity=4096");
+
+    int fd = shm_open(("/" + name).c_str(), O_RDWR, 0);
+    ASSERT_LE(0, fd);
+    void* mapping = mmap(nullptr, 16, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    ASSERT_NE(MAP_FAILED, mapping);
+    // The capacity follows the magic and version fields
+    uint64_t* capacity = reinterpret_cast<uint64_t*>(
+        static_cast<uint8_t*>(mapping) + 8
+    );
+    ASSERT_EQ(4096, *capacity);
+
+    uint64_t invalid[] = {
+        0, 3000, 8192, static_cast<uint64_t>(1) << 62, ~static_cast<uint64_t>(0)
+    };
+    for (uint64_t value : invalid) {
+        *capacity = value;
+        ASSERT_THROW(client.openURI("shm://" + name), std::runtime_error);
+    }
+    *capacity = 4096;
+    munmap(mapping, 16);
+    client.openURI("shm://" + name);
+}
+
+TEST_F(SharedMemoryStreamTest, it_transfers_messages_between_processes) {
+    server.openURI("shmserver://" + name + "?capacity=256");
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        SharedMemoryChannel child(100);
+        child.openURI("shm://" + name);
+        child.setWriteTimeout(base::Time::fromSeconds(5));
+        test_channel::Local local;
+        local.set_something_else(string(50, 'a'));
+        for (int i = 0; i < 1000; ++i) {
+            local.set_something(i);
+            child.write(local);
+        }
+        _exit(0);
+    }
+
+    test_channel::Local received;
+    for (int i = 0; i < 1000; ++i) {
+        server.read(received, base::Time::fromSeconds(5));
+        ASSERT_EQ(i, received.something());
+    }
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+}
@@ -0,0 +1,218 @@
+#include <gtest/gtest.h>
+#include "test.pb.h"
+#include <comms_protobuf/Channel.hpp>
+#include <iodrivers_base/FixtureGTest.hpp>
+
+using namespace std;
+using namespace comms_protobuf;
+using stats::LatencyHistogram;
+
+TEST(LatencyHistogramTest, it_maps_values_to_buckets_with_a_bounded_relative_error) {
+    for (uint64_t value : { 0, 1, 7, 8, 9, 15, 16, 17, 100, 1000, 123456789 }) {
+        size_t index = LatencyHistogram::getBucketIndex(value);
+        uint64_t lower = LatencyHistogram::getBucketLowerBound(index);
+        uint64_t upper = LatencyHistogram::getBucketLowerBound(index + 1);
+        ASSERT_LE(lower, value);
+        ASSERT_LT(value, upper);
+        ASSERT_LE(upper - lower, max<uint64_t>(1, value / 8));
+    }
+}
+
+TEST(LatencyHistogramTest, it_counts_values_bigger_than_the_range_in_the_last_bucket) {
+    ASSERT_EQ(LatencyHistogram::BUCKET_COUNT - 1,
+              LatencyHistogram::getBucketIndex(UINT64_MAX));
+}
+
+TEST(LatencyHistogramTest, it_computes_quantiles) {
+    if (!stats::ENABLED) {
+        return;
+    }
+
+    LatencyHistogram histogram;
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        histogram.record(i * 1000);
+    }
+    ASSERT_EQ(1000, histogram.getCount());
+    ASSERT_EQ(500500000, histogram.getSum());
+    ASSERT_EQ(1000000, histogram.getMax());
+    ASSERT_NEAR(500000, histogram.getQuantile(0.5), 500000 / 8);
+    ASSERT_NEAR(990000, histogram.getQuantile(0.99), 990000 / 8);
+    ASSERT_NEAR(1000000, histogram.getQuantile(1), 1000000 / 8);
+
+    histogram.reset();
+    ASSERT_EQ(0, histogram.getCount());
+    ASSERT_EQ(0, histogram.getQuantile(0.5));
+}
+
+struct StatsChannel : public Channel<test_channel::Local, test_channel::Local> {
+    typedef test_channel::Local Local;
+
+    StatsChannel()
+        : Channel<Local, Local>(100) {
+    }
+};
+
+struct ChannelStatsTest :
+    public ::testing::Test, iodrivers_base::Fixture<StatsChannel> {
+
+    ChannelStatsTest() {
+        driver.openURI("test://");
+    }
+
+    vector<uint8_t> getFrame() {
+        test_channel::Local local;
+        local.set_something(10);
+        driver.write(local);
+        return readDataFromDriver();
+    }
+};
+
+TEST_F(ChannelStatsTest, it_counts_and_times_the_messages) {
+    if (!stats::ENABLED) {
+        return;
+    }
+
+    auto frame = getFrame();
+    pushDataToDriver(frame);
+    driver.read();
+
+    auto const& stats = driver.getStats();
+    ASSERT_EQ(1, stats.frames_sent.get());
+    ASSERT_EQ(frame.size(), stats.bytes_sent.get());
+    ASSERT_EQ(1, stats.frames_received.get());
+    ASSERT_EQ(frame.size(), stats.bytes_received.get());
+    ASSERT_EQ(1, stats.encode_time.getCount());
+    ASSERT_EQ(1, stats.parse_time.getCount());
+    ASSERT_EQ(0, stats.encrypt_time.getCount());
+
+    driver.resetStats();
+    ASSERT_EQ(0, stats.frames_sent.get());
+    ASSERT_EQ(0, stats.encode_time.getCount());
+}
+
+TEST_F(ChannelStatsTest, it_counts_skipped_bytes_and_crc_failures) {
+    if (!stats::ENABLED) {
+        return;
+    }
+
+    auto frame = getFrame();
+    auto corrupted = frame;
+    corrupted[corrupted.size() - 1] ^= 0xFF;
+    vector<uint8_t> data = { 1, 2, 3 };
+    data.insert(data.end(), corrupted.begin(), corrupted.end());
+    data.insert(data.end(), frame.begin(), frame.end());
+    pushDataToDriver(data);
+    driver.read();
+
+    auto const& stats = driver.getStats();
+    ASSERT_EQ(3 + corrupted.size(), stats.bytes_skipped.get());
+    ASSERT_EQ(1, stats.crc_failures.get());
+    ASSERT_EQ(1, stats.frames_received.get());
+}
+
+TEST_F(ChannelStatsTest, it_counts_skipped_bytes_only_once_when_draining) {
+    if (!stats::ENABLED) {
+        return;
+    }
+
+    // A valid frame, a corrupted one, a valid one, 30 bytes of noise and
+    // a last valid frame
+    auto frame = getFrame();
+    vector<uint8_t> data;
+    for (int i = 0; i < 4; ++i) {
+        data.insert(data.end(), frame.begin(), frame.end());
+    }
+    data[2 * frame.size() - 1] ^= 0xFF;
+    data.insert(data.begin() + 3 * frame.size(), 30, 0);
+    pushDataToDriver(data);
+    ASSERT_EQ(3, driver.drain([](test_channel::Local&) {}));
+
+    auto const& stats = driver.getStats();
+    ASSERT_EQ(30 + frame.size(), stats.bytes_skipped.get());
+    ASSERT_EQ(1, stats.crc_failures.get());
+    ASSERT_EQ(3, stats.frames_received.get());
+}
+
+TEST_F(ChannelStatsTest, it_counts_skipped_bytes_read_through_the_base_driver) {
+    if (!stats::ENABLED) {
+        return;
+    }
+
+    auto frame = getFrame();
+    vector<uint8_t> data(20, 0);
+    data.insert(data.end(), frame.begin(), frame.end());
+    data.insert(data.end(), 10, 0);
+    data.insert(data.end(), frame.begin(), frame.end());
+    pushDataToDriver(data);
+
+    iodrivers_base::Driver& base = driver;
+    vector<uint8_t> buffer(base.getMaxPacketSize());
+    ASSERT_EQ(frame.size(), base.readPacket(buffer.data(), buffer.size()));
+    ASSERT_TRUE(base.hasPacket());
+    ASSERT_EQ(frame.size(), base.readPacket(buffer.data(), buffer.size()));
+    ASSERT_EQ(30, driver.getStats().bytes_skipped.get());
+}
+
+TEST_F(ChannelStatsTest, it_counts_oversize_rejections) {
+    if (!stats::ENABLED) {
+        return;
+    }
+
+    vector<uint8_t> payload(200);
+    vector<uint8_t> data(protocol::getFrameSize(payload.size()));
+    protocol::encodeFrame(data.data(), data.data() + data.size(),
+                          payload.data(), payload.data() + payload.size());
+    pushDataToDriver(data);
+    ASSERT_THROW(driver.read(base::Time::fromMilliseconds(10)),
+                 iodrivers_base::TimeoutError);
+    ASSERT_EQ(1, driver.getStats().oversize_rejections.get());
+}
+
+TEST_F(ChannelStatsTest, it_counts_parse_failures) {
+    if (!stats::ENABLED) {
+        return;
+    }
+
+    uint8_t payload[] = { 0xFF, 0xFF, 0xFF };
+    uint8_t buffer[64];
+    uint8_t* end = protocol::encodeFrame(buffer, buffer + 64, payload, payload + 3);
+    pushDataToDriver(buffer, end);
+    ASSERT_THROW(driver.read(), InvalidProtobufMessage);
+    ASSERT_EQ(1, driver.getStats().parse_failures.get());
+    ASSERT_EQ(1, driver.getStats().parse_time.getCount());
+}
+
+TEST_F(ChannelStatsTest, it_times_encryption_and_counts_decryption_failures) {
+    if (!stats::ENABLED) {
+        return;
+    }
+
+    driver.setEncryptionKey("test");
+    getFrame();
+    ASSERT_EQ(1, driver.getStats().encrypt_time.getCount());
+
+    // Frames sent by the channel itself are rejected before decryption, use
+    // a frame from the remote side
+    StatsChannel remote;
+    remote.setEncryptionKey("test");
+    test_channel::Local local;
+    local.set_something(10);
+    vector<uint8_t> frame;
+    remote.appendFrame(frame, local);
+    // Corrupt the ciphertext and recompute the CRC, so that the frame is
+    // extracted but does not authenticate
+    auto payload = protocol::getPayload(frame.data(), frame.data() + frame.size());
+    vector<uint8_t> corrupted_payload(payload.first, payload.second);
+    corrupted_payload.back() ^= 0xFF;
+    vector<uint8_t> corrupted(frame.size());
+    protocol::encodeFrame(corrupted.data(), corrupted.data() + corrupted.size(),
+                          corrupted_payload.data(),
+                          corrupted_payload.data() + corrupted_payload.size());
+    pushDataToDriver(corrupted);
+    ASSERT_THROW(driver.read(), DecryptionFailed);
+
+    auto const& stats = driver.getStats();
+    ASSERT_EQ(1, stats.encrypt_time.getCount());
+    ASSERT_EQ(1, stats.decrypt_time.getCount());
+    ASSERT_EQ(1, stats.decrypt_failures.get());
+}